@@ -0,0 +1,268 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "simulatedFileSystem.h"
+
+/* In-process benchmark of the file system library.
+ *
+ * Runs the same cycle of operations "rounds" times, once through the typed calls and
+ * once as text lines through fs_command, and reports the time per operation of both.
+ * A cycle creates a file, grows it, looks at it and its directory and removes it again.
+ * Then writes, reads and stats of one file are timed by name and through a descriptor,
+ * and once more through a descriptor with the whole file moved as one vectored call.
+ * Last, files of a large tree are looked up in a scattered order, which is where the pages
+ * backing the disk show: run it with "base" and with "thp" or "huge" to compare. Where the
+ * kernel offers hardware counters, the dTLB and cache misses per lookup are counted too.
+ *
+ * usage: bench [rounds] [base|thp|huge]
+ */
+
+#define LINESIZE 128
+#define OPERATIONS 5	//operations per cycle
+#define IO_OPERATIONS 3	//operations per input/output cycle
+#define IO_SIZE 100
+#define SEGMENTS 50	//segments per vectored call, together the whole hot file
+#define TREE_DIRECTORIES 8
+#define TREE_FILES 100	//per directory; with the directories, most of the disk's control blocks
+
+int rounds = 100000;
+
+/*--------------------------------------------------------------------------------*/
+
+long now_nanoseconds ( ) {
+	struct timespec now;
+
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+long run_typed ( fs_handle *fs ) {
+	fs_stat_type stat;
+
+	long start = now_nanoseconds();
+	for ( int r = 0; r < rounds; r++ ) {
+		if ( fs_mkfile(fs, "f", 100) != FS_OK || fs_resize(fs, "f", 6000) != FS_OK
+			|| fs_stat(fs, "f", &stat) != FS_OK || fs_stat(fs, ".", &stat) != FS_OK
+			|| fs_remove(fs, "f") != FS_OK ) {
+			fprintf( stderr, "bench: typed cycle %d failed\n", r );
+			exit(1);
+		}
+	}
+	return now_nanoseconds() - start;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//The text commands closest to the typed cycle; their output is thrown away
+long run_text ( fs_handle *fs, FILE *sink ) {
+	char *lines[OPERATIONS] = { "mkfil f 100\n", "szfil f 6000\n", "find f\n", "du\n", "rmfil f\n" };
+
+	long start = now_nanoseconds();
+	for ( int r = 0; r < rounds; r++ )
+		for ( int k = 0; k < OPERATIONS; k++ )
+			fs_command( fs, lines[k], sink );
+	return now_nanoseconds() - start;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+long run_named_io ( fs_handle *fs ) {
+	char buffer[IO_SIZE] = { 0 };
+	fs_stat_type stat;
+
+	long start = now_nanoseconds();
+	for ( int r = 0; r < rounds; r++ ) {
+		int offset = (r % 50) * IO_SIZE;
+		if ( fs_write(fs, "hot", offset, buffer, IO_SIZE) != IO_SIZE || fs_read(fs, "hot", offset, buffer, IO_SIZE) != IO_SIZE
+			|| fs_stat(fs, "hot", &stat) != FS_OK ) {
+			fprintf( stderr, "bench: named io cycle %d failed\n", r );
+			exit(1);
+		}
+	}
+	return now_nanoseconds() - start;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+long run_descriptor_io ( fs_handle *fs ) {
+	char buffer[IO_SIZE] = { 0 };
+	fs_stat_type stat;
+
+	long start = now_nanoseconds();
+	int fd = fs_open(fs, "hot");
+	for ( int r = 0; r < rounds; r++ ) {
+		int offset = (r % 50) * IO_SIZE;
+		if ( fs_pwrite(fd, offset, buffer, IO_SIZE) != IO_SIZE || fs_pread(fd, offset, buffer, IO_SIZE) != IO_SIZE
+			|| fs_fstat(fd, &stat) != FS_OK ) {
+			fprintf( stderr, "bench: descriptor io cycle %d failed\n", r );
+			exit(1);
+		}
+	}
+	fs_close(fd);
+	return now_nanoseconds() - start;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Every cycle moves SEGMENTS times the bytes of the others, so the time is per segment
+long run_vectored_io ( fs_handle *fs ) {
+	static char buffer[SEGMENTS][IO_SIZE];
+	fs_segment segments[SEGMENTS];
+	fs_stat_type stat;
+
+	for ( int s = 0; s < SEGMENTS; s++ )
+		segments[s] = (fs_segment){ s * IO_SIZE, buffer[s], IO_SIZE };
+	long start = now_nanoseconds();
+	int fd = fs_open(fs, "hot");
+	for ( int r = 0; r < rounds; r++ ) {
+		if ( fs_pwritev(fd, segments, SEGMENTS) != SEGMENTS*IO_SIZE || fs_preadv(fd, segments, SEGMENTS) != SEGMENTS*IO_SIZE
+			|| fs_fstat(fd, &stat) != FS_OK ) {
+			fprintf( stderr, "bench: vectored io cycle %d failed\n", r );
+			exit(1);
+		}
+	}
+	fs_close(fd);
+	return now_nanoseconds() - start;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//A hardware counter of the calling thread, user space only; -1 where there is none, as in most virtual
+//machines or with a strict kernel.perf_event_paranoid
+int counter_open ( uint32_t type, uint64_t config ) {
+	struct perf_event_attr attr;
+
+	memset( &attr, 0, sizeof(attr) );
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return syscall( SYS_perf_event_open, &attr, 0, -1, -1, 0 );
+}
+
+/*--------------------------------------------------------------------------------*/
+
+long counter_read ( int fd ) {
+	long value;
+
+	if ( fd < 0 || read(fd, &value, sizeof(value)) != sizeof(value) )
+		return -1;
+	return value;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Looks up the files of the tree in a scattered order, every lookup in another directory, and counts the
+//dTLB and cache misses of the loop; a count is -1 without the counter
+long run_tree_lookups ( fs_handle *fs, long *tlb_misses, long *cache_misses ) {
+	char directory[LINESIZE], name[LINESIZE];
+	fs_stat_type stat;
+
+	int tlb = counter_open( PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+		| (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) );
+	int cache = counter_open( PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES );
+	long tlb_start = counter_read(tlb), cache_start = counter_read(cache);
+
+	long start = now_nanoseconds();
+	for ( int r = 0; r < rounds; r++ ) {
+		int d = r % TREE_DIRECTORIES;
+		int f = (int)(((long)r * 7919) % TREE_FILES);
+		snprintf( directory, sizeof(directory), "t%d", d );
+		snprintf( name, sizeof(name), "t%d_%d", d, f );
+		if ( fs_chdir(fs, directory) != FS_OK || fs_stat(fs, name, &stat) != FS_OK || fs_chdir(fs, "..") != FS_OK ) {
+			fprintf( stderr, "bench: tree lookup %d failed\n", r );
+			exit(1);
+		}
+	}
+	long elapsed = now_nanoseconds() - start;
+
+	*tlb_misses = tlb < 0 ? -1 : counter_read(tlb) - tlb_start;
+	*cache_misses = cache < 0 ? -1 : counter_read(cache) - cache_start;
+	if ( tlb >= 0 ) close(tlb);
+	if ( cache >= 0 ) close(cache);
+	return elapsed;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Misses per lookup, or "-" without the counter
+char *per_lookup ( long misses, char *text ) {
+	if ( misses < 0 )
+		return "-";
+	sprintf( text, "%.2f", (double)misses / rounds );
+	return text;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+int main ( int argc, char *argv[] ) {
+	char *modes[] = { "base", "thp", "huge" };
+	int mode = FS_PAGES_BASE;
+
+	if ( argc > 1 ) rounds = atoi(argv[1]);
+	if ( argc > 2 )
+		for ( mode = FS_PAGES_HUGE; mode > FS_PAGES_BASE && strcmp(argv[2], modes[mode]) != 0; mode-- )
+			;
+	if ( rounds < 1 || (argc > 2 && strcmp(argv[2], modes[mode]) != 0) ) {
+		fprintf( stderr, "usage: %s [rounds] [base|thp|huge]\n", argv[0] );
+		return 1;
+	}
+
+	FILE *sink = fopen( "/dev/null", "w" );
+	fs_pages( mode );
+	fs_format();
+	fs_handle *fs = fs_attach();
+	fs_mkdir( fs, "bench" );
+	fs_chdir( fs, "bench" );
+
+	long typed = run_typed(fs);
+	long text = run_text(fs, sink);
+
+	//Enough files around the hot one that looking it up by name is not free
+	char name[LINESIZE];
+	for ( int i = 0; i < 100; i++ ) {
+		snprintf( name, sizeof(name), "f%d", i );
+		fs_mkfile( fs, name, 0 );
+	}
+	fs_mkfile( fs, "hot", 50*IO_SIZE );
+	long named = run_named_io(fs);
+	long descriptor = run_descriptor_io(fs);
+	long vectored = run_vectored_io(fs);
+
+	for ( int d = 0; d < TREE_DIRECTORIES; d++ ) {
+		snprintf( name, sizeof(name), "t%d", d );
+		fs_mkdir( fs, name );
+		fs_chdir( fs, name );
+		for ( int f = 0; f < TREE_FILES; f++ ) {
+			snprintf( name, sizeof(name), "t%d_%d", d, f );
+			fs_mkfile( fs, name, 0 );
+		}
+		fs_chdir( fs, ".." );
+	}
+	long tlb_misses, cache_misses;
+	long tree = run_tree_lookups(fs, &tlb_misses, &cache_misses);
+
+	printf("%8s %12s %12s\n", "api", "ops", "ns/op");
+	printf("%8s %12d %12.0f\n", "typed", rounds*OPERATIONS, (double)typed/(rounds*OPERATIONS));
+	printf("%8s %12d %12.0f\n", "text", rounds*OPERATIONS, (double)text/(rounds*OPERATIONS));
+	printf("%8s %12d %12.0f\n", "by name", rounds*IO_OPERATIONS, (double)named/(rounds*IO_OPERATIONS));
+	printf("%8s %12d %12.0f\n", "by fd", rounds*IO_OPERATIONS, (double)descriptor/(rounds*IO_OPERATIONS));
+	printf("%8s %12d %12.0f\n", "vectored", rounds*IO_OPERATIONS*SEGMENTS, (double)vectored/(rounds*IO_OPERATIONS*SEGMENTS));
+
+	char tlb_text[LINESIZE], cache_text[LINESIZE];
+	printf("\n%8s %12s %12s %12s %12s\n", "pages", "lookups", "ns/lookup", "dTLB miss", "cache miss");
+	printf("%8s %12d %12.0f %12s %12s\n", modes[mode], rounds, (double)tree/rounds,
+		per_lookup(tlb_misses, tlb_text), per_lookup(cache_misses, cache_text));
+
+	fs_detach(fs);
+	fclose(sink);
+	return 0;
+}
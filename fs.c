@@ -0,0 +1,345 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdbool.h>
+#include <poll.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "simulatedFileSystem.h"
+
+/* Command line front end of the file system library.
+ *
+ * Reads commands from stdin, or with "-s path" serves clients on a Unix domain socket.
+ * Every command line goes through fs_command; see simulatedFileSystem.c for the commands.
+ * "-t file" records a command trace of the run, which the replay tool can run again.
+ * "-p thp" backs the disk with transparent huge pages, "-p huge" with reserved ones.
+ * "-v a.img,b.img,..." keeps the disk in a volume striped over those image files.
+ *
+ * usage: fs [-t trace] [-p base|thp|huge] [-v member,...] [-s socket]
+ */
+
+#define LINESIZE 128
+#define MAX_EVENTS 64
+#define SESSION_BUFFER (64*LINESIZE)	//pipelined commands a client may have in flight
+
+//One connected client of the server
+typedef struct {
+	int fd;
+	fs_handle *fs;			//keeps this client's working directory
+	char in[SESSION_BUFFER];	//received bytes that do not form a complete line yet
+	int in_length;
+	char *out;			//responses not sent yet
+	size_t out_length;
+	size_t out_sent;
+	bool closing;			//client sent "exit" or shut its side; close once everything is sent
+} session;
+
+volatile sig_atomic_t stopping;	//set by SIGINT or SIGTERM; the server then shuts down cleanly
+
+int serve(char *path);
+void stop ( int signal );
+void run_background_tasks ( bool idle );
+void session_receive ( int epoll_fd, session *client );
+void session_run ( session *client, const char *text, size_t length );
+void session_send ( int epoll_fd, session *client );
+void session_append ( session *client, const char *data, size_t length );
+void session_close ( int epoll_fd, session *client );
+
+/*--------------------------------------------------------------------------------*/
+
+int main(int argc, char *argv[])
+{
+    char in[LINESIZE];
+    char *socket_path = NULL;
+    const char *members[FS_MAX_MEMBERS];
+    int member_count = 0;
+    int option;
+
+	while ((option = getopt(argc, argv, "s:t:p:v:")) != -1)
+	  {
+	    if (option == 's')
+	      { socket_path = optarg; }
+	    else if (option == 't' && fs_trace_start(optarg) != 0)
+	      { perror(optarg); return 1; }
+	    else if (option == 'p' && strcmp(optarg, "base") == 0)
+	      { fs_pages(FS_PAGES_BASE); }
+	    else if (option == 'p' && strcmp(optarg, "thp") == 0)
+	      { fs_pages(FS_PAGES_TRANSPARENT); }
+	    else if (option == 'p' && strcmp(optarg, "huge") == 0)
+	      { fs_pages(FS_PAGES_HUGE); }
+	    else if (option == 'v')
+	      {
+	        for (char *member = strtok(optarg, ","); member != NULL && member_count <= FS_MAX_MEMBERS; member = strtok(NULL, ","))
+	          { if (member_count < FS_MAX_MEMBERS) members[member_count] = member; member_count++; }
+	        if (fs_volume(members, member_count) != 0)
+	          { fprintf(stderr, "%s: a volume takes 1 to %d members\n", argv[0], FS_MAX_MEMBERS); return 1; }
+	      }
+	    else if (option == '?' || option == 'p')
+	      { fprintf(stderr, "usage: %s [-t trace] [-p base|thp|huge] [-v member,...] [-s socket]\n", argv[0]); return 1; }
+	  }
+
+	//"-s path" serves clients on a Unix domain socket instead of reading commands from stdin
+	if (socket_path != NULL)
+	  { return serve(socket_path); }
+
+	printf("Welcome to your file system\n");
+	fs_handle *fs = fs_attach();
+  
+   //Background work runs while an interactive user is idle; piped input only gets one slice per command
+   run_background_tasks( isatty(STDIN_FILENO) );
+   while (fgets(in, LINESIZE, stdin) != NULL)
+    {
+      fs_command(fs, in, stdout);
+      run_background_tasks( isatty(STDIN_FILENO) );
+    }
+
+  fs_sync();
+  fs_detach(fs);
+  fs_trace_stop();
+  return 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Gives the background tasks one time slice; with "idle" set, keeps going until input arrives
+void run_background_tasks ( bool idle )
+{
+  struct pollfd input = { STDIN_FILENO, POLLIN, 0 };
+
+  while (fs_background_step(stdout) && idle && poll(&input, 1, 0) == 0)
+    { }
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Serves many clients on a Unix domain socket from one epoll loop.
+//Clients send command lines, as many as they like per round trip; every command gets a
+//response "<result> <length>\n" followed by <length> bytes of output, in order.
+int serve(char *path)
+{
+  struct sockaddr_un address;
+  struct epoll_event event, events[MAX_EVENTS];
+  bool background = false;
+
+  if (strlen(path) >= sizeof(address.sun_path))
+    { fprintf(stderr, "socket path too long: %s\n", path); return 1; }
+
+  if (fs_format() != 0)
+    { fprintf(stderr, "cannot create the disk\n"); return 1; }
+
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, path);
+  unlink(path);
+  if (listen_fd == -1 || bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) == -1 || listen(listen_fd, SOMAXCONN) == -1)
+    { perror(path); return 1; }
+
+  //Stop between two wakeups, so that the command trace is complete
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = stop;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+
+  int epoll_fd = epoll_create1(0);
+  event.events = EPOLLIN;
+  event.data.ptr = NULL;		//NULL marks the listening socket
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+  printf("Serving file system on %s\n", path);
+
+  while (!stopping)
+    {
+      //Do not sleep while background tasks have work left
+      int ready = epoll_wait(epoll_fd, events, MAX_EVENTS, background ? 0 : -1);
+      if (ready == -1 && errno != EINTR)
+        { perror("epoll_wait"); return 1; }
+
+      for (int i = 0; i < ready; i++)
+        {
+          session *client = events[i].data.ptr;
+
+          if (client == NULL)
+            {
+              int fd;
+              while ((fd = accept(listen_fd, NULL, NULL)) != -1)
+                {
+                  fcntl(fd, F_SETFL, O_NONBLOCK);
+                  client = malloc(sizeof(session));
+                  client->fd = fd;
+                  client->fs = fs_attach();
+                  client->in_length = 0;
+                  client->out = NULL;
+                  client->out_length = 0;
+                  client->out_sent = 0;
+                  client->closing = false;
+                  event.events = EPOLLIN;
+                  event.data.ptr = client;
+                  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+                }
+              continue;
+            }
+          if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            { session_receive(epoll_fd, client); }
+          else if (events[i].events & EPOLLOUT)
+            { session_send(epoll_fd, client); }
+        }
+
+      background = fs_background_step(stdout);
+    }
+
+  fs_sync();
+  fs_trace_stop();
+  unlink(path);
+  return 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+void stop ( int signal )
+{
+  (void)signal;
+  stopping = 1;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Reads what the client sent and runs every complete line with the client's handle; once the client has shut
+//its side, what is left after the last newline is run as a line too
+void session_receive ( int epoll_fd, session *client )
+{
+  bool ended = false;
+
+  while (!ended)
+    {
+      ssize_t got = read(client->fd, client->in + client->in_length, SESSION_BUFFER - client->in_length);
+      if (got == -1 && errno != EAGAIN && errno != EINTR)
+        { session_close(epoll_fd, client); return; }
+      if (got == -1)
+        { break; }
+      //The client sent all it will: answer what it sent, then close
+      if (got == 0)
+        { ended = true; }
+      client->in_length += got;
+
+      int start = 0;
+      char *end;
+      while (!client->closing && (end = memchr(client->in + start, '\n', client->in_length - start)) != NULL)
+        {
+          session_run(client, client->in + start, end - (client->in + start) + 1);
+          start = end - client->in + 1;
+        }
+      if (ended && !client->closing && start < client->in_length)
+        {
+          session_run(client, client->in + start, client->in_length - start);
+          start = client->in_length;
+        }
+      memmove(client->in, client->in + start, client->in_length - start);
+      client->in_length -= start;
+
+      //A line that does not fit the buffer can never complete
+      if (client->in_length == SESSION_BUFFER || client->closing || ended)
+        { client->closing = true; break; }
+    }
+
+  session_send(epoll_fd, client);
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Runs one line of the client and queues the response; a line longer than a command may be is answered
+//with an error instead of being run cut short
+void session_run ( session *client, const char *text, size_t length )
+{
+  char line[LINESIZE];
+  char *body = NULL;
+  size_t body_length = 0;
+  char header[32];
+
+  if (length > LINESIZE - 1)
+    {
+      static const char error[] = "line too long\n";
+      int header_length = snprintf(header, sizeof(header), "%d %zu\n", -1, sizeof(error) - 1);
+      session_append(client, header, header_length);
+      session_append(client, error, sizeof(error) - 1);
+      return;
+    }
+  memcpy(line, text, length);
+  line[length] = '\0';
+
+  //"exit" ends this session, not the server
+  char *word = line + strspn(line, " \t");
+  if (strncmp(word, "exit", 4) == 0 && strchr(" \t\r\n", word[4]) != NULL)
+    {
+      session_append(client, "0 0\n", 4);
+      client->closing = true;
+      return;
+    }
+
+  FILE *out = open_memstream(&body, &body_length);
+  int ret = fs_command(client->fs, line, out);
+  fclose(out);
+
+  int header_length = snprintf(header, sizeof(header), "%d %zu\n", ret, body_length);
+  session_append(client, header, header_length);
+  session_append(client, body, body_length);
+  free(body);
+}
+
+/*--------------------------------------------------------------------------------*/
+//Sends as much of the pending responses as the socket takes; waits for EPOLLOUT for the rest
+void session_send ( int epoll_fd, session *client )
+{
+  struct epoll_event event;
+
+  while (client->out_sent < client->out_length)
+    {
+      ssize_t sent = send(client->fd, client->out + client->out_sent, client->out_length - client->out_sent, MSG_NOSIGNAL);
+      if (sent == -1 && errno == EAGAIN)
+        {
+          event.events = EPOLLOUT;
+          event.data.ptr = client;
+          epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client->fd, &event);
+          return;
+        }
+      if (sent == -1)
+        { session_close(epoll_fd, client); return; }
+      client->out_sent += sent;
+    }
+
+  client->out_length = 0;
+  client->out_sent = 0;
+  if (client->closing)
+    { session_close(epoll_fd, client); return; }
+  event.events = EPOLLIN;
+  event.data.ptr = client;
+  epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client->fd, &event);
+}
+
+/*--------------------------------------------------------------------------------*/
+
+void session_append ( session *client, const char *data, size_t length )
+{
+  client->out = realloc(client->out, client->out_length + length);
+  memcpy(client->out + client->out_length, data, length);
+  client->out_length += length;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+void session_close ( int epoll_fd, session *client )
+{
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+  close(client->fd);
+  free(client->out);
+  fs_detach(client->fs);
+  free(client);
+}
+
+/*--------------------------------------------------------------------------------*/
+
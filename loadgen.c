@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* Load generator for the file system server (started with "fs -s <socket>").
+ *
+ * For 1, 2, 4, ... up to max_clients concurrent clients, every client creates its own
+ * directory and then sends "rounds" batches of "depth" pipelined commands, waiting for
+ * all responses of a batch before sending the next one. Throughput and round trip
+ * latency percentiles are reported per client count.
+ *
+ * usage: loadgen <socket> [max_clients] [rounds] [depth]
+ */
+
+#define LINESIZE 128
+
+char *socket_path;
+int rounds = 200;
+int depth = 16;
+
+typedef struct {
+	int id;
+	int clients;		//clients running in this step, used to keep names unique
+	long *latencies;	//microseconds per round trip, "rounds" entries
+	bool failed;
+} client_type;
+
+/*--------------------------------------------------------------------------------*/
+
+long now_microseconds ( ) {
+	struct timespec now;
+
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return now.tv_sec * 1000000L + now.tv_nsec / 1000;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Reads "count" responses ("<result> <length>\n" and <length> bytes each); returns -1 on a broken connection
+int read_responses ( int fd, int count ) {
+	char buffer[4096];
+	int have = 0;
+
+	while ( count > 0 ) {
+		char *end = memchr( buffer, '\n', have );
+		if ( end == NULL ) {
+			int got = read( fd, buffer + have, sizeof(buffer) - have );
+			if ( got <= 0 )
+				return -1;
+			have += got;
+			continue;
+		}
+
+		int result;
+		long length;
+		if ( sscanf(buffer, "%d %ld", &result, &length) != 2 )
+			return -1;
+		long skip = end - buffer + 1 + length;
+
+		//The body may not have arrived yet
+		while ( skip > have ) {
+			int got = read( fd, buffer, sizeof(buffer) );
+			if ( got <= 0 )
+				return -1;
+			skip -= have;
+			have = got;
+		}
+		memmove( buffer, buffer + skip, have - skip );
+		have -= skip;
+		count--;
+	}
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+int send_all ( int fd, char *data, int length ) {
+	while ( length > 0 ) {
+		int sent = write( fd, data, length );
+		if ( sent <= 0 )
+			return -1;
+		data += sent;
+		length -= sent;
+	}
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+void *run_client ( void *arg ) {
+	client_type *client = arg;
+	struct sockaddr_un address;
+	char directory[LINESIZE];
+	char file[LINESIZE];
+	char *batch = malloc( depth * LINESIZE );
+	char line[2*LINESIZE];
+
+	//Names are global in the file system, so every client uses its own
+	snprintf( directory, sizeof(directory), "d%dc%d", client->clients, client->id );
+	snprintf( file, sizeof(file), "f%dc%d", client->clients, client->id );
+
+	int fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+	memset( &address, 0, sizeof(address) );
+	address.sun_family = AF_UNIX;
+	strncpy( address.sun_path, socket_path, sizeof(address.sun_path) - 1 );
+	if ( fd == -1 || connect(fd, (struct sockaddr *)&address, sizeof(address)) == -1 ) {
+		perror( socket_path );
+		client->failed = true;
+		free(batch);
+		return NULL;
+	}
+
+	int length = snprintf( line, sizeof(line), "mkdir %s\nchdir %s\n", directory, directory );
+	if ( send_all(fd, line, length) == -1 || read_responses(fd, 2) == -1 )
+		client->failed = true;
+
+	//A batch cycles through creating, inspecting and removing one file
+	char *commands[] = { "mkfil %s 100\n", "du\n", "rmfil %s\n", "df\n" };
+	int batch_length = 0;
+	for ( int k = 0; k < depth; k++ )
+		batch_length += snprintf( batch + batch_length, LINESIZE, commands[k % 4], file );
+	if ( depth % 4 == 1 || depth % 4 == 2 )
+		batch_length += snprintf( batch + batch_length, LINESIZE, "rmfil %s\n", file );
+	int responses = depth + (depth % 4 == 1 || depth % 4 == 2);
+
+	for ( int r = 0; r < rounds && !client->failed; r++ ) {
+		long start = now_microseconds();
+		if ( send_all(fd, batch, batch_length) == -1 || read_responses(fd, responses) == -1 ) {
+			client->failed = true;
+			break;
+		}
+		client->latencies[r] = now_microseconds() - start;
+	}
+
+	length = snprintf( line, sizeof(line), "chdir ..\nrmdir %s\nexit\n", directory );
+	if ( !client->failed )
+		send_all( fd, line, length );
+	read_responses( fd, 3 );
+	close(fd);
+	free(batch);
+	return NULL;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+int compare_longs ( const void *a, const void *b ) {
+	long x = *(long *)a;
+	long y = *(long *)b;
+	return (x > y) - (x < y);
+}
+
+/*--------------------------------------------------------------------------------*/
+
+int main ( int argc, char *argv[] ) {
+	if ( argc < 2 ) {
+		fprintf( stderr, "usage: %s <socket> [max_clients] [rounds] [depth]\n", argv[0] );
+		return 1;
+	}
+	socket_path = argv[1];
+	int max_clients = argc > 2 ? atoi(argv[2]) : 16;
+	if ( argc > 3 ) rounds = atoi(argv[3]);
+	if ( argc > 4 ) depth = atoi(argv[4]);
+	if ( max_clients < 1 || rounds < 1 || depth < 1 ) {
+		fprintf( stderr, "%s: clients, rounds and depth must be positive\n", argv[0] );
+		return 1;
+	}
+
+	printf("%8s %8s %12s %10s %10s %10s\n", "clients", "depth", "commands/s", "p50 us", "p99 us", "max us");
+	for ( int clients = 1; clients <= max_clients; clients *= 2 ) {
+		pthread_t *threads = malloc( sizeof(pthread_t)*clients );
+		client_type *client = calloc( clients, sizeof(client_type) );
+		long *latencies = malloc( sizeof(long)*clients*rounds );
+
+		long start = now_microseconds();
+		for ( int c = 0; c < clients; c++ ) {
+			client[c].id = c;
+			client[c].clients = clients;
+			client[c].latencies = latencies + c*rounds;
+			pthread_create( &threads[c], NULL, run_client, &client[c] );
+		}
+		for ( int c = 0; c < clients; c++ )
+			pthread_join( threads[c], NULL );
+		long elapsed = now_microseconds() - start;
+
+		for ( int c = 0; c < clients; c++ ) {
+			if ( client[c].failed ) {
+				fprintf( stderr, "%s: client %d of %d failed\n", argv[0], c, clients );
+				return 1;
+			}
+		}
+
+		//Round trips of all clients together; each one carries "depth" commands
+		int count = clients*rounds;
+		qsort( latencies, count, sizeof(long), compare_longs );
+		printf("%8d %8d %12.0f %10ld %10ld %10ld\n", clients, depth,
+			(double)count*depth*1000000.0/(elapsed > 0 ? elapsed : 1),
+			latencies[count/2], latencies[(count*99)/100], latencies[count-1]);
+
+		free(latencies);
+		free(client);
+		free(threads);
+	}
+	return 0;
+}
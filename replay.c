@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include "simulatedFileSystem.h"
+
+/* Replays a command trace recorded with "fs -t trace" against a freshly formatted disk.
+ *
+ * Every session of the trace gets its own handle, so each command runs in the working
+ * directory it ran in when it was recorded. Without -p the commands run back to back;
+ * with -p each one waits for its original start time. Afterwards the recorded and the
+ * replayed latency are compared per command, which shows what changed between the build
+ * that recorded the trace and this one. A command whose result or output is not the recorded
+ * one counts as different; output that shows times or timings differs from run to run anyway.
+ * -t writes the replayed run as a new trace.
+ *
+ * usage: replay [-p] [-t trace] <trace>
+ */
+
+#define LINESIZE 128
+#define SESSIONS 65536		//session numbers are 16 bit in the trace
+#define MAX_COMMANDS 64		//distinct command names in the report
+
+typedef struct {
+	char name[LINESIZE];
+	long count;
+	double recorded;	//nanoseconds, summed
+	double replayed;
+	long different;		//commands that returned or printed something else this time
+} command_stats;
+
+command_stats stats[MAX_COMMANDS];
+int stats_count;
+
+/*--------------------------------------------------------------------------------*/
+
+long now_nanoseconds ( ) {
+	struct timespec now;
+
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//CRC-32C as the trace has it for the output of a command
+uint32_t output_checksum ( const char *data, size_t length ) {
+	uint32_t crc = 0xFFFFFFFF;
+
+	for ( size_t i = 0; i < length; i++ ) {
+		crc ^= (unsigned char)data[i];
+		for ( int bit = 0; bit < 8; bit++ )
+			crc = crc & 1 ? (crc >> 1) ^ 0x82F63B78 : crc >> 1;
+	}
+	return ~crc;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//The statistics of the command that starts "line"; commands beyond MAX_COMMANDS share the last slot
+command_stats *find_stats ( char *line ) {
+	char name[LINESIZE];
+
+	sscanf( line, "%127s", name );
+	for ( int i = 0; i < stats_count; i++ )
+		if ( strcmp(stats[i].name, name) == 0 )
+			return &stats[i];
+	if ( stats_count == MAX_COMMANDS )
+		return &stats[MAX_COMMANDS - 1];
+	strcpy( stats[stats_count].name, name );
+	return &stats[stats_count++];
+}
+
+/*--------------------------------------------------------------------------------*/
+
+int main ( int argc, char *argv[] ) {
+	bool paced = false;
+	char *output_trace = NULL;
+	char magic[sizeof(FS_TRACE_MAGIC)] = "";
+	fs_trace_record record;
+	char line[LINESIZE + 2];
+	int option;
+
+	while ( (option = getopt(argc, argv, "pt:")) != -1 ) {
+		if ( option == 'p' )
+			paced = true;
+		else if ( option == 't' )
+			output_trace = optarg;
+		else
+			break;
+	}
+	if ( option == '?' || optind != argc - 1 ) {
+		fprintf( stderr, "usage: %s [-p] [-t trace] <trace>\n", argv[0] );
+		return 1;
+	}
+
+	FILE *input = fopen( argv[optind], "rb" );
+	if ( input == NULL ) {
+		perror( argv[optind] );
+		return 1;
+	}
+	if ( fread(magic, 1, strlen(FS_TRACE_MAGIC), input) != strlen(FS_TRACE_MAGIC) || strcmp(magic, FS_TRACE_MAGIC) != 0 ) {
+		fprintf( stderr, "%s: %s is not a command trace\n", argv[0], argv[optind] );
+		return 1;
+	}
+	if ( output_trace != NULL && fs_trace_start(output_trace) != FS_OK ) {
+		perror( output_trace );
+		return 1;
+	}
+
+	fs_handle **sessions = calloc( SESSIONS, sizeof(fs_handle *) );
+	fs_format();
+
+	long start = now_nanoseconds();
+	long commands = 0;
+	while ( fread(&record, sizeof(record), 1, input) == 1 ) {
+		if ( fread(line, 1, record.length, input) != record.length )
+			break;
+		//The trace leaves the newline out; the line goes in as it was typed
+		strcpy( line + record.length, "\n" );
+
+		//"exit" would end the replay itself
+		char name[LINESIZE] = "";
+		sscanf( line, "%127s", name );
+		if ( strcmp(name, "exit") == 0 )
+			continue;
+
+		if ( sessions[record.session] == NULL )
+			sessions[record.session] = fs_attach();
+		if ( paced ) {
+			long wait = start + (long)record.start - now_nanoseconds();
+			if ( wait > 0 ) {
+				struct timespec pause = { wait / 1000000000L, wait % 1000000000L };
+				nanosleep( &pause, NULL );
+			}
+		}
+
+		char *printed = NULL;
+		size_t printed_length = 0;
+		FILE *out = open_memstream( &printed, &printed_length );
+		long before = now_nanoseconds();
+		int result = fs_command( sessions[record.session], line, out );
+		long took = now_nanoseconds() - before;
+		fclose( out );
+
+		command_stats *command = find_stats(line);
+		command->count++;
+		command->recorded += record.duration;
+		command->replayed += took;
+		if ( (int8_t)result != record.result || output_checksum(printed, printed_length) != record.output )
+			command->different++;
+		free( printed );
+		commands++;
+	}
+	long elapsed = now_nanoseconds() - start;
+	fs_trace_stop();
+
+	printf("%-10s %10s %14s %14s %9s %10s\n", "command", "count", "recorded us", "replayed us", "change", "results");
+	for ( int i = 0; i < stats_count; i++ ) {
+		command_stats *command = &stats[i];
+		double recorded = command->recorded / command->count / 1000.0;
+		double replayed = command->replayed / command->count / 1000.0;
+		printf("%-10s %10ld %14.2f %14.2f %+8.1f%% %10s\n", command->name, command->count, recorded, replayed,
+			recorded > 0 ? 100.0 * (replayed - recorded) / recorded : 0.0,
+			command->different == 0 ? "same" : "differ");
+	}
+	printf("%ld commands replayed in %.3f s%s\n", commands, elapsed / 1e9, paced ? " at the recorded pace" : "");
+
+	for ( int i = 0; i < SESSIONS; i++ )
+		if ( sessions[i] != NULL )
+			fs_detach( sessions[i] );
+	free(sessions);
+	fclose(input);
+	return 0;
+}
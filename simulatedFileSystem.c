@@ -2,27 +2,62 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <stddef.h>
 #include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <fnmatch.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __x86_64__
+#include <nmmintrin.h>	//the crc32 instruction; only used once the CPU has been checked for it
+#endif
+#include "simulatedFileSystem.h"
 
 /* command	action
  * -------	------
  *  root	initialize root directory
  *  print	print current working directory and all descendants
+ *  ls		list a directory sorted by name, a page at a time (ls [dir] [cursor] [limit])
  *  chdir	change current working directory (.. refers to parent directory)
  *  mkdir	sub-directory create 
- *  rmdir	              delete 
+ *  rmdir	              delete (the blocks are freed in the background)
  *  mvdir	              rename 
- *  mkfil	file create
+ *  mkfil	file create (data blocks are only allocated once they are written)
  *  rmfil	     delete
  *  mvfil	     rename
  *  szfil	     resize 
+ *  cpfil	     copy (shares the data blocks until one of the files is written)
+ *  defrag	move file data into contiguous runs (defrag bg|stop|status)
+ *  fsck	check the disk for leaked, doubly allocated and dangling blocks (fsck repair)
+ *  df		report free and used blocks of the disk
+ *  du		report size, files and blocks of a directory and everything below it
+ *  find	list files and directories whose name matches a glob pattern
+ *  trace	print the trace points recorded so far, oldest first (trace dump|clear)
+ *  snapshot	copy-on-write snapshots of the whole disk (snapshot create|list|delete|rollback <name>)
+ *  dedup	share identical data blocks between files (dedup bg|stop|status|on|off)
+ *  compress	store a file's data compressed, or every new file of a directory (compress <name> on|off, compress status)
+ *  scrub	verify the checksum of every block in use (scrub bg [blocks per second]|stop|status)
+ *  watch	follow the changes in a directory (watch add|tree <dir>, watch read|rm <watch>, watch list)
+ *  quota	limit the blocks and entries of a directory and everything below it (quota <dir> [<blocks>[,<entries>]])
+ *  batch	queue mkdir and mkfil commands and run them as one (batch begin|in <dir>|commit|abort|status)
+ *  export	write a directory and everything below it into a read-only image file (export <file> [dir])
+ *  sync	write the disk back to the image files of its volume
  *  exit        quit the program
  */
 
-int debug = 1;	// extra output; 1 = on, 0 = off
+int debug = 1;	// trace points record into the trace ring; 1 = on, 0 = off
+FILE *output;	// where command results go; set by fs_command for the duration of one command
+char *operand;	// third operand of the command line being run, "" if there is none
 
 int do_root (char *name, char *size);
 int do_print(char *name, char *size);
+int do_ls   (char *name, char *size);
 int do_chdir(char *name, char *size);
 int do_mkdir(char *name, char *size);
 int do_rmdir(char *name, char *size);
@@ -31,6 +66,22 @@ int do_mkfil(char *name, char *size);
 int do_rmfil(char *name, char *size);
 int do_mvfil(char *name, char *size);
 int do_szfil(char *name, char *size);
+int do_cpfil(char *name, char *size);
+int do_defrag(char *name, char *size);
+int do_fsck  (char *name, char *size);
+int do_df    (char *name, char *size);
+int do_du    (char *name, char *size);
+int do_find  (char *name, char *size);
+int do_trace (char *name, char *size);
+int do_snapshot(char *name, char *size);
+int do_dedup (char *name, char *size);
+int do_compress(char *name, char *size);
+int do_scrub (char *name, char *size);
+int do_watch (char *name, char *size);
+int do_quota (char *name, char *size);
+int do_batch (char *name, char *size);
+int do_export(char *name, char *size);
+int do_sync  (char *name, char *size);
 int do_exit (char *name, char *size);
 /*
     returns 0 (success) or -1 (failure)
@@ -42,6 +93,7 @@ struct action {
 } table[] = {
     { "root" , do_root  },
     { "print", do_print },
+    { "ls"   , do_ls    },
     { "chdir", do_chdir },
     { "mkdir", do_mkdir },
     { "rmdir", do_rmdir },
@@ -50,6 +102,22 @@ struct action {
     { "rmfil", do_rmfil },
     { "mvfil", do_mvfil },
     { "szfil", do_szfil },
+    { "cpfil", do_cpfil },
+    { "defrag", do_defrag },
+    { "fsck" , do_fsck  },
+    { "df"   , do_df    },
+    { "du"   , do_du    },
+    { "find" , do_find  },
+    { "trace", do_trace },
+    { "snapshot", do_snapshot },
+    { "dedup", do_dedup },
+    { "compress", do_compress },
+    { "scrub", do_scrub },
+    { "watch", do_watch },
+    { "quota", do_quota },
+    { "batch", do_batch },
+    { "export", do_export },
+    { "sync" , do_sync  },
     { "exit" , do_exit  },
     { NULL, NULL }	// end mark, do not remove ,gives wierd errors! :(
 };
@@ -58,21 +126,35 @@ struct action {
 void printing(char *name);
 void print_descriptor ( );
 void parse(char *buf, int *argc, char *argv[]);
-int allocate_block (char *name, bool directory ) ;
+int run_command(char *line);
+int allocate_block (char *name, bool directory, int goal, int owner ) ;
 void unallocate_block ( int offset );
+int find_directory_group ( );
+int move_block ( int from, int to );
 int find_block ( char* name, bool directory );
 
 int add_descriptor ( char * name );
 int edit_descriptor ( int free_index, bool free, int name_index, char * name );
 int edit_descriptor_name (int index, char* new_name);
 int add_directory( char * name );
-int remove_directory( char * name );
+int place_directory ( char *name );
 int rename_directory( char *name, char *new_name );
 int edit_directory ( char * name,  char*subitem_name, char *new_name, bool name_change, bool directory );
 int add_file( char * name, int size );
+int place_file ( char *name, int size, int goal );
 int edit_file ( char * name, int size, char *new_name );
 int remove_file (char* name);
+void unlink_entry ( char *name, int block_index, bool directory );
+int resize_file ( int index, int size );
+int copy_file ( int index, char *new_name );
+int unshare_data_blocks ( int index, int first, int last );
+void data_block_name ( char *subname, const char *name, int position );
+void release_data_block ( int block, int user );
+int find_data_block_user ( int block, int except );
+int find_entry ( char *name, bool *directory );
+bool valid_name ( char *name );
 int edit_directory_subitem (char* name, char* sub_name, char* new_sub_name);
+void update_directory_totals ( char *name, long bytes, int files, int entries, int blocks );
 
 void print_directory ( char *name);
 char * get_directory_name ( char*name );
@@ -80,6 +162,19 @@ char * get_directory_top_level ( char*name);
 char * get_directory_subitem ( char*name, int subitem_index, char * subitem );
 int get_directory_subitem_count ( char*name);
 
+int fragmentation_score ( );
+bool defrag_step ( long budget );
+void defrag_finish ( );
+bool dedup_step ( long budget );
+void dedup_finish ( );
+bool scrub_step ( long budget );
+void scrub_finish ( );
+bool reclaim_step ( long budget );
+void reclaim_finish ( );
+long elapsed_microseconds ( struct timespec *start );
+long elapsed_nanoseconds ( struct timespec *start );
+void trace_command ( int session, const char *line, int result, uint32_t printed, struct timespec *start );
+
 char * get_file_name ( char*name );
 char * get_file_top_level ( char*name);
 int get_file_size( char*name);
@@ -87,12 +182,47 @@ void print_file ( char *name);
 
 /************************** Defining Constants for fs *******************/
 #define LINESIZE 128
-#define DISK_PARTITION 4000000
-#define BLOCK_SIZE 5000
-#define BLOCKS 4000000/5000
-#define MAX_STRING_LENGTH 20
-#define MAX_FILE_DATA_BLOCKS (BLOCK_SIZE-64*59) //Hard-coded as of now
-#define MAX_SUBDIRECTORIES  (BLOCK_SIZE - 136)/MAX_STRING_LENGTH
+#define DISK_PARTITION 4096000	//1000 blocks
+#define BLOCK_SIZE 4096		//one page: a block never straddles two pages and starts on a cache line
+#define BLOCKS (DISK_PARTITION/BLOCK_SIZE)
+#define BLOCKS_PER_GROUP 100
+#define GROUPS (BLOCKS/BLOCKS_PER_GROUP)
+#define MAX_STRING_LENGTH FS_NAME_LENGTH
+#define MAX_FILE_DATA_BLOCKS ((BLOCK_SIZE - 2*MAX_STRING_LENGTH - 32) / 4)	//what the control block has left for the block list
+#define HOLE -1			//data_block_index of a block never written: it takes no space and reads as zeros
+#define MAX_SUBDIRECTORIES  (BLOCK_SIZE - 136)/(MAX_STRING_LENGTH + 1)	//a name and a type per subitem
+#define MAX_OPEN_FILES 256
+#define SLICE_MICROSECONDS 1000	//how long a background task may run before returning to the command loop
+#define MAX_FSCK_THREADS 16
+#define TRACE_RECORDS 2048	//trace records kept per thread; the oldest ones are overwritten
+#define TRACE_ARGUMENTS 5
+#define TRACE_TEXT 24		//long enough for names and function names
+#define DEDUP_BUCKETS 1024	//hash chains of the dedup index, a power of two
+#define LZ_HASH_BITS 12		//positions remembered by the compressor, 2^LZ_HASH_BITS
+#define LZ_MIN_MATCH 4
+#define CACHE_BLOCKS 16		//decompressed blocks kept by the block cache
+#define CRC32C_POLY 0x82F63B78	//Castagnoli polynomial, bit reversed
+#define SCRUB_RATE 200		//blocks per second a background scrub checks unless told otherwise
+#define RECLAIM_RATE 5000	//blocks per second the reclaim task frees
+#define RECLAIM_BATCH 64	//blocks freed at a time
+#define REMOVED_NAME "(removed)"	//descriptor name of a removed entry whose blocks are not freed yet
+#define CHANGE_EVENTS 4096	//events the change feed keeps; a watch further behind overflows
+#define MAX_WATCHES 64		//one bit each in a change slot
+#define LS_PAGE 50		//entries per page of "ls" unless told otherwise
+#define VOLUME_MAGIC "FSVOLUM1"
+#define HUGE_PAGE (2*1024*1024)	//the disk is mapped on a boundary of this, whatever the pages
+#define EXPORT_CHUNK (16*BLOCK_SIZE)	//bytes of file data fs_export reads at a time
+
+//A trace point stores its format and arguments in the calling thread's trace ring, and "trace dump"
+//formats them later. With -DFS_NO_TRACE they are compiled out.
+#ifdef FS_NO_TRACE
+#define TRACE(format, ...) do { if ( 0 ) trace_point(NULL, format, __VA_ARGS__); } while ( 0 )
+#else
+#define TRACE(format, ...) do { \
+		static trace_site site = { format, -1, "" }; \
+		if ( debug ) trace_point(&site, format, __VA_ARGS__); \
+	} while ( 0 )
+#endif
 
 typedef struct {
 	char directory[MAX_STRING_LENGTH];
@@ -102,467 +232,2619 @@ typedef struct {
 } working_directory;
 
 
+//The fields every lookup and every totals update reads come first, so they share the first two cache lines
+//of the block with the names; the subitem names, which only a scan of the directory reads, come last.
 typedef struct dir_type {
 	char name[MAX_STRING_LENGTH];		//Name of file or dir
 	char top_level[MAX_STRING_LENGTH];	//Name of directory one level up(immediate parent)
-	char (*subitem)[MAX_STRING_LENGTH];
-	bool subitem_type[MAX_SUBDIRECTORIES];	//true if directory, false if file
 	int subitem_count;
+	long total_bytes;			//size of all files in this directory and below
+	int total_files;			//number of files in this directory and below
+	int total_blocks;			//blocks used by this directory and everything below it
+	int total_entries;			//files and directories in this directory and below, itself included
+	int quota_blocks;			//limit of total_blocks; 0 for none
+	int quota_entries;			//limit of total_entries; 0 for none
+	bool compress;				//files created in this directory are compressed
+	bool subitem_type[MAX_SUBDIRECTORIES];	//true if directory, false if file
+	char subitem[MAX_SUBDIRECTORIES][MAX_STRING_LENGTH];
 	struct dir_type *next;
 } dir_type;
 
 
+//Like a directory, the fields a stat reads lie in the first cache line and the block list follows
 typedef struct file_type {
 	char name[MAX_STRING_LENGTH];		//Name of file or dir
 	char top_level[MAX_STRING_LENGTH];	//Name of directory one level up 
-	int data_block_index[MAX_FILE_DATA_BLOCKS];
-	int data_block_count;
+	int data_block_count;				//blocks of the file, holes included
 	int size;
+	bool compressed;			//the data blocks hold a packed stream (see Compression), not the data itself
+	int data_block_index[MAX_FILE_DATA_BLOCKS];	//HOLE for blocks that were never written
 	struct file_type *next;
 } file_type;
 
+_Static_assert( sizeof(dir_type) <= BLOCK_SIZE && sizeof(file_type) <= BLOCK_SIZE, "control blocks have to fit a block" );
+
+//The disk is split into GROUPS allocation groups of BLOCKS_PER_GROUP blocks each.
+//Group g owns free[g*BLOCKS_PER_GROUP] up to free[(g+1)*BLOCKS_PER_GROUP - 1] as its free map.
+//The counters come first, in the cache line an allocation reads along with the start of the free map.
+//Everything up to the directory flags fits in block 0; the owners, reference counts and names take the blocks after it.
 typedef struct {
+	int free_blocks;			//number of free blocks left on the whole disk
+	int group_free[GROUPS];			//number of free blocks left in each group
+	int group_directories[GROUPS];		//number of directories placed in each group
 	bool free[BLOCKS];
 	bool directory[BLOCKS];
-	char (*name)[MAX_STRING_LENGTH];
+	int owner[BLOCKS];			//for data blocks, the block of a file using it; -1 otherwise
+	int references[BLOCKS];			//for data blocks, the number of files using it (cpfil shares them)
+	uint32_t checksum[BLOCKS];		//CRC32C of each block behind the descriptor; the descriptor is not covered
+	char name[BLOCKS][MAX_STRING_LENGTH];
 } descriptor_block;
 
-char *disk;
-working_directory current;
-bool disk_allocated = false; // makes sure that do_root is first thing being called and only called once
+#define DESCRIPTOR_BLOCKS ((int)(sizeof(descriptor_block)/BLOCK_SIZE) + 1)
+
+bool is_file_block ( descriptor_block *descriptor, int index );
+int file_blocks ( file_type *file );
+int fill_holes ( int index, int first, int last );
+int find_free_run ( descriptor_block *descriptor, int goal, int length );
+int data_breaks ( file_type *file, const int *moved );
+int breaks_of_users ( int index, bool shared, const int *moved, bool after );
+int segment_bytes ( file_type *file, const fs_segment *segment );
+bool valid_segments ( const fs_segment *segments, int count );
+void copy_segments ( file_type *file, const fs_segment *segments, int count, bool write );
+void copy_run ( char *data, char *buffer, int length, bool write );
+int read_file ( int index, int offset, void *buffer, int length );
+int write_file ( int index, int offset, const void *buffer, int length );
+int read_segments ( int index, const fs_segment *segments, int count );
+int write_segments ( int index, const fs_segment *segments, int count );
+int read_compressed ( int index, int offset, char *buffer, int length );
+int rewrite_compressed ( int index, int size, int offset, const char *buffer, int length );
+int compress_file ( int index, bool on );
+int store_data ( int index, file_type *file, const char *data, int bytes );
+bool packed_read ( file_type *file, int position, void *buffer, int bytes );
+int pack_block ( const char *data, char *packed );
+void unpack_block ( const char *packed, int length, char *data );
+int lz_compress ( const char *in, int length, char *out, int max );
+int lz_decompress ( const char *in, int length, char *out, int max );
+char *cached_block ( int index, int k );
+void cache_forget ( int index );
+void cache_reset ( );
+void stat_block ( int index, bool directory, fs_stat_type *stat );
+void write_blocks ( int index, const void *data, int count );
+void descriptor_changing ( int index );
+
+void checksum_init ( );
+uint32_t block_checksum ( const char *data );
+bool checksum_valid ( int index );
+void checksum_update ( int index );
+void checksum_write ( int index, const char *old, const char *new, int offset, int length );
+int first_change ( const char *old, const char *new, int from, int length );
+void checksum_set ( int index, uint32_t checksum );
+uint32_t crc32c_update ( uint32_t crc, const char *data, int length );
+uint32_t crc32c_delta ( uint32_t crc, const char *old, const char *new, int length );
+uint32_t crc32c_multiply ( uint32_t a, uint32_t b );
+
+//Tables of the CRC32C code; the crc32 instruction of SSE4.2 is used instead of the table where the CPU has it
+struct {
+	bool hardware;
+	uint32_t table[256];		//CRC of every byte value, for the byte at a time loop
+	uint32_t shift[BLOCK_SIZE + 1];	//x^(8n) modulo the polynomial: multiplying by shift[n] moves a CRC past n zero bytes
+	uint32_t zero;			//of a block of zeros, which every block given to a hole starts out as
+} crc32c;
+
+//Progress of the current scrub pass, which checks every block in use against its checksum
+struct {
+	int cursor;		//next block to check
+	int checked;		//blocks checked in this pass
+	int errors;		//blocks that did not match their checksum
+	long rate;		//blocks per second; 0 checks as fast as the time slices allow
+	struct timespec start;	//of the pass, for the rate limit
+} scrub;
+
+//Removed files and directories are only unlinked by fs_remove; their blocks keep the name REMOVED_NAME
+//until the reclaim task frees them in the background, or an allocation that runs short frees them right away.
+struct {
+	int pending;		//blocks they still hold: control blocks and the data blocks not released yet
+	int cursor;		//next block to look at
+	long released;		//blocks released since the task was started, for the rate limit
+	struct timespec start;
+} reclaim;
+
+void orphan_entry ( int index );
+int reclaim_blocks ( int max );
+void reclaim_count ( );
+int reclaim_freeable ( );
+bool reserve_blocks ( int count );
+
+//The change feed has a single producer, since calls that change the tree are serialized, and readers in
+//any thread, so the ring takes no lock. A slot's sequence is 0 while the slot is being written; a reader
+//copies the event and looks at the sequence again, and if it changed the producer has lapped the watch.
+typedef struct {
+	unsigned long sequence;
+	uint64_t watches;	//bit w is set if watch w sees the event
+	fs_event event;
+} change_slot;
+
+struct {
+	change_slot slot[CHANGE_EVENTS];
+	unsigned long published;		//events so far; slot[published % CHANGE_EVENTS] holds the newest
+	bool used[MAX_WATCHES];
+	int block[MAX_WATCHES];			//watched directory; -1 once it is removed
+	bool subtree[MAX_WATCHES];		//directories below it count as well
+	unsigned long next[MAX_WATCHES];	//sequence of the next event the watch reads
+	int count;				//watches in use; no event is published without one
+} changes;
+
+void publish_change ( int type, char *parent, char *name, char *new_name, bool directory, long size );
+void watches_move ( int from, int to );
+
+int quota_directories;	// directories with a quota; while there are none, nothing is checked
+
+//One operation of fs_batch while it is checked and applied
+typedef struct {
+	int op;					//index in the caller's array
+	char parent[MAX_STRING_LENGTH];
+	char name[MAX_STRING_LENGTH];
+	bool directory;
+	int maker;				//op that creates the parent; -1 if it is on the disk already
+	int depth;				//directories of the batch above the entry
+	int block;				//control block once it is placed; -1 before
+} batch_entry;
+
+//Operations queued by "batch begin" for "batch commit"
+struct {
+	bool open;
+	fs_handle *owner;			//handle whose mkdir and mkfil commands are queued
+	char parent[MAX_STRING_LENGTH];		//where the queued entries go, "" for the working directory
+	fs_batch_op *ops;
+	char (*names)[2][MAX_STRING_LENGTH];	//parent and name of each op, which ops point into
+	int count;
+	int capacity;
+} batch;
+
+const fs_batch_op *batch_sorting;	// ops whose names compare_batch_names compares
+
+int batch_check ( batch_entry *entries, const fs_batch_op *ops, int count, int *failed );
+void batch_apply ( batch_entry *entries, const fs_batch_op *ops, int first, int last );
+int batch_queue ( int type, char *name, int size );
+int compare_batch_entries ( const void *a, const void *b );
+int compare_batch_names ( const void *a, const void *b );
+
+//An image mapped by fs_image_open
+struct fs_image {
+	const char *base;
+	size_t length;				//bytes mapped
+	const fs_image_header *header;
+	const fs_image_node *nodes;
+};
 
-/*--------------------------------------------------------------------------------*/
+int export_data ( FILE *file, fs_image_node *nodes, int count, uint64_t data_offset, uint64_t *bytes );
+int compare_image_nodes ( const void *a, const void *b );
 
-int main(int argc, char *argv[])
-{
-	(void)argc;
-	(void)*argv;
-    char in[LINESIZE];
-    char *cmd, *fnm, *fsz;
-    char dummy[] = "";
-
-	//printf("sizeof file_type = %d\nsizeof dir_type = %d\nsize of descriptor_block = %d\nMAX_FILE_SIZE %d\n", sizeof(file_type), sizeof(dir_type), sizeof(descriptor_block), MAX_FILE_DATA_BLOCKS );
-
-	printf("Welcome to your file system\n");
-    int n;
-    char *a[LINESIZE];
-  
-   while (fgets(in, LINESIZE, stdin) != NULL)
-    {
-      // commands are all of form "cmd filename filesize\n" with whitespace as a delimiter
-
-      // parse input
-      parse(in, &n, a);
-
-      cmd = (n > 0) ? a[0] : dummy;
-      fnm = (n > 1) ? a[1] : dummy;
-      fsz = (n > 2) ? a[2] : dummy;
-
-      if (debug) printf(":%s:%s:%s:\n", cmd, fnm, fsz);
-
-      if (n == 0) continue;	// blank line
-
-      int found = 0;
-     
-      for (struct action *ptr = table; ptr->cmd != NULL; ptr++){  
-            if (strcmp(ptr->cmd, cmd) == 0)
-                {
-                    found = 1;
-                    
-                    int ret = (ptr->action)(fnm, fsz);
-                    //every function returns -1 on failure
-                    if (ret == -1)
-                        { printf("  %s %s %s: failed\n", cmd, fnm, fsz); }
-                    break;
-                }
-	    }
-      if (!found) { printf("command not found: %s\n", cmd);}
-    }
+bool quota_allows ( char *name, int entries, int blocks );
+void quota_count ( );
 
-  return 0;
-}
+//Every named block, sorted by name and then by block index, so that find_block is a binary search.
+//Kept up to date by every function that changes a name in the descriptor.
+struct {
+	int block[BLOCKS];
+	int count;
+} sorted_names;
 
+void name_index_insert ( int index );
+void name_index_remove ( int index );
+int name_index_lower_bound ( char *name, int index );
+bool name_has_prefix ( char *record, char *prefix, int length );
+bool name_may_contain ( char *record, char *literal, int length );
+void build_path ( int index, char *path );
+int compare_block_names ( const void *a, const void *b );
 
-/*--------------------------------------------------------------------------------*/
+typedef struct {
+	char *name;
+	int block;
+} fsck_name;
 
-void parse(char *buf, int *argc, char *argv[])
-{
-  char *delim;          // points to first space delimiter
-  int count = 0;        // number of args
+//Shared state of one fsck run; the workers only touch it under "lock" or through atomic counters
+typedef struct {
+	descriptor_block *descriptor;
+	fsck_name *directories;		//directory blocks sorted by name, for lookups without find_block
+	int directory_count;
+	fsck_name *files;		//file control blocks sorted by name
+	int file_count;
+	int *claims;			//how many times each block is referenced from the tree
+	char *status;			//per block result of the free map check, see FSCK_* below
+	int *queue;			//directory blocks still to be walked
+	int queue_head;
+	int queue_tail;
+	int busy;			//workers currently walking a directory
+	int *dangling;			//pairs of (directory block, subitem index) that point nowhere
+	int dangling_count;
+	int *mistyped;			//pairs of (directory block, subitem index) with the wrong subitem_type
+	int mistyped_count;
+	int problems;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+} fsck_state;
+
+#define FSCK_OK 0
+#define FSCK_LEAK 1		//allocated, but nothing refers to it
+#define FSCK_DOUBLE 2		//referred to more than once
+#define FSCK_UNMARKED 3		//referred to, but marked free
+#define FSCK_REFERENCES 4	//a shared data block whose reference count is off
 
-  char whsp[] = " \t\n\v\f\r";          // whitespace characters
+typedef struct {
+	fsck_state *state;
+	int first_group;
+	int last_group;			//exclusive
+	char report[GROUPS][LINESIZE];	//one summary mismatch line per group, printed by the main thread
+} fsck_range;
+
+void *fsck_walk ( void *arg );
+void *fsck_check_groups ( void *arg );
+int fsck_lookup ( fsck_state *state, char *name, bool directory );
+int fsck_compare ( const void *a, const void *b );
+void fsck_claim_file ( fsck_state *state, int index );
+void fsck_report ( fsck_state *state, const char *format, ... );
+
+//The arguments of one trace point, worked out from its format the first time it is hit
+typedef struct {
+	const char *format;
+	int count;			//arguments; -1 until the format has been scanned
+	char kind[TRACE_ARGUMENTS];	//'i' for int, 'l' for long, 's' for string
+} trace_site;
 
-  while (1)                             // build the argv list
-    {
-      buf += strspn(buf, whsp);         // skip leading whitespace
-      delim = strpbrk(buf, whsp);       // next whitespace char or NULL
-      if (delim == NULL)                // end of line, input parsed
-        { break; }
-      argv[count++] = buf;              
-      *delim = '\0';                    
-      buf = delim + 1;                  
-    }
-  argv[count] = NULL;
+//One trace point; strings are copied, since the names they point to may be gone by the time of the dump
+typedef struct {
+	const char *format;		//the trace point's format string, which lives as long as the program
+	long time;			//nanoseconds, CLOCK_MONOTONIC
+	int thread;			//ring it was written to
+	union {
+		long number;
+		char text[TRACE_TEXT];
+	} argument[TRACE_ARGUMENTS];
+} trace_record;
+
+//Every thread writes to a ring of its own, so trace points take no lock. The rings stay on the
+//"trace_rings" list after their thread ends; the next new thread takes one over.
+typedef struct trace_ring {
+	trace_record record[TRACE_RECORDS];
+	unsigned long next;		//records written so far; record[next % TRACE_RECORDS] is the next one
+	int thread;			//number of the ring, shown in the dump
+	bool in_use;			//a running thread writes to it
+	struct trace_ring *link;
+} trace_ring;
+
+trace_ring *trace_rings;
+int trace_ring_count;
+__thread trace_ring *thread_ring;	// the calling thread's ring, NULL until its first trace point
+pthread_key_t trace_key;		// releases the ring when its thread ends
+pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+
+void trace_point ( trace_site *site, const char *format, ... ) __attribute__((format(printf, 2, 3)));
+int trace_scan ( const char *format, char *kind );
+trace_ring *trace_ring_claim ( );
+void trace_ring_release ( void *ring );
+void trace_key_create ( );
+void trace_format ( trace_record *record, char *text, int size );
+int compare_trace_records ( const void *a, const void *b );
 
-  *argc = count;
+char *disk;
 
-  return;
-}
+//How the disk is backed: what fs_pages asked for and what fs_format got
+struct {
+	int requested;
+	int mode;
+} pages;
+
+char *disk_map ( );
+
+//First block of every member of a volume; the member's blocks follow it
+typedef struct {
+	char magic[8];			//VOLUME_MAGIC, no terminator
+	uint32_t member;		//position among the members
+	uint32_t members;
+	uint32_t blocks;		//BLOCKS and BLOCK_SIZE of the disk
+	uint32_t block_size;
+	uint64_t id;			//the same in every member of one volume
+} volume_header;
+
+//The image files of fs_volume; while there are none, the disk lives in memory only
+struct {
+	char *path[FS_MAX_MEMBERS];
+	int fd[FS_MAX_MEMBERS];
+	int count;
+	bool mounted;			//fs_format found a volume in the members and did not format them
+} volume;
+
+char *volume_map ( int *error );
+int volume_open ( );
+void *volume_sync_member ( void *arg );
+char zero_block[BLOCK_SIZE];	// what a hole reads as
+working_directory current;
+bool disk_allocated = false; // makes sure that do_root is first thing being called and only called once
+
+//A user of the library; its working directory is swapped into "current" while one of its calls runs
+struct fs_handle {
+	working_directory cwd;
+	int id;			//numbers the handle's commands in the command trace
+};
+
+int handles;		// handles attached so far
+
+fs_handle *active;	// handle of the text command being run by fs_command
+
+bool enter ( fs_handle *fs );
+void leave ( fs_handle *fs );
+
+//Open files of fs_open; a descriptor indexes this table and keeps the file's control block, so that
+//calls on it never search the name index. move_block and unallocate_block keep the blocks current.
+struct {
+	bool open[MAX_OPEN_FILES];
+	int block[MAX_OPEN_FILES];	//control block of the file; -1 once the file has been removed
+	int references[BLOCKS];		//open descriptors per block, so blocks nobody opened skip the table
+} open_files;
+
+int open_file_block ( int fd );
+void open_files_move ( int from, int to );
+
+//Work that runs in small time slices between commands, so no command waits behind a long job
+struct task {
+	char *name;
+	bool (*step)(long budget);	// runs for at most budget microseconds; returns true once finished
+	void (*finish)();		// reports the result once the task is done
+	bool active;
+} tasks[] = {
+    { "defrag", defrag_step, defrag_finish, false },
+    { "dedup", dedup_step, dedup_finish, false },
+    { "scrub", scrub_step, scrub_finish, false },
+    { "reclaim", reclaim_step, reclaim_finish, false },
+    { NULL, NULL, NULL, false }
+};
+
+//Command trace of fs_trace_start; file is NULL while no trace is recorded
+struct {
+	FILE *file;
+	struct timespec start;
+} command_trace;
+
+//A block as one or more snapshots saw it, saved the first time the block on the disk changed after them
+typedef struct {
+	int references;			//snapshots that see the block like this
+	char data[BLOCK_SIZE];
+} saved_block;
+
+//A snapshot holds only the blocks that changed since it was taken; every other block it reads from the disk
+typedef struct snapshot {
+	char name[MAX_STRING_LENGTH];
+	int generation;			//number of snapshots taken up to and including this one
+	time_t created;
+	int saved;			//blocks it holds a copy of
+	saved_block *block[BLOCKS];	//NULL while the block on the disk is still the one it saw
+	struct snapshot *older;
+} snapshot;
+
+//Taking a snapshot only bumps the generation, so it costs the same whatever the size of the disk.
+//Once saved[i] is behind the generation, the next change to block i saves it for the newer snapshots.
+struct {
+	snapshot *newest;		//newest first
+	int count;
+	int generation;
+	int saved[BLOCKS];		//generation in which each block was last saved
+	int copies;			//saved blocks held by all snapshots together
+} snapshots;
+
+void snapshot_preserve ( int index );
+bool snapshot_block_free ( snapshot *shot, int index );
+snapshot *snapshot_find ( char *name );
+void snapshot_restore ( snapshot *shot );
+
+//Hash index of data blocks, so that a block is matched with an identical one without comparing it to every
+//other block. It is kept in memory only; a block leaves it as soon as its data changes, it moves or it is freed.
+struct {
+	bool on;			//inline: blocks are matched as soon as they are written
+	int bucket[DEDUP_BUCKETS];	//first block of each hash chain, -1 if the chain is empty
+	int next[BLOCKS];		//next block of the same chain
+	uint64_t hash[BLOCKS];
+	bool hashed[BLOCKS];		//in the index
+	int cursor;			//next block of the background pass
+	int merged;			//blocks freed by the current pass
+} dedup;
+
+uint64_t block_hash ( const char *data );
+bool dedup_block ( int index );
+void dedup_forget ( int index );
+void dedup_reset ( );
+void merge_data_block ( int from, int to );
+int shared_blocks_saved ( );
+
+//Decompressed blocks of compressed files, so that reading a block again costs no decompression.
+//An entry belongs to a file's control block; it is dropped when the file is rewritten, moved or removed.
+struct {
+	int file[CACHE_BLOCKS];		//control block of the file, -1 if the entry is empty
+	int block[CACHE_BLOCKS];	//logical block of the file
+	unsigned long used[CACHE_BLOCKS];	//the least recently used entry is replaced first
+	unsigned long clock;
+	char data[CACHE_BLOCKS][BLOCK_SIZE];
+} block_cache;
+
+//What the codec did so far, for "compress status"
+struct {
+	long packed;			//blocks compressed
+	long raw_bytes;			//bytes they held
+	long packed_bytes;		//bytes they were compressed to
+	long pack_time;			//nanoseconds spent compressing
+	long unpacked;			//blocks decompressed
+	long unpack_time;
+	long cache_hits;
+} codec;
+
+//Progress of the current defragmentation pass
+struct {
+	int phase;		// 0 = pack directories, 1 = relocate file data
+	int cursor;		// next block to look at in the current phase
+	int moved;		// blocks moved so far in this pass
+	int score;		// fragmentation score when the pass started
+} defrag_state;
 
 /*--------------------------------------------------------------------------------*/
 
-//This function initializes the disk, descriptor within the disk, as well as the root directory.
-int do_root(char *name, char *size)
-{
-	(void)*name;
-	(void)*size;
+/************************** Library API ************************************/
+
+//Creates the disk with its descriptor block and root directory; does nothing once the disk exists
+int fs_format ( ) {
 	if ( disk_allocated == true )
-		return 0;
-		
+		return FS_OK;
+
 	//Initialize disk
-	disk = (char*)malloc ( DISK_PARTITION );
-		if ( debug ) printf("\t[%s] Allocating [%d] Bytes of memory to the disk\n", __func__, DISK_PARTITION );
+	int error = FS_ERR_NO_SPACE;
+	disk = volume.count > 0 ? volume_map(&error) : disk_map();
+		TRACE("\t[%s] Allocating [%d] Bytes of memory to the disk\n", __func__, DISK_PARTITION );
+	if ( disk == NULL )
+		return error;
+
+	checksum_init();
+	dedup_reset();
+	cache_reset();
+
+	//A mounted volume has its tree already; only what is kept in memory is built from it
+	if ( volume.mounted ) {
+		sorted_names.count = 0;
+		for ( int i = 0; i < BLOCKS; i++ )
+			name_index_insert(i);
+		reclaim_count();
+		quota_count();
+		TRACE("\t[%s] Volume of [%d] Members Mounted\n", __func__, volume.count );
+		disk_allocated = true;
+		return FS_OK;
+	}
 
-	//Add descriptor and root directory to disk
+	//Add descriptor and root directory to disk; root is created from no directory, so it has no parent
+	working_directory saved = current;
+	strcpy(current.directory, "");
 	add_descriptor("descriptor");
-		if ( debug ) printf("\t[%s] Creating Descriptor Block\n", __func__ );
+		TRACE("\t[%s] Creating Descriptor Block\n", __func__ );
 	add_directory("root");
-		if ( debug ) printf("\t[%s] Creating Root Directory\n", __func__ );
-	
-	//Set up the working_directory structure
-	strcpy(current.directory, "root");
-	current.directory_index = 3;
-	strcpy(current.parent, "" );
-	current.parent_index = -1;
-		if ( debug ) printf("\t[%s] Set Current Directory to [%s], with Parent Directory [%s]\n", __func__, "root", "" );
-	
-	if ( debug ) printf("\t[%s] Disk Successfully Allocated\n", __func__ );
+		TRACE("\t[%s] Creating Root Directory\n", __func__ );
+	current = saved;
+
+	TRACE("\t[%s] Disk Successfully Allocated\n", __func__ );
 	disk_allocated = true;
-	
- 	return 0;
+	return FS_OK;
 }
 
 /*--------------------------------------------------------------------------------*/
 
-int do_print(char *name, char *size)
-{
-	(void)*name;
-	(void)*size;
-	if ( disk_allocated == false ) {
-		printf("Error: Disk not allocated\n");
-		return 0;
+//Maps the disk on a HUGE_PAGE boundary, so that with huge pages each one covers HUGE_PAGE/BLOCK_SIZE whole
+//blocks. MAP_HUGETLB fails when no huge pages are reserved; then transparent ones are asked for instead.
+//Base pages are asked for explicitly too, so that a kernel handing out transparent huge pages to everyone
+//does not blur a comparison.
+char *disk_map ( ) {
+	size_t length = (DISK_PARTITION + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+
+	if ( pages.requested == FS_PAGES_HUGE ) {
+		char *mapped = mmap( NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+		if ( mapped != MAP_FAILED ) {
+			pages.mode = FS_PAGES_HUGE;
+			return mapped;
+		}
 	}
-	//Start with the root directory, which is directory type (true)
-	printing("root");
-	
-	if (debug) if ( debug ) printf("\n\t[%s] Finished printing\n", __func__);
-	return 0;
+
+	//One huge page more than needed, and what lies outside the aligned part is given back
+	char *mapped = mmap( NULL, length + HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+	if ( mapped == MAP_FAILED )
+		return NULL;
+	char *aligned = (char *)(((uintptr_t)mapped + HUGE_PAGE - 1) & ~(uintptr_t)(HUGE_PAGE - 1));
+	if ( aligned > mapped )
+		munmap( mapped, aligned - mapped );
+	if ( mapped + HUGE_PAGE > aligned )
+		munmap( aligned + length, mapped + HUGE_PAGE - aligned );
+
+	pages.mode = FS_PAGES_BASE;
+#ifdef MADV_HUGEPAGE
+	if ( pages.requested != FS_PAGES_BASE && madvise(aligned, length, MADV_HUGEPAGE) == 0 )
+		pages.mode = FS_PAGES_TRANSPARENT;
+	else
+		madvise( aligned, length, MADV_NOHUGEPAGE );
+#endif
+	TRACE("\t[%s] Disk Mapped with Pages [%d]\n", __func__, pages.mode );
+	return aligned;
 }
 
 /*--------------------------------------------------------------------------------*/
 
-int do_chdir(char *name, char *size)
-{
-	(void)*size;
-	if ( disk_allocated == false ) {
-		printf("Error: Disk not allocated\n");
-		return 0;
-	}
-	
-	//Case if ".." is the argument to "chdir"
-	if ( strcmp(name, ".." ) == 0 ) {
-		
-		//If we are in root directory then we can't go back
-		if ( strcmp(current.directory, "root") == 0 )
-			return 0;
-		
-		//Adjust the working_directory struct
-		strcpy ( current.directory, current.parent );	
-		strcpy (current.parent, get_directory_top_level( current.parent) );
-			if ( debug ) printf ("\t[%s] Current Directory is now [%s], Parent Directory is [%s]\n", __func__, current.directory, current.parent);
-		return 0;
-	}
-	else
-	{	
-		char tmp[20];
-
-		//Check to make sure it is a subdirectory that is to be changed
-		//If name is not in the current directory then returns -1, else return 0
-		if ( (strcmp(get_directory_subitem(current.directory, -1, name), "-1") == 0) && strcmp( current.parent, name ) != 0 ) {
-			if ( debug ) printf( "\t\t\t[%s] Cannot Change to Directory [%s]\n", __func__, name );
-			if (!debug ) printf( "%s: %s: No such file or directory\n", "chdir", name );
-			return 0;
-		}
-	
-		strcpy( tmp, get_directory_name(name));
-		if ( strcmp(tmp, "") == 0 )
-			return 0;
-		
-		if ( strcmp( tmp, name ) == 0 ) {
-			//Adjust the working_directory struct
-			strcpy ( current.directory, tmp);
-			
-
-			strcpy(current.parent, get_directory_top_level(name) );
-				if ( debug ) printf ("\t[%s] Current Directory is now [%s], Parent Directory is [%s]\n", __func__, current.directory, current.parent);
-			return 1;
-		}
-		return -1;
-	}
-  return 0;
+void fs_pages ( int mode ) {
+	if ( mode >= FS_PAGES_BASE && mode <= FS_PAGES_HUGE )
+		pages.requested = mode;
 }
 
 /*--------------------------------------------------------------------------------*/
 
-int do_mkdir(char *name, char *size)
-{
-	(void)*size;
-	if ( disk_allocated == false ) {
-		printf("Error: Disk not allocated\n");
-		return 0;
-	}	
-
-	//If it returns 0, there is a subitem with that name already
-	if ( get_directory_subitem(current.directory, -1, name) == 0  ) {
-			if ( debug ) printf( "\t\t\t[%s] Cannot Make Directory [%s]\n", __func__, name );
-			if (!debug ) printf( "%s: cannot create directory '%s': Folder exists\n", "mkdir", name );
-			return 0;
-		}
+//Every handle starts out in the root directory
+fs_handle *fs_attach ( ) {
+	fs_handle *fs = malloc ( sizeof(fs_handle) );
 
-	//Call add directory
-	if ( debug ) printf("\t[%s] Creating Directory: [%s]\n", __func__, name );
-	if ( add_directory( name ) != 0 ) {
-		if (!debug ) printf("%s: missing operand\n", "mkdir");
-		return 0;
-	}
-	
-	//Edit the current directory to add our new directory to the current directory's "subdirectory" member. 
-	//NULL ==> for just editing the subdirectory
-	edit_directory( current.directory, name, NULL, false, true );
-		if ( debug ) printf("\t[%s] Updating Parents Subitem content\n", __func__ );
-		
-	if ( debug ) printf("\t[%s] Directory Created Successfully\n", __func__ );
-	if( debug ) print_directory(name);
-	
-  	return 0;
+	strcpy(fs->cwd.directory, "root");
+	fs->cwd.directory_index = 3;
+	strcpy(fs->cwd.parent, "");
+	fs->cwd.parent_index = -1;
+	fs->id = handles++;
+	return fs;
 }
 
 /*--------------------------------------------------------------------------------*/
 
-int do_rmdir(char *name, char *size)
-{
-	(void)*size;
-	if ( disk_allocated == false ) {
-		printf("Error: Disk not allocated\n");
-		return 0;
-	}
-		
-	if ( strcmp(name,"") == 0 ) {
-		if ( debug ) printf("\t[%s] Invalid Command\n", __func__ );
-		if (!debug ) printf("%s: missing operand\n", "rmdir");
-		return 0;
-	}
-	
-	if( (strcmp(name, ".") == 0) || (strcmp(name, "..") == 0) ) {
-		if ( debug ) printf("\t[%s] Invalid command [%s] Will not remove directory\n", __func__, name);
-		if (!debug ) printf( "%s: %s: No such file or directory\n", "rmdir", name );
-		return 0;
-	}
-	
-	//Check to make sure it is a subdirectory that is to be changed
-	//If name is not in the current directory then returns -1, else return 0
-	if ( strcmp(get_directory_subitem(current.directory, -1, name), "-1") == 0 ) {
-		if ( debug ) printf( "\t[%s] Cannot Remove Directory [%s]\n", __func__, name );
-		if (!debug ) printf( "%s: %s: No such file or directory\n", "rmdir", name );
-		return 0;
-	}
-	
-	//Remove directory from the parent's subitems.
-	dir_type *folder = malloc ( BLOCK_SIZE );
-	int block_index = find_block(name, true);
-	memcpy( folder, disk + block_index*BLOCK_SIZE, BLOCK_SIZE );
+void fs_detach ( fs_handle *fs ) {
+	free(fs);
+}
 
-	dir_type *top_folder = malloc ( BLOCK_SIZE );
+/*--------------------------------------------------------------------------------*/
 
-	//The top_level is created based off the folder 
-	int top_block_index = find_block(folder->top_level, true);
-	memcpy( disk + block_index*BLOCK_SIZE, folder, BLOCK_SIZE );
-	memcpy( top_folder, disk + top_block_index*BLOCK_SIZE, BLOCK_SIZE );
+void fs_debug ( bool on ) {
+	debug = on;
+}
 
-	char subitem_name[MAX_STRING_LENGTH]; // holds the current subitem in the parent directory array
-	const int subcnt = top_folder->subitem_count; // no. of subitems
-	int j;
-	int k=0;
+/*--------------------------------------------------------------------------------*/
 
-	//iterate through the subitem count
-	for(j = 0; j<subcnt; j++) {
-		strcpy(subitem_name, top_folder->subitem[j]);
-		if (strcmp(subitem_name, name) != 0)
-		{
-			strcpy(top_folder->subitem[k],subitem_name);
-			//printf("------ Subitem [%s] copied ------\n", subitem_name);
-			k++;
-		}
-	}
-	
-	//Remove the directory subitem from the parent
-	strcpy(top_folder->subitem[k], "");
+void fs_dedup ( bool on ) {
+	dedup.on = on;
+}
 
-	top_folder->subitem_count--;
-	memcpy( disk + top_block_index*BLOCK_SIZE, top_folder, BLOCK_SIZE );
-	free(top_folder);
-	
-	//Remove the directory with its contents
-	if ( debug ) printf("\t[%s] Removing Directory: [%s]\n", __func__, name );
-	if( remove_directory( name ) == -1 ) {
-		return 0;
+/*--------------------------------------------------------------------------------*/
+
+const char *fs_strerror ( int error ) {
+	switch ( error ) {
+		case FS_OK:			return "Success";
+		case FS_ERR_INVALID:		return "Invalid argument";
+		case FS_ERR_NOT_FOUND:		return "No such file or directory";
+		case FS_ERR_EXISTS:		return "File exists";
+		case FS_ERR_NO_SPACE:		return "No space left on device";
+		case FS_ERR_FULL:		return "Directory full";
+		case FS_ERR_NO_DISK:		return "Disk not allocated";
+		case FS_ERR_IS_DIRECTORY:	return "Is a directory";
+		case FS_ERR_NOT_DIRECTORY:	return "Not a directory";
+		case FS_ERR_BAD_DESCRIPTOR:	return "Bad file descriptor";
+		case FS_ERR_TOO_MANY_OPEN:	return "Too many open files";
+		case FS_ERR_IO:			return "Input/output error";
+		case FS_ERR_CHECKSUM:		return "Block checksum mismatch";
+		case FS_ERR_OVERFLOW:		return "Event queue overflow";
+		case FS_ERR_QUOTA:		return "Disk quota exceeded";
 	}
-	
-	if (debug) printf("\t[%s] Directory Removed Successfully\n", __func__);
-	return 0;
+	return "Unknown error";
 }
 
 /*--------------------------------------------------------------------------------*/
 
-int do_mvdir(char *name, char *size) //"size" is actually the new name
-{
-	if ( disk_allocated == false ) {
-		printf("Error: Disk not allocated\n");
-		return 0;
-	}
+//The engine works in "current"; a call swaps the handle's working directory in and back out.
+//Returns false if the working directory is gone, removed by another handle or by a rollback.
+bool enter ( fs_handle *fs ) {
+	current = fs->cwd;
+	return disk_allocated == false || find_block(current.directory, true) != -1;
+}
 
-	//Rename the directory
-	if ( debug ) printf("\t[%s] Renaming Directory: [%s]\n", __func__, name );
-	//if the directory "name" is not found, return -1
-	if( edit_directory( name, "", size, true, true ) == -1 ) {
-		if (!debug ) printf( "%s: cannot rename file or directory '%s'\n", "mvdir", name );
-		return 0;
-	}
-	
-	//else the directory is renamed
-	if (debug) printf( "\t[%s] Directory Renamed Successfully: [%s]\n", __func__, size );
-	if (debug) print_directory(size); 
-	return 0;
+void leave ( fs_handle *fs ) {
+	fs->cwd = current;
 }
 
 /*--------------------------------------------------------------------------------*/
 
-int do_mkfil(char *name, char *size)
-{
-	if ( disk_allocated == false ) {
-		printf("Error: Disk not allocated\n");
-		return 0;
+int fs_chdir ( fs_handle *fs, char *name ) {
+	bool directory;
+	int error = FS_OK;
+
+	if ( disk_allocated == false )
+		return FS_ERR_NO_DISK;
+	//From a working directory that is gone, the way out starts at root
+	if ( !enter(fs) ) {
+		strcpy( current.directory, "root" );
+		strcpy( current.parent, "" );
 	}
-	
-	if ( debug ) printf("\t[%s] Creating File: [%s], with Size: [%s]\n", __func__, name, size );
-	
-	//If it returns 0, there is a subitem with that name already
-	if ( get_directory_subitem(current.directory, -1, name) == 0  ) {
-			if ( debug ) printf( "\t\t\t[%s] Cannot make file [%s], a file or directory [%s] already exists\n", __func__, name, name );
-			if (!debug ) printf( "%s: cannot create file '%s': File exists\n", "mkfil", name );
-			return 0;
+
+	if ( strcmp(name, "..") == 0 ) {
+		//If we are in root directory then we can't go back
+		if ( strcmp(current.directory, "root") != 0 ) {
+			strcpy( current.directory, current.parent );
+			strcpy( current.parent, get_directory_top_level(current.parent) );
 		}
-	
-	if ( add_file ( name, atoi(size)) != 0 )
-		return 0;
-	
-	//Edit the current directory to add our new file to the current directory's "subdirectory" member.
-  	edit_directory( current.directory, name, NULL, false, false);
-  		if ( debug ) printf("\t[%s] Updating Parents Subitem content\n", __func__ );
-  	
-  	if ( debug ) print_file(name);
-  	return 0;
+	}
+	else if ( find_entry(name, &directory) == -1 && strcmp(current.parent, name) != 0 )
+		error = FS_ERR_NOT_FOUND;
+	else if ( find_block(name, true) == -1 )
+		error = FS_ERR_NOT_DIRECTORY;
+	else {
+		strcpy( current.directory, name );
+		strcpy( current.parent, get_directory_top_level(name) );
+	}
+
+	leave(fs);
+	return error;
 }
 
 /*--------------------------------------------------------------------------------*/
 
-// Remove a file
-int do_rmfil(char *name, char *size)
-{
-	if ( disk_allocated == false ) {
-		printf("Error: Disk not allocated\n");
-		return 0;
+int fs_mkdir ( fs_handle *fs, char *name ) {
+	bool directory;
+	int error = FS_OK;
+
+	if ( disk_allocated == false )
+		return FS_ERR_NO_DISK;
+	if ( !valid_name(name) )
+		return FS_ERR_INVALID;
+	if ( !enter(fs) )
+		return FS_ERR_NOT_FOUND;
+
+	if ( find_entry(name, &directory) != -1 )
+		error = FS_ERR_EXISTS;
+	else if ( get_directory_subitem_count(current.directory) >= MAX_SUBDIRECTORIES )
+		error = FS_ERR_FULL;
+	else if ( !quota_allows(current.directory, 1, 1) )
+		error = FS_ERR_QUOTA;
+	else if ( !reserve_blocks(1) )
+		error = FS_ERR_NO_SPACE;
+	else {
+		add_directory( name );
+		//Edit the current directory to add our new directory to the current directory's "subdirectory" member.
+		edit_directory( current.directory, name, NULL, false, true );
+		publish_change( FS_EVENT_CREATE, current.directory, name, "", true, 0 );
 	}
-	
-	(void)*size;
-	if ( debug ) printf("\t[%s] Removing File: [%s]\n", __func__, name);
 
-		//If the file to be removed actually exists in current directory, remove it
-	if ( get_directory_subitem(current.directory, -1, name) == 0  ) {
-			remove_file(name);
-			return 0;
+	leave(fs);
+	return error;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+int fs_mkfile ( fs_handle *fs, char *name, int size ) {
+	bool directory;
+	int error = FS_OK;
+	int parent_block;
+
+	if ( disk_allocated == false )
+		return FS_ERR_NO_DISK;
+	if ( !valid_name(name) || size < 0 )
+		return FS_ERR_INVALID;
+	if ( !enter(fs) )
+		return FS_ERR_NOT_FOUND;
+
+	//Only the control block; the data blocks start out as holes
+	if ( (parent_block = find_block(current.directory, true)) == -1 )
+		error = FS_ERR_NOT_FOUND;
+	else if ( find_entry(name, &directory) != -1 )
+		error = FS_ERR_EXISTS;
+	else if ( get_directory_subitem_count(current.directory) >= MAX_SUBDIRECTORIES )
+		error = FS_ERR_FULL;
+	else if ( !quota_allows(current.directory, 1, 1) )
+		error = FS_ERR_QUOTA;
+	else if ( ((dir_type *)(disk + parent_block*BLOCK_SIZE))->compress ) {
+		//Created empty and then grown, so the file never takes more blocks than its packed data
+		if ( size/BLOCK_SIZE + 1 > MAX_FILE_DATA_BLOCKS || !reserve_blocks(2) )
+			error = FS_ERR_NO_SPACE;
+		else {
+			add_file( name, 0 );
+			edit_directory( current.directory, name, NULL, false, false );
+			int index = find_block(name, false);
+			error = compress_file( index, true );
+			if ( error == FS_OK )
+				error = resize_file( index, size );
+			if ( error != FS_OK )
+				remove_file( name );
 		}
-	else{ // If it doesn't exist, print error and return 0
-		if ( debug ) printf( "\t\t\t[%s] Cannot remove file [%s], it does not exist in this directory\n", __func__, name );
-		if (!debug ) printf( "%s: %s: No such file or directory\n", "rmfil", name );
-		return 0;
 	}
+	else if ( size/BLOCK_SIZE + 1 > MAX_FILE_DATA_BLOCKS || !reserve_blocks(1) )
+		error = FS_ERR_NO_SPACE;
+	else {
+		add_file( name, size );
+		//Edit the current directory to add our new file to the current directory's "subdirectory" member.
+		edit_directory( current.directory, name, NULL, false, false );
+	}
+	if ( error == FS_OK )
+		publish_change( FS_EVENT_CREATE, current.directory, name, "", false, size );
+
+	leave(fs);
+	return error;
 }
 
 /*--------------------------------------------------------------------------------*/
 
-// Rename a file
-int do_mvfil(char *name, char *size)
-{
-	if ( disk_allocated == false ) {
-		printf("Error: Disk not allocated\n");
-		return 0;
-	}
-	
-	if ( debug ) printf("\t[%s] Renaming File: [%s], to: [%s]\n", __func__, name, size );
+//Only unlinks the entry, so removing a file or a directory takes the same time whatever its size;
+//the reclaim task frees the blocks afterwards
+int fs_remove ( fs_handle *fs, char *name ) {
+	bool directory;
 
-	//If it returns 0, there is a subitem with that name already
-	if ( get_directory_subitem(current.directory, -1, size) == 0  ) {
-			if ( debug ) printf( "\t\t\t[%s] Cannot rename file [%s], a file or directory [%s] already exists\n", __func__, name, size );
-			if (!debug ) printf( "%s: cannot rename file or directory '%s'\n", "mvfil", name );
-			return 0;
-		}
+	if ( disk_allocated == false )
+		return FS_ERR_NO_DISK;
+	if ( !valid_name(name) )
+		return FS_ERR_INVALID;
+	enter(fs);
 
-	int er = edit_file( name, 0, size);
-	
-	if (er == -1) return -1;
-	if (debug) print_file(size);
+	int block_index = find_entry(name, &directory);
+	if ( block_index == -1 ) {
+		leave(fs);
+		return FS_ERR_NOT_FOUND;
+	}
 
-	return 0;
+	unlink_entry( name, block_index, directory );
+	publish_change( FS_EVENT_REMOVE, current.directory, name, "", directory, 0 );
+
+	leave(fs);
+	return FS_OK;
 }
 
 /*--------------------------------------------------------------------------------*/
 
-// Resize a file -- addon to be implemented
-int do_szfil(char *name, char *size)
-{
-	if ( disk_allocated == false ) {
-		printf("Error: Disk not allocated\n");
-		return 0;
-	}
-	
-	if ( debug ) printf("\t[%s] Resizing File: [%s], to: [%s]\n", __func__, name, size );
-	//remove file; make new file with updated size
-	if (remove_file(name) != -1)  do_mkfil(name, size);
-
-	else {
-		if ( debug ) printf("\t[%s] File: [%s] does not exist. Cannot resize.\n", __func__, name);
-		if (!debug ) printf( "%s: cannot resize '%s': No such file or directory\n", "szfil", name );
+int fs_rename ( fs_handle *fs, char *name, char *new_name ) {
+	bool directory, other;
+	int error = FS_OK;
+
+	if ( disk_allocated == false )
+		return FS_ERR_NO_DISK;
+	if ( !valid_name(name) || !valid_name(new_name) )
+		return FS_ERR_INVALID;
+	enter(fs);
+
+	if ( find_entry(name, &directory) == -1 )
+		error = FS_ERR_NOT_FOUND;
+	else if ( find_entry(new_name, &other) != -1 )
+		error = FS_ERR_EXISTS;
+	else if ( directory ) {
+		//Fails if a directory of that name exists anywhere, directories are looked up by name alone
+		if ( edit_directory( name, "", new_name, true, true ) == -1 )
+			error = FS_ERR_EXISTS;
 	}
+	else
+		edit_file( name, 0, new_name );
+	if ( error == FS_OK )
+		publish_change( FS_EVENT_RENAME, current.directory, name, new_name, directory, 0 );
 
-	return 0;
+	leave(fs);
+	return error;
 }
 
 /*--------------------------------------------------------------------------------*/
 
-int do_exit(char *name, char *size)
-{
-	(void)*name;
-	(void)*size;
-	if (debug) printf("\t[%s] Exiting\n", __func__);
-	exit(0);
-	return 0;
+int fs_resize ( fs_handle *fs, char *name, int size ) {
+	bool directory;
+	int error;
+
+	if ( disk_allocated == false )
+		return FS_ERR_NO_DISK;
+	if ( size < 0 )
+		return FS_ERR_INVALID;
+	enter(fs);
+
+	int block_index = find_entry(name, &directory);
+	if ( block_index == -1 )
+		error = FS_ERR_NOT_FOUND;
+	else if ( directory )
+		error = FS_ERR_IS_DIRECTORY;
+	else
+		error = resize_file( block_index, size );
+	if ( error == FS_OK )
+		publish_change( FS_EVENT_RESIZE, current.directory, name, "", false, size );
+
+	leave(fs);
+	return error;
 }
 
 /*--------------------------------------------------------------------------------*/
 
+int fs_copy ( fs_handle *fs, char *name, char *new_name ) {
+	bool directory, other;
+	int error = FS_OK;
+
+	if ( disk_allocated == false )
+		return FS_ERR_NO_DISK;
+	if ( !valid_name(name) || !valid_name(new_name) )
+		return FS_ERR_INVALID;
+	enter(fs);
+
+	int block_index = find_entry(name, &directory);
+	if ( block_index == -1 )
+		error = FS_ERR_NOT_FOUND;
+	else if ( directory )
+		error = FS_ERR_IS_DIRECTORY;
+	else if ( find_entry(new_name, &other) != -1 )
+		error = FS_ERR_EXISTS;
+	else if ( get_directory_subitem_count(current.directory) >= MAX_SUBDIRECTORIES )
+		error = FS_ERR_FULL;
+	else if ( !quota_allows(current.directory, 1, 1 + file_blocks((file_type *)(disk + block_index*BLOCK_SIZE))) )
+		error = FS_ERR_QUOTA;
+	else if ( !reserve_blocks(1) )
+		error = FS_ERR_NO_SPACE;
+	else {
+		copy_file( block_index, new_name );
+		edit_directory( current.directory, new_name, NULL, false, false );
+		publish_change( FS_EVENT_CREATE, current.directory, new_name, "", false, ((file_type *)(disk + block_index*BLOCK_SIZE))->size );
+	}
 
-/******************************* Helper Functions Start *****************************/
+	leave(fs);
+	return error;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Switches a file between compressed and plain data blocks; for a directory ("." is the working
+//directory) it sets whether the files created in it from now on are compressed
+int fs_compress ( fs_handle *fs, char *name, bool on ) {
+	bool directory = true;
+	int error = FS_OK;
+
+	if ( disk_allocated == false )
+		return FS_ERR_NO_DISK;
+	if ( strcmp(name, ".") != 0 && !valid_name(name) )
+		return FS_ERR_INVALID;
+	enter(fs);
+
+	int block_index = strcmp(name, ".") == 0 ? find_block(current.directory, true) : find_entry(name, &directory);
+	if ( block_index == -1 )
+		error = FS_ERR_NOT_FOUND;
+	else if ( directory ) {
+		dir_type *folder = malloc ( BLOCK_SIZE );
+		memcpy( folder, disk + block_index*BLOCK_SIZE, BLOCK_SIZE );
+		folder->compress = on;
+		write_blocks( block_index, folder, 1 );
+		free(folder);
+	}
+	else if ( ((file_type *)(disk + block_index*BLOCK_SIZE))->compressed != on )
+		error = compress_file( block_index, on );
+
+	leave(fs);
+	return error;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Limits the blocks and the entries of a directory ("." is the working directory) and everything below it;
+//0 lifts a limit. A quota below what the directory holds already only stops it from growing.
+int fs_quota_set ( fs_handle *fs, char *name, int blocks, int entries ) {
+	bool directory = true;
+
+	if ( disk_allocated == false )
+		return FS_ERR_NO_DISK;
+	if ( blocks < 0 || entries < 0 )
+		return FS_ERR_INVALID;
+	enter(fs);
+
+	int block_index = strcmp(name, ".") == 0 ? find_block(current.directory, true) : find_entry(name, &directory);
+	leave(fs);
+	if ( block_index == -1 )
+		return FS_ERR_NOT_FOUND;
+	if ( !directory )
+		return FS_ERR_NOT_DIRECTORY;
+
+	dir_type *folder = malloc ( BLOCK_SIZE );
+	memcpy( folder, disk + block_index*BLOCK_SIZE, BLOCK_SIZE );
+	bool had = folder->quota_blocks > 0 || folder->quota_entries > 0;
+	folder->quota_blocks = blocks;
+	folder->quota_entries = entries;
+	write_blocks( block_index, folder, 1 );
+	quota_directories += (blocks > 0 || entries > 0) - had;
+	TRACE("\t[%s] Directory [%s] Limited to [%d] Blocks and [%d] Entries\n", __func__, folder->name, blocks, entries );
+	free(folder);
+	return FS_OK;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+int fs_quota_get ( fs_handle *fs, char *name, fs_quota_type *quota ) {
+	bool directory = true;
+
+	if ( disk_allocated == false )
+		return FS_ERR_NO_DISK;
+	enter(fs);
+
+	int block_index = strcmp(name, ".") == 0 ? find_block(current.directory, true) : find_entry(name, &directory);
+	leave(fs);
+	if ( block_index == -1 )
+		return FS_ERR_NOT_FOUND;
+	if ( !directory )
+		return FS_ERR_NOT_DIRECTORY;
+
+	dir_type *folder = (dir_type *)(disk + block_index*BLOCK_SIZE);
+	quota->blocks = folder->quota_blocks;
+	quota->entries = folder->quota_entries;
+	quota->used_blocks = folder->total_blocks;
+	quota->used_entries = folder->total_entries;
+	return FS_OK;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+int fs_stat ( fs_handle *fs, char *name, fs_stat_type *stat ) {
+	bool directory = true;
+
+	if ( disk_allocated == false )
+		return FS_ERR_NO_DISK;
+	enter(fs);
+
+	int block_index = strcmp(name, ".") == 0 ? find_block(current.directory, true) : find_entry(name, &directory);
+	leave(fs);
+	if ( block_index == -1 )
+		return FS_ERR_NOT_FOUND;
+
+	stat_block( block_index, directory, stat );
+	return FS_OK;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+int fs_readdir ( fs_handle *fs, char *name, fs_entry_type *entries, int max ) {
+	bool directory = true;
+
+	if ( disk_allocated == false )
+		return FS_ERR_NO_DISK;
+	enter(fs);
+
+	int block_index = strcmp(name, ".") == 0 ? find_block(current.directory, true) : find_entry(name, &directory);
+	leave(fs);
+	if ( block_index == -1 )
+		return FS_ERR_NOT_FOUND;
+	if ( !directory )
+		return FS_ERR_NOT_DIRECTORY;
+
+	dir_type *folder = (dir_type *)(disk + block_index*BLOCK_SIZE);
+	for ( int i = 0; i < folder->subitem_count && i < max; i++ ) {
+		strcpy( entries[i].name, folder->subitem[i] );
+		entries[i].directory = folder->subitem_type[i];
+	}
+	return folder->subitem_count;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Fills at most "max" entries of a directory in name order, starting after the name "after" ("" for the first
+//page). The last name of a page is the cursor of the next one; since it is a name and not a position, it stays
+//valid whatever is added or removed in between. Each page keeps only its own entries, sorted by insertion.
+int fs_listdir ( fs_handle *fs, char *name, const char *after, fs_entry_type *entries, int max ) {
+	bool directory = true;
+	int count = 0;
+
+	if ( disk_allocated == false )
+		return FS_ERR_NO_DISK;
+	if ( after == NULL || max < 0 )
+		return FS_ERR_INVALID;
+	enter(fs);
+
+	int block_index = strcmp(name, ".") == 0 ? find_block(current.directory, true) : find_entry(name, &directory);
+	leave(fs);
+	if ( block_index == -1 )
+		return FS_ERR_NOT_FOUND;
+	if ( !directory )
+		return FS_ERR_NOT_DIRECTORY;
+	if ( max == 0 )
+		return 0;
+
+	dir_type *folder = (dir_type *)(disk + block_index*BLOCK_SIZE);
+	for ( int i = 0; i < folder->subitem_count; i++ ) {
+		char *subitem = folder->subitem[i];
+		if ( strcmp(subitem, after) <= 0 || (count == max && strcmp(subitem, entries[max - 1].name) >= 0) )
+			continue;
+
+		//Once the page is full the last entry drops out
+		int j = count < max ? count++ : max - 1;
+		for ( ; j > 0 && strcmp(entries[j - 1].name, subitem) > 0; j-- )
+			entries[j] = entries[j - 1];
+		strcpy( entries[j].name, subitem );
+		entries[j].directory = folder->subitem_type[i];
+	}
+	return count;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+int fs_read ( fs_handle *fs, char *name, int offset, void *buffer, int length ) {
+	bool directory;
+
+	if ( disk_allocated == false )
+		return FS_ERR_NO_DISK;
+	if ( offset < 0 || length < 0 )
+		return FS_ERR_INVALID;
+	enter(fs);
+
+	int block_index = find_entry(name, &directory);
+	leave(fs);
+	if ( block_index == -1 )
+		return FS_ERR_NOT_FOUND;
+	if ( directory )
+		return FS_ERR_IS_DIRECTORY;
+	return read_file( block_index, offset, buffer, length );
+}
+
+/*--------------------------------------------------------------------------------*/
+
+int fs_write ( fs_handle *fs, char *name, int offset, const void *buffer, int length ) {
+	bool directory;
+
+	if ( disk_allocated == false )
+		return FS_ERR_NO_DISK;
+	if ( offset < 0 || length < 0 )
+		return FS_ERR_INVALID;
+	enter(fs);
+
+	int block_index = find_entry(name, &directory);
+	leave(fs);
+	if ( block_index == -1 )
+		return FS_ERR_NOT_FOUND;
+	if ( directory )
+		return FS_ERR_IS_DIRECTORY;
+	return write_file( block_index, offset, buffer, length );
+}
+
+/*--------------------------------------------------------------------------------*/
+
+int fs_readv ( fs_handle *fs, char *name, const fs_segment *segments, int count ) {
+	bool directory;
+
+	if ( disk_allocated == false )
+		return FS_ERR_NO_DISK;
+	if ( !valid_segments(segments, count) )
+		return FS_ERR_INVALID;
+	enter(fs);
+
+	int block_index = find_entry(name, &directory);
+	leave(fs);
+	if ( block_index == -1 )
+		return FS_ERR_NOT_FOUND;
+	if ( directory )
+		return FS_ERR_IS_DIRECTORY;
+	return read_segments( block_index, segments, count );
+}
+
+/*--------------------------------------------------------------------------------*/
+
+int fs_writev ( fs_handle *fs, char *name, const fs_segment *segments, int count ) {
+	bool directory;
+
+	if ( disk_allocated == false )
+		return FS_ERR_NO_DISK;
+	if ( !valid_segments(segments, count) )
+		return FS_ERR_INVALID;
+	enter(fs);
+
+	int block_index = find_entry(name, &directory);
+	leave(fs);
+	if ( block_index == -1 )
+		return FS_ERR_NOT_FOUND;
+	if ( directory )
+		return FS_ERR_IS_DIRECTORY;
+	return write_segments( block_index, segments, count );
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Looks the file up once; the descriptor remembers its control block for the calls below
+int fs_open ( fs_handle *fs, char *name ) {
+	bool directory;
+
+	if ( disk_allocated == false )
+		return FS_ERR_NO_DISK;
+	enter(fs);
+
+	int block_index = find_entry(name, &directory);
+	leave(fs);
+	if ( block_index == -1 )
+		return FS_ERR_NOT_FOUND;
+	if ( directory )
+		return FS_ERR_IS_DIRECTORY;
+
+	for ( int fd = 0; fd < MAX_OPEN_FILES; fd++ ) {
+		if ( !open_files.open[fd] ) {
+			open_files.open[fd] = true;
+			open_files.block[fd] = block_index;
+			open_files.references[block_index]++;
+				TRACE("\t[%s] Opened File [%s] at Memory Block [%d] as Descriptor [%d]\n", __func__, name, block_index, fd );
+			return fd;
+		}
+	}
+	return FS_ERR_TOO_MANY_OPEN;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+int fs_close ( int fd ) {
+	int block_index = open_file_block(fd);
+
+	if ( block_index == FS_ERR_BAD_DESCRIPTOR )
+		return block_index;
+	if ( block_index >= 0 )
+		open_files.references[block_index]--;
+	open_files.open[fd] = false;
+	return FS_OK;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+int fs_fstat ( int fd, fs_stat_type *stat ) {
+	int block_index = open_file_block(fd);
+
+	if ( block_index < 0 )
+		return block_index;
+	stat_block( block_index, false, stat );
+	return FS_OK;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+int fs_fresize ( int fd, int size ) {
+	int block_index = open_file_block(fd);
+
+	if ( block_index < 0 )
+		return block_index;
+	if ( size < 0 )
+		return FS_ERR_INVALID;
+
+	int error = resize_file( block_index, size );
+	file_type *file = (file_type *)(disk + block_index*BLOCK_SIZE);
+	if ( error == FS_OK )
+		publish_change( FS_EVENT_RESIZE, file->top_level, file->name, "", false, size );
+	return error;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+int fs_pread ( int fd, int offset, void *buffer, int length ) {
+	int block_index = open_file_block(fd);
+
+	if ( block_index < 0 )
+		return block_index;
+	if ( offset < 0 || length < 0 )
+		return FS_ERR_INVALID;
+	return read_file( block_index, offset, buffer, length );
+}
+
+/*--------------------------------------------------------------------------------*/
+
+int fs_pwrite ( int fd, int offset, const void *buffer, int length ) {
+	int block_index = open_file_block(fd);
+
+	if ( block_index < 0 )
+		return block_index;
+	if ( offset < 0 || length < 0 )
+		return FS_ERR_INVALID;
+	return write_file( block_index, offset, buffer, length );
+}
+
+/*--------------------------------------------------------------------------------*/
+
+int fs_preadv ( int fd, const fs_segment *segments, int count ) {
+	int block_index = open_file_block(fd);
+
+	if ( block_index < 0 )
+		return block_index;
+	if ( !valid_segments(segments, count) )
+		return FS_ERR_INVALID;
+	return read_segments( block_index, segments, count );
+}
+
+/*--------------------------------------------------------------------------------*/
+
+int fs_pwritev ( int fd, const fs_segment *segments, int count ) {
+	int block_index = open_file_block(fd);
+
+	if ( block_index < 0 )
+		return block_index;
+	if ( !valid_segments(segments, count) )
+		return FS_ERR_INVALID;
+	return write_segments( block_index, segments, count );
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Takes a snapshot of the whole disk; no block is copied until it changes
+int fs_snapshot_create ( char *name ) {
+	if ( disk_allocated == false )
+		return FS_ERR_NO_DISK;
+	if ( !valid_name(name) )
+		return FS_ERR_INVALID;
+	if ( snapshot_find(name) != NULL )
+		return FS_ERR_EXISTS;
+
+	snapshot *shot = calloc( 1, sizeof(snapshot) );
+	strcpy( shot->name, name );
+	shot->generation = ++snapshots.generation;
+	shot->created = time(NULL);
+	shot->older = snapshots.newest;
+	snapshots.newest = shot;
+	snapshots.count++;
+	TRACE("\t[%s] Snapshot [%s] Taken in Generation [%d]\n", __func__, name, shot->generation );
+	return FS_OK;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Drops a snapshot and every saved block no other snapshot shares
+int fs_snapshot_delete ( char *name ) {
+	snapshot **link = &snapshots.newest;
+
+	if ( !valid_name(name) )
+		return FS_ERR_INVALID;
+	while ( *link != NULL && strcmp((*link)->name, name) != 0 )
+		link = &(*link)->older;
+	if ( *link == NULL )
+		return FS_ERR_NOT_FOUND;
+
+	snapshot *shot = *link;
+	for ( int i = 0; i < BLOCKS; i++ ) {
+		if ( shot->block[i] != NULL && --shot->block[i]->references == 0 ) {
+			free( shot->block[i] );
+			snapshots.copies--;
+		}
+	}
+	TRACE("\t[%s] Snapshot [%s] Deleted with [%d] Saved Blocks\n", __func__, name, shot->saved );
+	*link = shot->older;
+	snapshots.count--;
+	free(shot);
+	return FS_OK;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Puts the disk back the way it was when the snapshot was taken; the snapshot itself stays.
+//Open descriptors of files that are gone now are closed off. The calling handle is moved to root
+//if its working directory is gone; other such handles cannot create entries until they change directory.
+int fs_snapshot_rollback ( fs_handle *fs, char *name ) {
+	if ( disk_allocated == false )
+		return FS_ERR_NO_DISK;
+	if ( !valid_name(name) )
+		return FS_ERR_INVALID;
+	snapshot *shot = snapshot_find(name);
+	if ( shot == NULL )
+		return FS_ERR_NOT_FOUND;
+	enter(fs);
+
+	tasks[0].active = false;	//a defrag pass would go on with a stale cursor
+	snapshot_restore( shot );
+
+	if ( find_block(current.directory, true) == -1 ) {
+		strcpy( current.directory, "root" );
+		strcpy( current.parent, "" );
+	}
+	publish_change( FS_EVENT_RESET, "", "", "", true, 0 );
+	TRACE("\t[%s] Disk Rolled Back to Snapshot [%s]\n", __func__, name );
+
+	leave(fs);
+	return FS_OK;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Lists the snapshots oldest first
+int fs_snapshot_list ( fs_snapshot_type *list, int max ) {
+	int position = snapshots.count;
+
+	for ( snapshot *shot = snapshots.newest; shot != NULL; shot = shot->older ) {
+		if ( --position >= max )
+			continue;
+		strcpy( list[position].name, shot->name );
+		list[position].created = shot->created;
+		list[position].blocks = shot->saved;
+	}
+	return snapshots.count;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Runs one line of the text interface in the handle's working directory; the command prints to "out".
+//While a trace is recorded the output is collected first, so that the trace can hold its checksum.
+int fs_command ( fs_handle *fs, const char *line, FILE *out ) {
+	char copy[LINESIZE];
+	struct timespec start;
+	char *printed = NULL;
+	size_t printed_length = 0;
+	FILE *capture = NULL;
+
+	//parse() cuts the words out of the line in place
+	snprintf( copy, LINESIZE, "%s", line );
+	if ( command_trace.file != NULL ) {
+		capture = open_memstream( &printed, &printed_length );
+		clock_gettime( CLOCK_MONOTONIC, &start );
+	}
+	active = fs;
+	output = capture != NULL ? capture : out;
+	enter(fs);
+	int ret = run_command(copy);
+	leave(fs);
+	output = stdout;
+	if ( capture != NULL ) {
+		fclose( capture );
+		trace_command( fs->id, line, ret, ~crc32c_update(0xFFFFFFFF, printed, printed_length), &start );
+		fwrite( printed, 1, printed_length, out );
+		free( printed );
+	}
+	return ret;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Gives every active background task one time slice; finished tasks report to "out"
+bool fs_background_step ( FILE *out ) {
+	bool pending = false;
+
+	output = out;
+	for ( struct task *ptr = tasks; ptr->name != NULL; ptr++ ) {
+		if ( !ptr->active )
+			continue;
+		if ( (ptr->step)(SLICE_MICROSECONDS) ) {
+			ptr->active = false;
+			(ptr->finish)();
+		}
+		else
+			pending = true;
+	}
+	output = stdout;
+	return pending;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Parses one command line and dispatches it through table[]; returns what the command returned
+int run_command(char *line)
+{
+  char *cmd, *fnm, *fsz;
+  char dummy[] = "";
+  int n;
+  char *a[LINESIZE];
+
+  // commands are all of form "cmd filename filesize\n" with whitespace as a delimiter
+
+  // parse input
+  parse(line, &n, a);
+
+  cmd = (n > 0) ? a[0] : dummy;
+  fnm = (n > 1) ? a[1] : dummy;
+  fsz = (n > 2) ? a[2] : dummy;
+  operand = (n > 3) ? a[3] : dummy;
+
+  TRACE(":%s:%s:%s:\n", cmd, fnm, fsz);
+
+  if (n == 0) return 0;	// blank line
+
+  for (struct action *ptr = table; ptr->cmd != NULL; ptr++){  
+        if (strcmp(ptr->cmd, cmd) == 0)
+            {
+                int ret = (ptr->action)(fnm, fsz);
+                //every function returns -1 on failure
+                if (ret == -1)
+                    { fprintf(output, "  %s %s %s: failed\n", cmd, fnm, fsz); }
+                return ret;
+            }
+    }
+  fprintf(output, "command not found: %s\n", cmd);
+  return -1;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+void parse(char *buf, int *argc, char *argv[])
+{
+  char *delim;          // points to first space delimiter
+  int count = 0;        // number of args
+
+  char whsp[] = " \t\n\v\f\r";          // whitespace characters
+
+  while (1)                             // build the argv list
+    {
+      buf += strspn(buf, whsp);         // skip leading whitespace
+      delim = strpbrk(buf, whsp);       // next whitespace char or NULL
+      if (delim == NULL)                // end of line, input parsed
+        {
+          if (*buf != '\0')            // last word, no newline after it
+            { argv[count++] = buf; }
+          break;
+        }
+      argv[count++] = buf;              
+      *delim = '\0';                    
+      buf = delim + 1;                  
+    }
+  argv[count] = NULL;
+
+  *argc = count;
+
+  return;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//This function initializes the disk, descriptor within the disk, as well as the root directory.
+int do_root(char *name, char *size)
+{
+	(void)*name;
+	(void)*size;
+	int error = fs_format();
+	if ( error != FS_OK ) {
+		fprintf( output, "%s: cannot create the disk: %s\n", "root", fs_strerror(error) );
+		return -1;
+	}
+ 	return 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+int do_print(char *name, char *size)
+{
+	(void)*name;
+	(void)*size;
+	if ( disk_allocated == false ) {
+		fprintf(output, "Error: Disk not allocated\n");
+		return 0;
+	}
+	//Start with the root directory, which is directory type (true)
+	printing("root");
+	
+	TRACE("\n\t[%s] Finished printing\n", __func__);
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+// Sorted listing: "ls [dir] [cursor] [limit]" prints at most "limit" entries of a directory in name order, those
+// after "cursor" ("-" or nothing for the first page), and then the cursor of the next page if there is more
+int do_ls(char *name, char *size)
+{
+	char *directory = strcmp(name, "") == 0 ? "." : name;
+	char *after = strcmp(size, "-") == 0 ? "" : size;
+	int limit = strcmp(operand, "") == 0 ? LS_PAGE : atoi(operand);
+
+	if ( disk_allocated == false ) {
+		fprintf(output, "Error: Disk not allocated\n");
+		return 0;
+	}
+	if ( limit < 1 ) {
+		fprintf(output, "%s: invalid limit '%s'\n", "ls", operand);
+		return -1;
+	}
+
+	//One entry more than the page tells whether there is a next one
+	fs_entry_type *entries = malloc( sizeof(fs_entry_type)*(limit + 1) );
+	int count = fs_listdir( active, directory, after, entries, limit + 1 );
+	if ( count < 0 ) {
+		fprintf( output, "%s: cannot access '%s': %s\n", "ls", directory, fs_strerror(count) );
+		free(entries);
+		return -1;
+	}
+	for ( int i = 0; i < count && i < limit; i++ )
+		fprintf(output, "%s%s\n", entries[i].name, entries[i].directory ? "/" : "");
+	if ( count > limit )
+		fprintf(output, "next: %s\n", entries[limit - 1].name);
+	free(entries);
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+int do_chdir(char *name, char *size)
+{
+	(void)*size;
+	if ( disk_allocated == false ) {
+		fprintf(output, "Error: Disk not allocated\n");
+		return 0;
+	}
+	
+	int error = fs_chdir( active, name );
+	if ( error != FS_OK ) {
+		TRACE( "\t\t\t[%s] Cannot Change to Directory [%s]\n", __func__, name );
+		fprintf( output, "%s: %s: %s\n", "chdir", name, fs_strerror(error) );
+		return 0;
+	}
+	TRACE("\t[%s] Current Directory is now [%s], Parent Directory is [%s]\n", __func__, current.directory, current.parent);
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+int do_mkdir(char *name, char *size)
+{
+	(void)*size;
+	if ( disk_allocated == false ) {
+		fprintf(output, "Error: Disk not allocated\n");
+		return 0;
+	}	
+
+	//Call add directory
+	TRACE("\t[%s] Creating Directory: [%s]\n", __func__, name );
+	int error = batch.open && batch.owner == active ? batch_queue( FS_BATCH_MKDIR, name, 0 ) : fs_mkdir( active, name );
+	if ( error == FS_ERR_INVALID && strcmp(name, "") == 0 ) {
+		fprintf(output, "%s: missing operand\n", "mkdir");
+		return 0;
+	}
+	if ( error != FS_OK ) {
+		TRACE( "\t\t\t[%s] Cannot Make Directory [%s]\n", __func__, name );
+		fprintf( output, "%s: cannot create directory '%s': %s\n", "mkdir", name, fs_strerror(error) );
+		return 0;
+	}
+	if ( batch.open && batch.owner == active )
+		return 0;
+		
+	TRACE("\t[%s] Directory Created Successfully\n", __func__ );
+	print_directory(name);
+	
+  	return 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+int do_rmdir(char *name, char *size)
+{
+	fs_stat_type stat;
+
+	(void)*size;
+	if ( disk_allocated == false ) {
+		fprintf(output, "Error: Disk not allocated\n");
+		return 0;
+	}
+		
+	if ( strcmp(name,"") == 0 ) {
+		TRACE("\t[%s] Invalid Command\n", __func__ );
+		fprintf(output, "%s: missing operand\n", "rmdir");
+		return 0;
+	}
+	
+	//Only a subdirectory of the current directory can be removed
+	int error = fs_stat( active, name, &stat );
+	if ( error == FS_OK && !stat.directory )
+		error = FS_ERR_NOT_DIRECTORY;
+	if ( error == FS_OK && strcmp(name, ".") == 0 )
+		error = FS_ERR_INVALID;
+	if ( error == FS_OK )
+		error = fs_remove( active, name );
+	if ( error != FS_OK ) {
+		TRACE( "\t[%s] Cannot Remove Directory [%s]\n", __func__, name );
+		fprintf( output, "%s: %s: %s\n", "rmdir", name, fs_strerror(error) );
+		return 0;
+	}
+	
+	TRACE("\t[%s] Directory Removed Successfully\n", __func__);
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+int do_mvdir(char *name, char *size) //"size" is actually the new name
+{
+	fs_stat_type stat;
+
+	if ( disk_allocated == false ) {
+		fprintf(output, "Error: Disk not allocated\n");
+		return 0;
+	}
+
+	//Rename the directory
+	TRACE("\t[%s] Renaming Directory: [%s]\n", __func__, name );
+	int error = fs_stat( active, name, &stat );
+	if ( error == FS_OK && !stat.directory )
+		error = FS_ERR_NOT_DIRECTORY;
+	if ( error == FS_OK )
+		error = fs_rename( active, name, size );
+	if ( error != FS_OK ) {
+		fprintf( output, "%s: cannot rename file or directory '%s': %s\n", "mvdir", name, fs_strerror(error) );
+		return 0;
+	}
+	
+	//else the directory is renamed
+	TRACE( "\t[%s] Directory Renamed Successfully: [%s]\n", __func__, size );
+	print_directory(size); 
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+int do_mkfil(char *name, char *size)
+{
+	if ( disk_allocated == false ) {
+		fprintf(output, "Error: Disk not allocated\n");
+		return 0;
+	}
+	
+	TRACE("\t[%s] Creating File: [%s], with Size: [%s]\n", __func__, name, size );
+	
+	int error = batch.open && batch.owner == active ? batch_queue( FS_BATCH_MKFILE, name, atoi(size) ) : fs_mkfile( active, name, atoi(size) );
+	if ( error == FS_ERR_INVALID ) {
+		TRACE("\t\t[%s] Invalid command\n", __func__);
+		fprintf(output, "%s: missing operand\n", "mkfil");
+		return 0;
+	}
+	if ( error != FS_OK ) {
+		TRACE( "\t\t\t[%s] Cannot make file [%s]: %s\n", __func__, name, fs_strerror(error) );
+		fprintf( output, "%s: cannot create file '%s': %s\n", "mkfil", name, fs_strerror(error) );
+		return 0;
+	}
+	if ( batch.open && batch.owner == active )
+		return 0;
+  	
+  	print_file(name);
+  	return 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+// Remove a file
+int do_rmfil(char *name, char *size)
+{
+	fs_stat_type stat;
+
+	if ( disk_allocated == false ) {
+		fprintf(output, "Error: Disk not allocated\n");
+		return 0;
+	}
+	
+	(void)*size;
+	TRACE("\t[%s] Removing File: [%s]\n", __func__, name);
+
+	if ( strcmp(name,"") == 0 ) {
+		TRACE("\t\t[%s] Invalid command\n", __func__);
+		fprintf(output, "%s: missing operand\n", "rmfil");
+		return 0;
+	}
+
+	//If the file to be removed actually exists in current directory, remove it
+	int error = fs_stat( active, name, &stat );
+	if ( error == FS_OK && stat.directory )
+		error = FS_ERR_IS_DIRECTORY;
+	if ( error == FS_OK )
+		error = fs_remove( active, name );
+	if ( error != FS_OK ) { // If it doesn't exist, print error and return 0
+		TRACE( "\t\t\t[%s] Cannot remove file [%s]: %s\n", __func__, name, fs_strerror(error) );
+		fprintf( output, "%s: %s: %s\n", "rmfil", name, fs_strerror(error) );
+	}
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+// Rename a file
+int do_mvfil(char *name, char *size)
+{
+	fs_stat_type stat;
+
+	if ( disk_allocated == false ) {
+		fprintf(output, "Error: Disk not allocated\n");
+		return 0;
+	}
+	
+	TRACE("\t[%s] Renaming File: [%s], to: [%s]\n", __func__, name, size );
+
+	int error = fs_stat( active, name, &stat );
+	if ( error == FS_OK && stat.directory )
+		error = FS_ERR_IS_DIRECTORY;
+	if ( error == FS_OK )
+		error = fs_rename( active, name, size );
+	if ( error != FS_OK ) {
+		TRACE( "\t\t\t[%s] Cannot rename file [%s] to [%s]: %s\n", __func__, name, size, fs_strerror(error) );
+		fprintf( output, "%s: cannot rename file or directory '%s': %s\n", "mvfil", name, fs_strerror(error) );
+		return 0;
+	}
+
+	print_file(size);
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+// Resize a file, keeping its data
+int do_szfil(char *name, char *size)
+{
+	if ( disk_allocated == false ) {
+		fprintf(output, "Error: Disk not allocated\n");
+		return 0;
+	}
+	
+	TRACE("\t[%s] Resizing File: [%s], to: [%s]\n", __func__, name, size );
+	int error = fs_resize( active, name, atoi(size) );
+	if ( error != FS_OK ) {
+		TRACE("\t[%s] Cannot resize File: [%s]: %s\n", __func__, name, fs_strerror(error));
+		fprintf( output, "%s: cannot resize '%s': %s\n", "szfil", name, fs_strerror(error) );
+		return 0;
+	}
+
+	print_file(name);
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+// Copy a file; the copy shares the data blocks until one of the two is written
+int do_cpfil(char *name, char *size) //"size" is actually the name of the copy
+{
+	if ( disk_allocated == false ) {
+		fprintf(output, "Error: Disk not allocated\n");
+		return 0;
+	}
+
+	TRACE("\t[%s] Copying File: [%s], to: [%s]\n", __func__, name, size );
+	int error = fs_copy( active, name, size );
+	if ( error == FS_ERR_INVALID ) {
+		fprintf(output, "%s: missing operand\n", "cpfil");
+		return 0;
+	}
+	if ( error != FS_OK ) {
+		TRACE( "\t\t\t[%s] Cannot copy file [%s] to [%s]: %s\n", __func__, name, size, fs_strerror(error) );
+		fprintf( output, "%s: cannot copy '%s' to '%s': %s\n", "cpfil", name, size, fs_strerror(error) );
+		return 0;
+	}
+
+	print_file(size);
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+// Defragment the disk: "defrag" runs a whole pass now, "defrag bg" runs it in the background,
+// "defrag stop" cancels a background pass and "defrag status" reports the fragmentation score
+int do_defrag(char *name, char *size)
+{
+	(void)*size;
+	if ( disk_allocated == false ) {
+		fprintf(output, "Error: Disk not allocated\n");
+		return 0;
+	}
+
+	struct task *task = &tasks[0];
+
+	if ( strcmp(name, "status") == 0 ) {
+		fprintf(output, "fragmentation score: %d%s\n", fragmentation_score(), task->active ? " (defragmenting)" : "");
+		return 0;
+	}
+	if ( strcmp(name, "stop") == 0 ) {
+		if ( task->active ) fprintf(output, "defrag: stopped after moving %d blocks\n", defrag_state.moved);
+		task->active = false;
+		return 0;
+	}
+	if ( strcmp(name, "") != 0 && strcmp(name, "bg") != 0 ) {
+		fprintf(output, "%s: unknown option '%s'\n", "defrag", name);
+		return -1;
+	}
+
+	//Start a new pass unless one is already running in the background
+	if ( !task->active ) {
+		defrag_state.phase = 0;
+		defrag_state.cursor = 0;
+		defrag_state.moved = 0;
+		defrag_state.score = fragmentation_score();
+		task->active = true;
+	}
+	fprintf(output, "fragmentation score before: %d\n", defrag_state.score);
+
+	if ( strcmp(name, "bg") == 0 ) {
+		TRACE("\t[%s] Defragmenting in the Background\n", __func__);
+		return 0;
+	}
+
+	//Foreground: keep running slices until the pass is done
+	while ( !defrag_step(SLICE_MICROSECONDS) )
+		;
+	task->active = false;
+	defrag_finish();
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+// Check that the descriptor agrees with what is reachable from root; "fsck repair" also fixes what it can
+int do_fsck(char *name, char *size)
+{
+	(void)*size;
+	if ( disk_allocated == false ) {
+		fprintf(output, "Error: Disk not allocated\n");
+		return 0;
+	}
+	bool repair = strcmp(name, "repair") == 0;
+	if ( strcmp(name, "") != 0 && !repair ) {
+		fprintf(output, "%s: unknown option '%s'\n", "fsck", name);
+		return -1;
+	}
+
+	int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if ( threads < 1 ) threads = 1;
+	if ( threads > MAX_FSCK_THREADS ) threads = MAX_FSCK_THREADS;
+	if ( threads > GROUPS ) threads = GROUPS;
+
+	fsck_state state;
+	memset( &state, 0, sizeof(state) );
+	state.descriptor = malloc( BLOCK_SIZE*DESCRIPTOR_BLOCKS );
+	memcpy ( state.descriptor, disk, BLOCK_SIZE*DESCRIPTOR_BLOCKS );
+	state.directories = malloc( sizeof(fsck_name)*BLOCKS );
+	state.files = malloc( sizeof(fsck_name)*BLOCKS );
+	state.claims = calloc( BLOCKS, sizeof(int) );
+	state.status = calloc( BLOCKS, sizeof(char) );
+	state.queue = malloc( sizeof(int)*BLOCKS );
+	state.dangling = malloc( sizeof(int)*2*BLOCKS*MAX_SUBDIRECTORIES );
+	state.mistyped = malloc( sizeof(int)*2*BLOCKS*MAX_SUBDIRECTORIES );
+	pthread_mutex_init( &state.lock, NULL );
+	pthread_cond_init( &state.wake, NULL );
+
+	//Name tables, so that the workers never have to scan the descriptor
+	for ( int i = 0; i < BLOCKS; i++ ) {
+		if ( state.descriptor->free[i] )
+			continue;
+		if ( state.descriptor->directory[i] )
+			state.directories[state.directory_count++] = (fsck_name){ state.descriptor->name[i], i };
+		else if ( is_file_block(state.descriptor, i) )
+			state.files[state.file_count++] = (fsck_name){ state.descriptor->name[i], i };
+		else if ( strcmp(state.descriptor->name[i], "descriptor") == 0 )
+			state.claims[i]++;
+	}
+	qsort( state.directories, state.directory_count, sizeof(fsck_name), fsck_compare );
+	qsort( state.files, state.file_count, sizeof(fsck_name), fsck_compare );
+		TRACE("\t[%s] Checking [%d] Directories and [%d] Files with [%d] Threads\n", __func__, state.directory_count, state.file_count, threads );
+
+	//Walk the tree from root, one directory at a time per worker
+	int root = fsck_lookup( &state, "root", true );
+	if ( root == -1 ) {
+		fsck_report( &state, "fsck: root directory is missing\n" );
+	}
+	else {
+		state.claims[root]++;
+		state.queue[state.queue_tail++] = root;
+	}
+
+	//Removed entries hold their blocks until they are reclaimed; the entries below a directory are removed ones themselves
+	for ( int i = 0; i < BLOCKS; i++ ) {
+		if ( state.descriptor->free[i] || strcmp(state.descriptor->name[i], REMOVED_NAME) != 0 )
+			continue;
+		state.claims[i]++;
+		if ( !state.descriptor->directory[i] )
+			fsck_claim_file( &state, i );
+	}
+
+	pthread_t workers[MAX_FSCK_THREADS];
+	for ( int t = 0; t < threads; t++ )
+		pthread_create( &workers[t], NULL, fsck_walk, &state );
+	for ( int t = 0; t < threads; t++ )
+		pthread_join( workers[t], NULL );
+
+	//Cross-check every block against the free map, one range of allocation groups per worker
+	fsck_range *ranges = malloc( sizeof(fsck_range)*threads );
+	for ( int t = 0; t < threads; t++ ) {
+		ranges[t].state = &state;
+		ranges[t].first_group = GROUPS * t / threads;
+		ranges[t].last_group = GROUPS * (t+1) / threads;
+		pthread_create( &workers[t], NULL, fsck_check_groups, &ranges[t] );
+	}
+	for ( int t = 0; t < threads; t++ )
+		pthread_join( workers[t], NULL );
+
+	for ( int i = 0; i < BLOCKS; i++ ) {
+		if ( state.status[i] == FSCK_LEAK )
+			fprintf(output, "fsck: block %d [%s] is allocated but unreachable (leak)\n", i, state.descriptor->name[i]);
+		else if ( state.status[i] == FSCK_DOUBLE )
+			fprintf(output, "fsck: block %d [%s] is claimed %d times (double allocation)\n", i, state.descriptor->name[i], state.claims[i]);
+		else if ( state.status[i] == FSCK_UNMARKED )
+			fprintf(output, "fsck: block %d [%s] is in use but marked free\n", i, state.descriptor->name[i]);
+		else if ( state.status[i] == FSCK_REFERENCES )
+			fprintf(output, "fsck: block %d [%s] is used by %d files, but its reference count is %d\n", i, state.descriptor->name[i], state.claims[i], state.descriptor->references[i]);
+	}
+	for ( int t = 0; t < threads; t++ )
+		for ( int g = ranges[t].first_group; g < ranges[t].last_group; g++ )
+			if ( strcmp(ranges[t].report[g], "") != 0 )
+				fprintf(output, "%s", ranges[t].report[g]);
+
+	int free_blocks = 0;
+	for ( int i = 0; i < BLOCKS; i++ )
+		if ( state.descriptor->free[i] ) free_blocks++;
+	if ( free_blocks != state.descriptor->free_blocks ) {
+		fprintf(output, "fsck: descriptor says %d free blocks, free map has %d\n", state.descriptor->free_blocks, free_blocks);
+		state.problems++;
+	}
+
+	if ( repair && state.problems > 0 ) {
+		dir_type *folder = malloc ( BLOCK_SIZE );
+
+		//Fix the subitem types, then drop dangling subitems from the back so earlier indexes stay valid
+		for ( int d = 0; d < state.mistyped_count; d++ ) {
+			memcpy( folder, disk + state.mistyped[2*d]*BLOCK_SIZE, BLOCK_SIZE );
+			folder->subitem_type[state.mistyped[2*d+1]] = !folder->subitem_type[state.mistyped[2*d+1]];
+			write_blocks( state.mistyped[2*d], folder, 1 );
+		}
+		for ( int d = state.dangling_count - 1; d >= 0; d-- ) {
+			memcpy( folder, disk + state.dangling[2*d]*BLOCK_SIZE, BLOCK_SIZE );
+			for ( int k = state.dangling[2*d+1]; k < folder->subitem_count - 1; k++ ) {
+				strcpy( folder->subitem[k], folder->subitem[k+1] );
+				folder->subitem_type[k] = folder->subitem_type[k+1];
+			}
+			folder->subitem_count--;
+			write_blocks( state.dangling[2*d], folder, 1 );
+		}
+
+		//Free leaked blocks, mark referenced ones as used and rebuild the group summaries from the free map
+		for ( int i = 0; i < BLOCKS; i++ ) {
+			if ( state.status[i] == FSCK_LEAK ) {
+				state.descriptor->free[i] = true;
+				state.descriptor->directory[i] = false;
+				state.descriptor->owner[i] = -1;
+				state.descriptor->references[i] = 0;
+				if ( open_files.references[i] > 0 )
+					open_files_move(i, -1);
+				dedup_forget(i);
+				cache_forget(i);
+				name_index_remove(i);
+				strcpy( state.descriptor->name[i], "" );
+			}
+			else if ( state.status[i] == FSCK_UNMARKED )
+				state.descriptor->free[i] = false;
+			else if ( state.status[i] == FSCK_REFERENCES )
+				state.descriptor->references[i] = state.claims[i];
+		}
+		for ( int g = 0; g < GROUPS; g++ ) {
+			state.descriptor->group_free[g] = 0;
+			state.descriptor->group_directories[g] = 0;
+		}
+		state.descriptor->free_blocks = 0;
+		for ( int i = 0; i < BLOCKS; i++ ) {
+			if ( state.descriptor->free[i] ) state.descriptor->free_blocks++;
+			if ( state.descriptor->free[i] ) state.descriptor->group_free[i / BLOCKS_PER_GROUP]++;
+			if ( state.descriptor->directory[i] ) state.descriptor->group_directories[i / BLOCKS_PER_GROUP]++;
+		}
+		//The directories fixed above have new checksums since the copy was taken
+		memcpy( state.descriptor->checksum, ((descriptor_block *)disk)->checksum, sizeof(state.descriptor->checksum) );
+		write_blocks( 0, state.descriptor, DESCRIPTOR_BLOCKS );
+		free(folder);
+	}
+
+	fprintf(output, "fsck: %d blocks, %d directories, %d files checked with %d threads: %d problems found%s\n",
+		BLOCKS, state.directory_count, state.file_count, threads, state.problems,
+		repair && state.problems > 0 ? " (double allocations are left alone)" : "");
+
+	pthread_mutex_destroy( &state.lock );
+	pthread_cond_destroy( &state.wake );
+	free(ranges);
+	free(state.mistyped);
+	free(state.dangling);
+	free(state.queue);
+	free(state.status);
+	free(state.claims);
+	free(state.files);
+	free(state.directories);
+	free(state.descriptor);
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+// Report free and used space; the descriptor keeps the count, so no block is scanned unless removed entries
+// are still waiting for the reclaim task. Pending blocks are those that become free once it is done.
+int do_df(char *name, char *size)
+{
+	(void)*name;
+	(void)*size;
+	if ( disk_allocated == false ) {
+		fprintf(output, "Error: Disk not allocated\n");
+		return 0;
+	}
+
+	descriptor_block *descriptor = (descriptor_block *)disk;
+
+	int used = BLOCKS - descriptor->free_blocks;
+	fprintf(output, "%10s %10s %10s %10s %5s %12s\n", "Blocks", "Used", "Pending", "Free", "Use%", "Available");
+	fprintf(output, "%10d %10d %10d %10d %4d%% %12ld\n", BLOCKS, used, reclaim.pending > 0 ? reclaim_freeable() : 0, descriptor->free_blocks,
+		100*used/BLOCKS, (long)descriptor->free_blocks*BLOCK_SIZE);
+	char *backing[] = { "base pages", "transparent huge pages (advised)", "huge pages" };
+	if ( volume.count > 0 )
+		fprintf(output, "%d bytes in blocks of %d, striped over %d members\n", DISK_PARTITION, BLOCK_SIZE, volume.count);
+	else
+		fprintf(output, "%d bytes in blocks of %d, on %s\n", DISK_PARTITION, BLOCK_SIZE, backing[pages.mode]);
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+// Report the totals of a directory (the current one by default), kept up to date by every change below it
+int do_du(char *name, char *size)
+{
+	(void)*size;
+	if ( disk_allocated == false ) {
+		fprintf(output, "Error: Disk not allocated\n");
+		return 0;
+	}
+
+	if ( strcmp(name, "") == 0 || strcmp(name, ".") == 0 )
+		name = current.directory;
+	int block_index = find_block(name, true);
+	if ( block_index == -1 ) {
+		TRACE("\t[%s] Directory [%s] does not exist\n", __func__, name);
+		fprintf( output, "%s: %s: No such file or directory\n", "du", name );
+		return 0;
+	}
+
+	dir_type *folder = malloc ( BLOCK_SIZE );
+	memcpy( folder, disk + block_index*BLOCK_SIZE, BLOCK_SIZE );
+	fprintf(output, "%ld bytes, %d files, %d blocks\t%s\n", folder->total_bytes, folder->total_files, folder->total_blocks, folder->name);
+
+	free(folder);
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+// List every file and directory whose name matches a glob pattern ("*", "?" and "[...]")
+int do_find(char *name, char *size)
+{
+	(void)*size;
+	if ( disk_allocated == false ) {
+		fprintf(output, "Error: Disk not allocated\n");
+		return 0;
+	}
+	if ( strcmp(name, "") == 0 ) {
+		fprintf(output, "%s: missing operand\n", "find");
+		return 0;
+	}
+
+	descriptor_block *descriptor = (descriptor_block *)disk;
+	int *matches = malloc( sizeof(int)*BLOCKS );
+	int count = 0;
+
+	//The literal prefix of the pattern, up to the first wildcard
+	char prefix[MAX_STRING_LENGTH];
+	int prefix_length = strcspn( name, "*?[\\" );
+	if ( prefix_length >= MAX_STRING_LENGTH ) prefix_length = MAX_STRING_LENGTH - 1;
+	strncpy( prefix, name, prefix_length );
+	prefix[prefix_length] = '\0';
+
+	if ( prefix_length > 0 ) {
+		//Only the range of the index that starts with the prefix can match
+		TRACE("\t[%s] Searching Names Starting With [%s]\n", __func__, prefix );
+		for ( int j = name_index_lower_bound(prefix, -1); j < sorted_names.count; j++ ) {
+			int i = sorted_names.block[j];
+			if ( !name_has_prefix(descriptor->name[i], prefix, prefix_length) )
+				break;
+			if ( fnmatch(name, descriptor->name[i], 0) == 0 )
+				matches[count++] = i;
+		}
+	}
+	else {
+		//Leading wildcard: scan the fixed-width name records, using the longest literal of the pattern as a filter
+		char literal[MAX_STRING_LENGTH] = "";
+		for ( char *p = name; *p != '\0'; ) {
+			int length = strcspn( p, "*?[\\" );
+			if ( length > (int)strlen(literal) && length < MAX_STRING_LENGTH ) {
+				strncpy( literal, p, length );
+				literal[length] = '\0';
+			}
+			p += length;
+			if ( *p == '[' && strchr(p, ']') != NULL )
+				p = strchr(p, ']') + 1;		//a bracket expression is not a literal
+			else if ( *p == '\\' && p[1] != '\0' )
+				p += 2;
+			else if ( *p != '\0' )
+				p++;
+		}
+		TRACE("\t[%s] Scanning All Names for [%s]\n", __func__, literal );
+		int literal_length = strlen(literal);
+		for ( int i = 0; i < BLOCKS; i++ ) {
+			if ( !name_may_contain(descriptor->name[i], literal, literal_length) )
+				continue;
+			if ( fnmatch(name, descriptor->name[i], 0) == 0 )
+				matches[count++] = i;
+		}
+		qsort( matches, count, sizeof(int), compare_block_names );
+	}
+
+	//Data blocks, the descriptor and removed entries carry names too, but only files and directories are listed
+	char path[LINESIZE];
+	for ( int j = 0; j < count; j++ ) {
+		int i = matches[j];
+		if ( (!descriptor->directory[i] && !is_file_block(descriptor, i)) || strcmp(descriptor->name[i], REMOVED_NAME) == 0 )
+			continue;
+		build_path( i, path );
+		fprintf(output, "%s%s\n", path, descriptor->directory[i] ? "/" : "");
+	}
+
+	free(matches);
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+// Print the trace points of every thread in the order they were hit ("trace" or "trace dump"),
+// or drop them ("trace clear")
+int do_trace(char *name, char *size)
+{
+	(void)*size;
+	if ( strcmp(name, "clear") == 0 ) {
+		for ( trace_ring *ring = __atomic_load_n(&trace_rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->link )
+			__atomic_store_n( &ring->next, 0, __ATOMIC_RELEASE );
+		return 0;
+	}
+	if ( strcmp(name, "") != 0 && strcmp(name, "dump") != 0 ) {
+		fprintf(output, "%s: unknown operand '%s' (dump, clear)\n", "trace", name);
+		return 0;
+	}
+
+	//Copy what the rings hold, so their threads can go on while the records are sorted and formatted
+	int rings = __atomic_load_n( &trace_ring_count, __ATOMIC_ACQUIRE );
+	trace_record *records = malloc( sizeof(trace_record) * TRACE_RECORDS * (rings + 1) );
+	int count = 0;
+	for ( trace_ring *ring = __atomic_load_n(&trace_rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->link ) {
+		unsigned long next = __atomic_load_n( &ring->next, __ATOMIC_ACQUIRE );
+		unsigned long first = next > TRACE_RECORDS ? next - TRACE_RECORDS : 0;
+		for ( unsigned long i = first; i < next && count < TRACE_RECORDS * rings; i++ )
+			records[count++] = ring->record[i % TRACE_RECORDS];
+	}
+	qsort( records, count, sizeof(trace_record), compare_trace_records );
+
+	char text[2*LINESIZE];
+	for ( int i = 0; i < count; i++ ) {
+		trace_format( &records[i], text, sizeof(text) );
+		fprintf(output, "%12.6f %2d %s", (records[i].time - records[0].time) / 1e9, records[i].thread, text);
+	}
+	fprintf(output, "%d trace records from %d threads\n", count, rings);
+
+	free(records);
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+// Copy-on-write snapshots of the disk: "snapshot create|delete|rollback <name>", "snapshot" or "snapshot list"
+int do_snapshot(char *name, char *size)
+{
+	int error = FS_OK;
+
+	if ( disk_allocated == false ) {
+		fprintf(output, "Error: Disk not allocated\n");
+		return 0;
+	}
+
+	if ( strcmp(name, "") == 0 || strcmp(name, "list") == 0 ) {
+		int count = fs_snapshot_list( NULL, 0 );
+		fs_snapshot_type *list = malloc( sizeof(fs_snapshot_type)*(count + 1) );
+		char created[LINESIZE];
+
+		fs_snapshot_list( list, count );
+		fprintf(output, "%-20s %20s %8s\n", "Name", "Created", "Saved");
+		for ( int i = 0; i < count; i++ ) {
+			time_t when = list[i].created;
+			strftime( created, sizeof(created), "%Y-%m-%d %H:%M:%S", localtime(&when) );
+			fprintf(output, "%-20s %20s %8d\n", list[i].name, created, list[i].blocks);
+		}
+		fprintf(output, "%d snapshots, %d saved blocks (%ld bytes)\n", count, snapshots.copies, (long)snapshots.copies*BLOCK_SIZE);
+		free(list);
+		return 0;
+	}
+
+	if ( strcmp(name, "create") == 0 )
+		error = fs_snapshot_create( size );
+	else if ( strcmp(name, "delete") == 0 )
+		error = fs_snapshot_delete( size );
+	else if ( strcmp(name, "rollback") == 0 )
+		error = fs_snapshot_rollback( active, size );
+	else {
+		fprintf(output, "%s: unknown operand '%s' (create, list, delete, rollback)\n", "snapshot", name);
+		return 0;
+	}
+
+	if ( error == FS_ERR_INVALID && strcmp(size, "") == 0 )
+		fprintf(output, "%s: missing operand\n", "snapshot");
+	else if ( error != FS_OK )
+		fprintf( output, "%s %s: %s: %s\n", "snapshot", name, size, fs_strerror(error) );
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+// Share identical data blocks: "dedup" runs a pass over the whole disk now, "dedup bg" runs it in the background,
+// "dedup stop" cancels a background pass, "dedup on|off" switches inline deduplication of written blocks
+// and "dedup status" reports the space saved
+int do_dedup(char *name, char *size)
+{
+	(void)*size;
+	if ( disk_allocated == false ) {
+		fprintf(output, "Error: Disk not allocated\n");
+		return 0;
+	}
+
+	struct task *task = &tasks[1];
+
+	if ( strcmp(name, "status") == 0 ) {
+		int saved = shared_blocks_saved();
+		fprintf(output, "inline dedup: %s, %d blocks saved by sharing (%ld bytes)%s\n", dedup.on ? "on" : "off",
+			saved, (long)saved*BLOCK_SIZE, task->active ? " (deduplicating)" : "");
+		return 0;
+	}
+	if ( strcmp(name, "on") == 0 || strcmp(name, "off") == 0 ) {
+		fs_dedup( strcmp(name, "on") == 0 );
+		return 0;
+	}
+	if ( strcmp(name, "stop") == 0 ) {
+		if ( task->active ) fprintf(output, "dedup: stopped after merging %d blocks\n", dedup.merged);
+		task->active = false;
+		return 0;
+	}
+	if ( strcmp(name, "") != 0 && strcmp(name, "bg") != 0 ) {
+		fprintf(output, "%s: unknown option '%s'\n", "dedup", name);
+		return -1;
+	}
+
+	//Start a new pass unless one is already running in the background
+	if ( !task->active ) {
+		dedup.cursor = 0;
+		dedup.merged = 0;
+		task->active = true;
+	}
+
+	if ( strcmp(name, "bg") == 0 ) {
+		TRACE("\t[%s] Deduplicating in the Background\n", __func__);
+		return 0;
+	}
+
+	//Foreground: keep running slices until the pass is done
+	while ( !dedup_step(SLICE_MICROSECONDS) )
+		;
+	task->active = false;
+	dedup_finish();
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+// Compressed data blocks: "compress <name> on|off" switches a file, or the files created from now on in a
+// directory; "compress" or "compress status" reports the compression ratio and what the codec cost
+int do_compress(char *name, char *size)
+{
+	if ( disk_allocated == false ) {
+		fprintf(output, "Error: Disk not allocated\n");
+		return 0;
+	}
+
+	if ( strcmp(name, "") == 0 || strcmp(name, "status") == 0 ) {
+		descriptor_block *descriptor = (descriptor_block *)disk;
+		long bytes = 0;
+		int files = 0, blocks = 0;
+
+		for ( int i = 0; i < BLOCKS; i++ ) {
+			file_type *file = (file_type *)(disk + i*BLOCK_SIZE);
+			if ( !is_file_block(descriptor, i) || !file->compressed )
+				continue;
+			files++;
+			bytes += file->size;
+			blocks += file->data_block_count;
+		}
+		fprintf(output, "%d compressed files: %ld bytes in %d data blocks (ratio %.2f)\n", files, bytes, blocks,
+			blocks > 0 ? (double)bytes / ((long)blocks*BLOCK_SIZE) : 0.0);
+		fprintf(output, "codec: %ld blocks compressed (ratio %.2f, %.1f us each), %ld decompressed (%.1f us each), %ld cache hits\n",
+			codec.packed, codec.packed_bytes > 0 ? (double)codec.raw_bytes / codec.packed_bytes : 0.0,
+			codec.packed > 0 ? codec.pack_time / 1000.0 / codec.packed : 0.0,
+			codec.unpacked, codec.unpacked > 0 ? codec.unpack_time / 1000.0 / codec.unpacked : 0.0, codec.cache_hits);
+		return 0;
+	}
+	if ( strcmp(size, "on") != 0 && strcmp(size, "off") != 0 ) {
+		fprintf(output, "%s: expected on or off after '%s'\n", "compress", name);
+		return 0;
+	}
+
+	TRACE("\t[%s] Switching Compression of [%s] %s\n", __func__, name, size );
+	int error = fs_compress( active, name, strcmp(size, "on") == 0 );
+	if ( error != FS_OK )
+		fprintf( output, "%s: cannot switch '%s' %s: %s\n", "compress", name, size, fs_strerror(error) );
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+// Verify block checksums: "scrub" checks every block in use now, "scrub bg [rate]" does so in the background
+// at "rate" blocks per second, "scrub stop" cancels a background pass and "scrub status" reports its progress
+int do_scrub(char *name, char *size)
+{
+	if ( disk_allocated == false ) {
+		fprintf(output, "Error: Disk not allocated\n");
+		return 0;
+	}
+
+	struct task *task = &tasks[2];
+
+	if ( strcmp(name, "status") == 0 ) {
+		fprintf(output, "scrub: %d blocks checked, %d checksum errors%s\n", scrub.checked, scrub.errors,
+			task->active ? " (scrubbing)" : "");
+		return 0;
+	}
+	if ( strcmp(name, "stop") == 0 ) {
+		if ( task->active ) fprintf(output, "scrub: stopped after checking %d blocks\n", scrub.checked);
+		task->active = false;
+		return 0;
+	}
+	if ( strcmp(name, "") != 0 && strcmp(name, "bg") != 0 ) {
+		fprintf(output, "%s: unknown option '%s'\n", "scrub", name);
+		return -1;
+	}
+
+	//Start a new pass unless one is already running in the background
+	if ( !task->active ) {
+		scrub.cursor = 0;
+		scrub.checked = 0;
+		scrub.errors = 0;
+		clock_gettime( CLOCK_MONOTONIC, &scrub.start );
+		task->active = true;
+	}
+
+	if ( strcmp(name, "bg") == 0 ) {
+		scrub.rate = strcmp(size, "") == 0 ? SCRUB_RATE : atol(size);
+		TRACE("\t[%s] Scrubbing in the Background at [%ld] Blocks per Second\n", __func__, scrub.rate);
+		return 0;
+	}
+
+	//Foreground: no rate limit, keep running slices until the pass is done
+	scrub.rate = 0;
+	while ( !scrub_step(SLICE_MICROSECONDS) )
+		;
+	task->active = false;
+	scrub_finish();
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+// Follow the changes in a directory: "watch add <dir>" watches the directory, "watch tree <dir>" it and every
+// directory below it, "watch read <watch>" prints the new events, "watch rm <watch>" ends the watch and
+// "watch" or "watch list" shows the watches
+int do_watch(char *name, char *size)
+{
+	char *types[] = { "", "create", "remove", "rename", "resize", "reset" };
+	fs_event events[16];
+	int error = FS_OK;
+
+	if ( disk_allocated == false ) {
+		fprintf(output, "Error: Disk not allocated\n");
+		return 0;
+	}
+
+	if ( strcmp(name, "") == 0 || strcmp(name, "list") == 0 ) {
+		fprintf(output, "%-6s %-20s %8s %10s\n", "Watch", "Directory", "Subtree", "Next");
+		for ( int w = 0; w < MAX_WATCHES; w++ )
+			if ( changes.used[w] )
+				fprintf(output, "%-6d %-20s %8s %10lu\n", w, changes.block[w] == -1 ? REMOVED_NAME : ((descriptor_block *)disk)->name[changes.block[w]],
+					changes.subtree[w] ? "yes" : "no", changes.next[w]);
+		fprintf(output, "%d watches, %lu events published\n", changes.count, changes.published);
+		return 0;
+	}
+
+	if ( strcmp(name, "add") == 0 || strcmp(name, "tree") == 0 ) {
+		if ( strcmp(size, "") == 0 ) {
+			fprintf(output, "%s: missing operand\n", "watch");
+			return -1;
+		}
+		int watch = fs_watch( active, size, strcmp(name, "tree") == 0 );
+		if ( watch < 0 ) {
+			fprintf( output, "%s %s: %s: %s\n", "watch", name, size, fs_strerror(watch) );
+			return -1;
+		}
+		fprintf(output, "watch %d on %s\n", watch, size);
+		return 0;
+	}
+
+	if ( strcmp(size, "") == 0 && (strcmp(name, "read") == 0 || strcmp(name, "rm") == 0) ) {
+		fprintf(output, "%s: missing operand\n", "watch");
+		return -1;
+	}
+	if ( strcmp(name, "rm") == 0 )
+		error = fs_unwatch( atoi(size) );
+	else if ( strcmp(name, "read") == 0 ) {
+		int count;
+		while ( (count = fs_watch_read(atoi(size), events, 16)) > 0 )
+			for ( int i = 0; i < count; i++ ) {
+				fs_event *event = &events[i];
+				fprintf(output, "%lu %s %s %s", event->sequence, types[event->type], event->directory ? "dir" : "file", event->name);
+				if ( event->type == FS_EVENT_RENAME )
+					fprintf(output, " -> %s", event->new_name);
+				else if ( event->type == FS_EVENT_RESIZE || (event->type == FS_EVENT_CREATE && !event->directory) )
+					fprintf(output, " %ld", event->size);
+				fprintf(output, "\n");
+			}
+		if ( count < 0 && count != FS_ERR_NOT_FOUND )
+			error = count;
+	}
+	else {
+		fprintf(output, "%s: unknown operand '%s' (add, tree, read, rm, list)\n", "watch", name);
+		return -1;
+	}
+
+	if ( error != FS_OK ) {
+		fprintf( output, "%s %s: %s: %s\n", "watch", name, size, fs_strerror(error) );
+		return -1;
+	}
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+// Quotas: "quota <dir> <blocks>[,<entries>]" sets the limits of a directory and everything below it (0 for
+// none), "quota <dir>" shows them with what is in use and "quota" lists every directory that has one
+int do_quota(char *name, char *size)
+{
+	descriptor_block *descriptor = (descriptor_block *)disk;
+	fs_quota_type quota;
+	int error;
+
+	if ( disk_allocated == false ) {
+		fprintf(output, "Error: Disk not allocated\n");
+		return 0;
+	}
+
+	if ( strcmp(name, "") == 0 ) {
+		fprintf(output, "%-20s %14s %14s\n", "Directory", "Blocks", "Entries");
+		for ( int i = 0; i < BLOCKS; i++ ) {
+			if ( descriptor->free[i] || !descriptor->directory[i] || strcmp(descriptor->name[i], REMOVED_NAME) == 0 )
+				continue;
+			dir_type *folder = (dir_type *)(disk + i*BLOCK_SIZE);
+			if ( folder->quota_blocks > 0 || folder->quota_entries > 0 )
+				fprintf(output, "%-20s %6d/%-7d %6d/%-7d\n", folder->name, folder->total_blocks, folder->quota_blocks,
+					folder->total_entries, folder->quota_entries);
+		}
+		fprintf(output, "%d directories with a quota\n", quota_directories);
+		return 0;
+	}
+
+	if ( strcmp(size, "") != 0 ) {
+		int blocks = 0, entries = 0;
+		if ( sscanf(size, "%d,%d", &blocks, &entries) < 1 ) {
+			fprintf(output, "%s: invalid limits '%s' (<blocks>[,<entries>])\n", "quota", size);
+			return -1;
+		}
+		error = fs_quota_set( active, name, blocks, entries );
+	}
+	else if ( (error = fs_quota_get(active, name, &quota)) == FS_OK )
+		fprintf(output, "%s: %d of %d blocks, %d of %d entries (0: no limit)\n", name, quota.used_blocks, quota.blocks,
+			quota.used_entries, quota.entries);
+
+	if ( error != FS_OK ) {
+		fprintf( output, "%s: %s: %s\n", "quota", name, fs_strerror(error) );
+		return -1;
+	}
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+// Batches: after "batch begin" the mkdir and mkfil commands of this session are queued instead of run, into the
+// directory of the last "batch in <dir>" (the working directory until then), which may be one the batch makes;
+// "batch commit" runs them as one, all or none, "batch abort" drops them and "batch status" counts them
+int do_batch(char *name, char *size)
+{
+	if ( disk_allocated == false ) {
+		fprintf(output, "Error: Disk not allocated\n");
+		return 0;
+	}
+
+	if ( strcmp(name, "") == 0 || strcmp(name, "status") == 0 ) {
+		if ( batch.open )
+			fprintf(output, "batch: %d operations queued%s%s\n", batch.count, strcmp(batch.parent, "") == 0 ? "" : " in ", batch.parent);
+		else
+			fprintf(output, "batch: none open\n");
+		return 0;
+	}
+	if ( strcmp(name, "begin") == 0 ) {
+		if ( batch.open ) {
+			fprintf(output, "%s: %d operations are queued already\n", "batch", batch.count);
+			return -1;
+		}
+		batch.open = true;
+		batch.owner = active;
+		batch.count = 0;
+		strcpy( batch.parent, "" );
+		return 0;
+	}
+	if ( !batch.open || batch.owner != active ) {
+		fprintf(output, "%s %s: no batch open, see 'batch begin'\n", "batch", name);
+		return -1;
+	}
+
+	if ( strcmp(name, "in") == 0 ) {
+		if ( strcmp(size, "") == 0 || strlen(size) >= MAX_STRING_LENGTH ) {
+			fprintf(output, "%s: missing operand\n", "batch in");
+			return -1;
+		}
+		strcpy( batch.parent, strcmp(size, ".") == 0 ? "" : size );
+		return 0;
+	}
+	if ( strcmp(name, "abort") == 0 ) {
+		batch.open = false;
+		fprintf(output, "batch: %d operations dropped\n", batch.count);
+		return 0;
+	}
+	if ( strcmp(name, "commit") != 0 ) {
+		fprintf(output, "%s: unknown operand '%s' (begin, in, commit, abort, status)\n", "batch", name);
+		return -1;
+	}
+
+	//The names only stay put once nothing more is queued
+	int failed;
+	for ( int i = 0; i < batch.count; i++ ) {
+		batch.ops[i].parent = batch.names[i][0];
+		batch.ops[i].name = batch.names[i][1];
+	}
+	batch.open = false;
+	int error = fs_batch( active, batch.ops, batch.count, &failed );
+	if ( error != FS_OK && failed >= 0 )
+		fprintf( output, "%s: %s '%s': %s; nothing was created\n", "batch", batch.ops[failed].type == FS_BATCH_MKDIR ? "mkdir" : "mkfil",
+			batch.ops[failed].name, fs_strerror(error) );
+	else if ( error != FS_OK )
+		fprintf( output, "%s: %s; nothing was created\n", "batch", fs_strerror(error) );
+	else
+		fprintf(output, "batch: %d entries created\n", batch.count);
+	return error == FS_OK ? 0 : -1;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+// Exports: "export <file>" writes the working directory and everything below it into an image that
+// fs_image_open maps, "export <file> <dir>" the directory dir
+int do_export(char *name, char *size)
+{
+	fs_stat_type stat;
+
+	if ( disk_allocated == false ) {
+		fprintf(output, "Error: Disk not allocated\n");
+		return 0;
+	}
+	if ( strcmp(name, "") == 0 ) {
+		fprintf(output, "%s: missing operand\n", "export");
+		return -1;
+	}
+
+	char *directory = strcmp(size, "") == 0 ? "." : size;
+	int error = fs_export( active, directory, name );
+	if ( error != FS_OK ) {
+		fprintf( output, "%s: cannot export '%s' to '%s': %s\n", "export", directory, name, fs_strerror(error) );
+		return -1;
+	}
+	fs_stat( active, directory, &stat );
+	fprintf(output, "export: %s, %d files and %ld bytes, written to %s\n", stat.name, stat.files, stat.size, name);
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+int do_sync(char *name, char *size)
+{
+	(void)*name;
+	(void)*size;
+	if ( disk_allocated == false ) {
+		fprintf(output, "Error: Disk not allocated\n");
+		return 0;
+	}
+
+	int error = fs_sync();
+	if ( error != FS_OK ) {
+		fprintf( output, "%s: %s\n", "sync", fs_strerror(error) );
+		return -1;
+	}
+	if ( volume.count == 0 )
+		fprintf(output, "sync: the disk is in memory, nothing to write\n");
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+int do_exit(char *name, char *size)
+{
+	(void)*name;
+	(void)*size;
+	TRACE("\t[%s] Exiting\n", __func__);
+	fs_sync();
+	exit(0);
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+
+/******************************* Helper Functions Start *****************************/
 
 //Prints the information of directories and files starting at the root
 void printing(char *name) {
@@ -570,528 +2852,3982 @@ void printing(char *name) {
 	dir_type *folder = malloc (BLOCK_SIZE);
 	int block_index = find_block(name, true);
 
-	memcpy( folder, disk + block_index*BLOCK_SIZE, BLOCK_SIZE);
-		
-	printf("%s:\n", folder->name);
-	for( int i = 0; i < folder->subitem_count; i++ ) {
-		 printf("\t%s\n", folder->subitem[i]);
+	memcpy( folder, disk + block_index*BLOCK_SIZE, BLOCK_SIZE);
+		
+	fprintf(output, "%s:\n", folder->name);
+	for( int i = 0; i < folder->subitem_count; i++ ) {
+		 fprintf(output, "\t%s\n", folder->subitem[i]);
+	}
+
+	//Go through again if there is a subdirectory
+	for( int i = 0; i < folder->subitem_count; i++ ) {
+		if( folder->subitem_type[i] == true ) {
+			//Recursively call the function! can be improved further ;)
+			printing(folder->subitem[i]);
+		}
+	}
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Displays the content of the descriptor block and free block table.
+void print_descriptor ( ) {
+	descriptor_block *descriptor = (descriptor_block *)disk;
+
+	fprintf(output, "Disk Descriptor Free Table:\n");
+	
+	for ( int i = 0; i < BLOCKS ; i++ ) {
+		fprintf(output, "\tIndex %d : %d\n", i, descriptor->free[i]);
+	}
+
+	fprintf(output, "Allocation Groups:\n");
+	for ( int g = 0; g < GROUPS; g++ ) {
+		fprintf(output, "\tGroup %d : %d free, %d directories\n", g, descriptor->group_free[g], descriptor->group_directories[g]);
+	}
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//finds a free block on the disk, as close to "goal" as possible; the free block index is returned
+//The goal's allocation group is searched first (from the goal onwards, then from the start of the group),
+//after that the following groups are tried in order, so that related blocks stay together.
+int allocate_block ( char *name, bool directory, int goal, int owner ) { 
+
+	descriptor_block *descriptor = (descriptor_block *)disk;
+	
+	if ( goal < 0 || goal >= BLOCKS )
+		goal = 0;
+	int goal_group = goal / BLOCKS_PER_GROUP;
+
+	//Goes through every group, starting at the goal's group, until a free block is found	
+	TRACE("\t\t\t[%s] Finding Free Memory Block in the Descriptor near Block [%d] (Group [%d])\n", __func__, goal, goal_group );
+	for ( int g = 0; g < GROUPS; g++ ) {
+		int group = (goal_group + g) % GROUPS;
+		int first = group * BLOCKS_PER_GROUP;
+
+		//Skip full groups without touching their free map
+		if ( descriptor->group_free[group] == 0 )
+			continue;
+
+		int start = ( group == goal_group ) ? goal : first;
+		for ( int j = 0; j < BLOCKS_PER_GROUP; j++ ) {
+			int i = first + (start - first + j) % BLOCKS_PER_GROUP;
+			if ( descriptor->free[i] ) {
+				//Once free block is found, update descriptor information
+				descriptor_changing(i);
+				descriptor->free[i] = false;
+				descriptor->directory[i] = directory;
+				strcpy(descriptor->name[i], name);
+				name_index_insert(i);
+				descriptor->owner[i] = owner;
+				descriptor->references[i] = owner >= 0 ? 1 : 0;
+				descriptor->group_free[group]--;
+				descriptor->free_blocks--;
+				if ( directory )
+					descriptor->group_directories[group]++;
+				TRACE("\t\t\t[%s] Allocated [%s] at Memory Block [%d] (Group [%d])\n", __func__, name, i, group );
+
+				return i; 
+			}
+		}
+	}
+	TRACE("\t\t\t[%s] No Free Space Found: Returning -1\n", __func__);
+	return -1;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//updates the descriptor block on disk to reflect that the block is no longer in use. 
+void unallocate_block ( int offset ) { 
+	descriptor_block *descriptor = (descriptor_block *)disk;
+	
+	//TODO: check if the block holds a file, and then unallocate all its sub-block
+	TRACE("\t\t\t[%s] Unallocating Memory Block [%d]\n", __func__, offset );
+	descriptor_changing(offset);
+	if ( !descriptor->free[offset] ) {
+		descriptor->group_free[offset / BLOCKS_PER_GROUP]++;
+		descriptor->free_blocks++;
+		if ( descriptor->directory[offset] )
+			descriptor->group_directories[offset / BLOCKS_PER_GROUP]--;
+	}
+	descriptor->free[offset] = true;
+	descriptor->directory[offset] = false;
+	descriptor->owner[offset] = -1;
+	descriptor->references[offset] = 0;
+	if ( open_files.references[offset] > 0 )
+		open_files_move(offset, -1);
+	dedup_forget(offset);
+	cache_forget(offset);
+	name_index_remove(offset);
+	strcpy( descriptor->name[offset], "" );
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Picks the allocation group for a new directory; the first block of that group is returned as allocation goal.
+//Directories are spread out: among the groups with at least the average number of free blocks,
+//the one holding the fewest directories wins. Files then follow their parent into that group.
+int find_directory_group ( ) {
+	descriptor_block *descriptor = (descriptor_block *)disk;
+
+	int total_free = 0;
+	for ( int g = 0; g < GROUPS; g++ )
+		total_free += descriptor->group_free[g];
+	int average_free = total_free / GROUPS;
+
+	int best = -1;
+	for ( int g = 0; g < GROUPS; g++ ) {
+		if ( descriptor->group_free[g] == 0 || descriptor->group_free[g] < average_free )
+			continue;
+		if ( best == -1 || descriptor->group_directories[g] < descriptor->group_directories[best] )
+			best = g;
+	}
+
+	//Every group is below average (or full); fall back to the emptiest one
+	if ( best == -1 ) {
+		best = 0;
+		for ( int g = 1; g < GROUPS; g++ )
+			if ( descriptor->group_free[g] > descriptor->group_free[best] )
+				best = g;
+	}
+	TRACE("\t\t\t[%s] Placing New Directory in Group [%d] ([%d] Free Blocks, [%d] Directories)\n", __func__, best, descriptor->group_free[best], descriptor->group_directories[best] );
+
+	return best * BLOCKS_PER_GROUP;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Moves the contents of block "from" to the free block "to" and fixes every reference to it.
+//Directories and files are looked up by name, so only data blocks have to be patched in their file.
+int move_block ( int from, int to ) {
+	descriptor_block *descriptor = (descriptor_block *)disk;
+
+	if ( descriptor->free[from] || !descriptor->free[to] ) {
+		TRACE("\t\t\t[%s] Cannot Move Memory Block [%d] to [%d]\n", __func__, from, to );
+		return -1;
+	}
+
+	//Hand the descriptor entry over to the new block
+	descriptor_changing(from);
+	descriptor_changing(to);
+	descriptor->free[to] = false;
+	descriptor->directory[to] = descriptor->directory[from];
+	descriptor->owner[to] = descriptor->owner[from];
+	descriptor->references[to] = descriptor->references[from];
+	name_index_remove(from);
+	strcpy( descriptor->name[to], descriptor->name[from] );
+	name_index_insert(to);
+	descriptor->group_free[to / BLOCKS_PER_GROUP]--;
+	descriptor->group_free[from / BLOCKS_PER_GROUP]++;
+	if ( descriptor->directory[from] ) {
+		descriptor->group_directories[to / BLOCKS_PER_GROUP]++;
+		descriptor->group_directories[from / BLOCKS_PER_GROUP]--;
+	}
+	descriptor->free[from] = true;
+	descriptor->directory[from] = false;
+	descriptor->owner[from] = -1;
+	descriptor->references[from] = 0;
+	strcpy( descriptor->name[from], "" );
+	if ( open_files.references[from] > 0 )
+		open_files_move(from, to);
+	if ( changes.count > 0 && descriptor->directory[to] )
+		watches_move(from, to);
+	dedup_forget(from);
+	cache_forget(from);
+
+	file_type *file = malloc ( BLOCK_SIZE );
+	int owner = descriptor->owner[to];
+	if ( is_file_block(descriptor, to) ) {
+		//File control block: its data blocks now belong to the new location
+		memcpy( file, disk + from*BLOCK_SIZE, BLOCK_SIZE );
+		for ( int i = 0; i < file->data_block_count; i++ )
+			if ( file->data_block_index[i] != HOLE )
+				descriptor->owner[file->data_block_index[i]] = to;
+	}
+
+	write_blocks( to, disk + from*BLOCK_SIZE, 1 );
+		TRACE("\t\t\t[%s] Moved [%s] from Memory Block [%d] to [%d]\n", __func__, descriptor->name[to], from, to );
+
+	//Data block: point the owning file at the new location, or every file if it is shared
+	for ( int user = owner; user >= 0; ) {
+		memcpy( file, disk + user*BLOCK_SIZE, BLOCK_SIZE );
+		for ( int i = 0; i < file->data_block_count; i++ )
+			if ( file->data_block_index[i] == from )
+				file->data_block_index[i] = to;
+		write_blocks( user, file, 1 );
+		user = descriptor->references[to] > 1 ? find_data_block_user(from, -1) : -1;
+	}
+
+	free(file);
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//True if the block holds a file control block (not free, not a directory, not a data block or the descriptor)
+bool is_file_block ( descriptor_block *descriptor, int index ) {
+	return !descriptor->free[index] && !descriptor->directory[index] && descriptor->owner[index] == -1
+		&& strcmp(descriptor->name[index], "descriptor") != 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Data blocks the file really takes; its holes take none
+int file_blocks ( file_type *file ) {
+	int blocks = 0;
+
+	for ( int k = 0; k < file->data_block_count; k++ )
+		if ( file->data_block_index[k] != HOLE )
+			blocks++;
+	return blocks;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Takes in a name, and searches the sorted name index to find the block that contains the item
+int find_block ( char *name, bool directory ) {
+
+	descriptor_block *descriptor = (descriptor_block *)disk;
+	
+	//Binary search for the first block with this name, then step over the ones of the other type and over
+	//data blocks, whose names can match a file's once they are cut short
+	TRACE("\t\t\t[%s] Searching Descriptor for [%s], which is a [%s]\n", __func__, name, directory == true ? "Folder": "File" );
+	for ( int j = name_index_lower_bound(name, -1); j < sorted_names.count; j++ ) {
+		int i = sorted_names.block[j];
+		if ( strcmp(descriptor->name[i], name) != 0 )
+			break;
+		//Make sure it is of the type that we are searching for
+		if ( descriptor->directory[i] == directory && descriptor->owner[i] == -1 ) {
+			TRACE("\t\t\t[%s] Found [%s] at Memory Block [%d]\n", __func__, name, i );
+			//Return the block index where the item resides in memory
+			return i;
+		}
+	}
+	
+	TRACE("\t\t\t[%s] Block Not Found: Returning -1\n", __func__);
+	return -1;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Looks "name" up among the subitems of the current directory; returns the block holding it
+//and sets "directory" to its type, or returns -1 if the current directory has no such entry
+int find_entry ( char *name, bool *directory ) {
+	int block_index = find_block(current.directory, true);
+	if ( block_index == -1 )
+		return -1;
+
+	dir_type *folder = (dir_type *)(disk + block_index*BLOCK_SIZE);
+	for ( int i = 0; i < folder->subitem_count; i++ ) {
+		if ( strcmp(folder->subitem[i], name) == 0 ) {
+			*directory = folder->subitem_type[i];
+			return find_block(name, *directory);
+		}
+	}
+	return -1;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Names have to fit the name fields, "." and ".." are taken by chdir and REMOVED_NAME by removed entries
+bool valid_name ( char *name ) {
+	return strcmp(name, "") != 0 && strlen(name) < MAX_STRING_LENGTH
+		&& strcmp(name, ".") != 0 && strcmp(name, "..") != 0 && strcmp(name, REMOVED_NAME) != 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+int add_descriptor ( char * name ) {
+	(void)*name;
+	//Allocate memory to a descriptor_block type so that we start assigning values to its members.
+	descriptor_block *descriptor = malloc( BLOCK_SIZE*DESCRIPTOR_BLOCKS );
+		TRACE("\t\t[%s] Allocating Space for Descriptor Block\n", __func__);
+	
+	//initialize each block ==> that it is free
+	TRACE("\t\t[%s] Initializing Descriptor to Have All of Memory Available\n", __func__);
+	for (int i = 0; i < BLOCKS; i++ ) {
+		descriptor->free[i] = true;
+		descriptor->directory[i] = false;
+		strcpy(descriptor->name[i], "");
+		descriptor->owner[i] = -1;
+		descriptor->references[i] = 0;
+	}
+	for (int g = 0; g < GROUPS; g++ ) {
+		descriptor->group_free[g] = BLOCKS_PER_GROUP;
+		descriptor->group_directories[g] = 0;
+	}
+	descriptor->free_blocks = BLOCKS;
+
+	//descriptor occupied space on the disk, the name table included
+	int limit = DESCRIPTOR_BLOCKS;
+	
+	TRACE("\t\t[%s] Updating Descriptor to Show that first [%d] Memory Blocks Are Taken\n", __func__, limit);
+	for ( int i = 0; i < limit; i ++ ) {
+		descriptor->free[i]= false; //marking space occupied by descriptor as used
+		descriptor->group_free[i / BLOCKS_PER_GROUP]--;
+		descriptor->free_blocks--;
+		strcpy(descriptor->name[i], "descriptor");
+	}
+
+	//Every block behind the descriptor starts out matching its checksum, whatever it holds
+	for ( int i = limit; i < BLOCKS; i++ )
+		descriptor->checksum[i] = block_checksum( disk + i*BLOCK_SIZE );
+	
+	//writing new updated descriptor to the beginning of the disk
+	memcpy ( disk, descriptor, BLOCK_SIZE*limit );
+	free(descriptor);
+
+	sorted_names.count = 0;
+	for ( int i = 0; i < limit; i ++ )
+		name_index_insert(i);
+
+	return 0;	
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Allows us to directly update values in the descriptor block. 
+int edit_descriptor ( int free_index, bool free, int name_index, char * name ) {
+
+	descriptor_block *descriptor = (descriptor_block *)disk;
+
+	//Each array in the descriptor block will be updated
+	if ( free_index > 0 ) {
+		descriptor_changing(free_index);
+		if ( descriptor->free[free_index] != free ) {
+			descriptor->group_free[free_index / BLOCKS_PER_GROUP] += free ? 1 : -1;
+			descriptor->free_blocks += free ? 1 : -1;
+		}
+		descriptor->free[free_index] = free;
+			TRACE("\t\t[%s] Descriptor Free Member now shows Memory Block [%d] is [%s]\n", __func__, free_index, free == true ? "Free": "Used");
+	}
+	if ( name_index > 0 ) {
+		descriptor_changing(name_index);
+		name_index_remove(name_index);
+		strcpy(descriptor->name[name_index], name );
+		name_index_insert(name_index);
+			TRACE("\t\t[%s] Descriptor Name Member now shows Memory Block [%d] has Name [%s]\n", __func__, name_index, name);	
+	}
+
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+// This changes the name of a file in the descriptor; used for moving files;
+int edit_descriptor_name (int index, char* new_name)
+{
+	descriptor_block *descriptor = (descriptor_block *)disk;
+
+	// Change the name of the file at index to the new_name
+	descriptor_changing(index);
+	name_index_remove(index);
+	strcpy(descriptor->name[index], new_name);
+	name_index_insert(index);
+
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Allows us to add a folder to the disk.
+int add_directory( char * name ) {
+	
+	if ( strcmp(name,"") == 0 ) {
+		TRACE("\t\t[%s] Invalid Command\n", __func__ );
+		return -1;
+	}
+	
+	place_directory( name );
+	update_directory_totals( current.directory, 0, 0, 1, 1 );
+	
+	TRACE("\t\t[%s] Folder [%s] Successfully Added\n", __func__, name);
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Writes the control block of a new, empty directory in the current directory and returns where it went;
+//the current directory itself is left to the caller
+int place_directory ( char *name ) {
+	//Allocating memory for new folder
+	dir_type *folder = malloc ( BLOCK_SIZE);
+		TRACE("\t\t[%s] Allocating Space for New Folder\n", __func__);
+	
+	//Initialize our new folder
+	strcpy(folder->name, name);					
+	strcpy(folder->top_level, current.directory);
+	folder->subitem_count = 0;					// Imp : Initialize subitem array to have 0 elements
+	folder->total_bytes = 0;
+	folder->total_files = 0;
+	folder->total_blocks = 1;					// the folder's own block
+	folder->total_entries = 1;
+	folder->quota_blocks = 0;
+	folder->quota_entries = 0;
+	folder->compress = false;
+	
+
+	//Find free block in disk to store our folder; true => mark the block as directory
+	//New directories are spread across the allocation groups
+	int index = allocate_block(name, true, find_directory_group(), -1);
+		TRACE("\t\t[%s] Assigning New Folder to Memory Block [%d]\n", __func__, index);
+		
+	//Copy our folder to the disk
+	write_blocks( index, folder, 1 );
+	free(folder);
+	return index;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Allows you to directly add items to a folders subitem array, or change the folder's name
+int edit_directory (char * name,  char*subitem_name, char *new_name, bool name_change, bool directory ) {
+	
+	if( strcmp(name,"") == 0 ) {
+		TRACE("\t\t[%s] Invalid Command\n", __func__ );
+		return -1;
+	}
+
+	dir_type *folder = malloc ( BLOCK_SIZE);
+	
+	//Find where the folder is on disk	
+	int block_index = find_block(name, true);
+	//If the directory is not found, should return
+	if( block_index == -1 ) {
+		TRACE("\t\t[%s] Directory [%s] does not exist\n", __func__, name);
+		return -1;
+	}
+		TRACE("\t\t[%s] Folder [%s] Found At Memory Block [%d]\n", __func__, name, block_index);
+	
+	memcpy( folder, disk + block_index*BLOCK_SIZE, BLOCK_SIZE);
+
+	if ( strcmp(subitem_name, "") != 0 ) {	//Case that we are adding subitem to the descriptor block
+		
+		if ( !name_change ) {     //Case adding subitem
+			TRACE("\t\t[%s] Added Subitem [%s] at Subitem index [%d] to directory [%s]\n", __func__, subitem_name, folder->subitem_count, folder->name );
+			strcpy (folder->subitem[folder->subitem_count], subitem_name );
+			folder->subitem_type[folder->subitem_count] = directory;
+			folder->subitem_count++;
+				TRACE("\t\t[%s] Folder [%s] Now Has [%d] Subitems\n", __func__, name, folder->subitem_count);
+
+			//update the disk too!	
+			write_blocks( block_index, folder, 1 );
+			
+			free(folder);
+			return 0;
+		}
+		else {				//Case editing a subitem's name
+			for ( int i =0; i < folder->subitem_count; i++ ) {
+				if ( strcmp(folder->subitem[i], subitem_name) == 0 ) {
+					strcpy( folder->subitem[i], new_name);
+						TRACE("\t\t[%s] Edited Subitem [%s] to [%s] at Subitem index [%d] for directory [%s]\n", __func__, subitem_name, new_name, i, folder->name );	
+
+					write_blocks( block_index, folder, 1 );
+					free(folder);
+					return 0;
+				}
+			}
+
+			TRACE("\t\t[%s] Subitem Does Not Exist in Directory [%s]\n", __func__, folder->name );
+			free(folder);
+			return -1;
+		}
+	}
+	else {						//Case we are changing the folders name
+		//if directory with given name already exists, don't allow
+		int block_index2 = find_block(new_name, true);
+
+		//If the directory for the new name already exists, should return -1
+		if( block_index2 != -1 ) {
+			TRACE("\t\t[%s] Directory [%s] already exists. Choose a different name\n", __func__, new_name);
+			return -1;
+		}
+	
+		strcpy(folder->name, new_name );
+			TRACE("\t\t[%s] Folder [%s] Now Has Name [%s]\n", __func__, name, folder->name);
+		
+		write_blocks( block_index, folder, 1 );
+		
+		//edit descriptors
+		edit_descriptor(-1, false, block_index, new_name );
+			TRACE("\t\t[%s] Updated Descriptor's Name Member\n", __func__);
+			print_directory(folder->name);
+		
+		//changing parents name
+		edit_directory(folder->top_level, name, new_name, true, true );
+			TRACE("\t\t[%s] Updated Parents Subitem Name\n", __func__);
+		
+		int child_index;
+
+		//Iterates through to change the subitems' top_level name
+		for ( int i = 0; i < folder->subitem_count; i++) {
+			file_type *child_file = malloc ( BLOCK_SIZE);
+			dir_type *child_folder = malloc ( BLOCK_SIZE);
+			
+			child_index = find_block ( folder->subitem[i], folder->subitem_type[i]);
+			if ( folder->subitem_type[i] ) {
+				//if type == folder
+				memcpy( child_folder, disk + child_index*BLOCK_SIZE, BLOCK_SIZE);
+				strcpy( child_folder->top_level, new_name );
+				
+				write_blocks( child_index, child_folder, 1 );
+				free ( child_folder );
+				free ( child_file );
+			}
+			else {
+				//if type == file
+				memcpy( child_file, disk + child_index*BLOCK_SIZE, BLOCK_SIZE);
+				strcpy( child_file->top_level, new_name );
+			
+				write_blocks( child_index, child_file, 1 );
+				free ( child_folder );
+				free ( child_file );
+			} 
+		}
+			
+		free(folder);
+		return 0;
+	}
+		
+	free ( folder );
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Allows us to add a file to our disk; This function will allocate this file descriptor block (holds file info).
+//The data blocks are holes until they are written, so a file of any size is created with one block.
+int add_file( char * name, int size ) {
+	
+	if ( size < 0 || strcmp(name,"") == 0 ) {
+		TRACE("\t\t[%s] Invalid command\n", __func__);
+		return 1;
+	}
+		
+	
+	//The file goes into its parent directory's allocation group
+	place_file( name, size, find_block(current.directory, true) );
+	update_directory_totals( current.directory, size, 1, 1, 1 );
+	
+	TRACE("\t\t[%s] File [%s] Successfully Added\n", __func__, name);
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Writes the control block of a new file in the current directory, near block "goal", and returns where it went;
+//the current directory itself is left to the caller
+int place_file ( char *name, int size, int goal ) {
+	//Allocate memory to a file_type
+	file_type *file = malloc ( BLOCK_SIZE );
+		TRACE("\t\t[%s] Allocating Space for New File\n", __func__);
+		
+	//Initialize all the members of our new file
+	strcpy( file->name, name);	
+	strcpy ( file->top_level, current.directory );
+	file->size = size;		
+	file->data_block_count = 0;
+	file->compressed = false;
+		TRACE("\t\t[%s] Initializing File Members\n", __func__);
+				
+	//Find free block to put this file descriptor block in memory, false ==> indicates a file
+	int index = allocate_block(name, false, goal, -1);
+	
+	//Blocks are only picked when data is first written to them (see fill_holes), so a write gets a contiguous run
+	TRACE("\t\t[%s] Leaving [%d] Data Blocks as Holes\n", __func__, size/BLOCK_SIZE + 1);
+	for ( int i = 0; i < size/BLOCK_SIZE + 1; i++ )
+		file->data_block_index[i] = HOLE;
+	file->data_block_count = size/BLOCK_SIZE + 1;
+	write_blocks( index, file, 1 );
+	free(file);
+	return index;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Takes the entry "name" at block "index" out of the current directory and leaves its blocks to the reclaim task
+void unlink_entry ( char *name, int block_index, bool directory ) {
+	//Remove the entry from the parent's subitems.
+	dir_type *top_folder = malloc ( BLOCK_SIZE );
+	int top_block_index = find_block(current.directory, true);
+	memcpy( top_folder, disk + top_block_index*BLOCK_SIZE, BLOCK_SIZE );
+
+	char subitem_name[MAX_STRING_LENGTH]; // holds the current subitem in the parent directory array
+	const int subcnt = top_folder->subitem_count; // no. of subitems
+	int j;
+	int k=0;
+
+	//iterate through the subitem count
+	for(j = 0; j<subcnt; j++) {
+		strcpy(subitem_name, top_folder->subitem[j]);
+		if (strcmp(subitem_name, name) != 0)
+		{
+			strcpy(top_folder->subitem[k],subitem_name);
+			top_folder->subitem_type[k] = top_folder->subitem_type[j];
+			k++;
+		}
+	}
+
+	//Remove the subitem from the parent
+	strcpy(top_folder->subitem[k], "");
+
+	top_folder->subitem_count--;
+	write_blocks( top_block_index, top_folder, 1 );
+	free(top_folder);
+
+	//The totals drop right away, the blocks only once they are reclaimed
+	if ( directory ) {
+		dir_type *folder = (dir_type *)(disk + block_index*BLOCK_SIZE);
+		update_directory_totals( current.directory, -folder->total_bytes, -folder->total_files, -folder->total_entries, -folder->total_blocks );
+	}
+	else {
+		file_type *file = (file_type *)(disk + block_index*BLOCK_SIZE);
+		update_directory_totals( current.directory, -(long)file->size, -1, -1, -(1 + file_blocks(file)) );
+	}
+	TRACE("\t\t[%s] Removing [%s] at Memory Block [%d]\n", __func__, name, block_index );
+	orphan_entry( block_index );
+}
+
+/*--------------------------------------------------------------------------------*/
+
+int remove_file (char* name)
+{
+	if (strcmp(name,"") == 0 ) {
+		TRACE("\t\t[%s] Invalid command\n", __func__);
+		return 1;
+	}
+
+	file_type *file = malloc ( BLOCK_SIZE);
+	dir_type *folder = malloc ( BLOCK_SIZE);
+	
+	int file_index = find_block(name, false);
+	
+	// If the file is not found, error, return -1
+	if ( file_index == -1 )  {
+		TRACE("\t\t\t[%s] File [%s] not found\n", __func__, name);
+		return -1;
+	}
+	
+	TRACE("\t\t[%s] File [%s] Found At Memory Block [%d]\n", __func__, name, file_index);
+	
+	memcpy( file, disk + file_index*BLOCK_SIZE, BLOCK_SIZE);
+	
+	//Find the top_level folder on disk
+	int folder_index = find_block(file->top_level, true);
+	
+	TRACE("\t\t[%s] Folder [%s] Found At Memory Block [%d]\n", __func__, name, folder_index);
+	memcpy( folder, disk + folder_index*BLOCK_SIZE, BLOCK_SIZE);
+	
+	
+	// Go through the parent directory's subitem array and remove our file
+	char subitem_name[MAX_STRING_LENGTH]; 
+	const int subcnt = folder->subitem_count; // no of subitems
+	int j;
+	int k=0;
+	for(j = 0; j<subcnt; j++)
+		{
+			strcpy(subitem_name, folder->subitem[j]);
+			if (strcmp(subitem_name, name) != 0) 
+			// if this element is not the one we are removing, copy back
+			{
+				strcpy(folder->subitem[k],subitem_name);
+				folder->subitem_type[k] = folder->subitem_type[j];
+				k++;
+			}
+		}
+	strcpy(folder->subitem[k], "");
+	folder->subitem_count--;
+
+	write_blocks( folder_index, folder, 1 ); // Update the folder in memory
+
+
+	//Imp :  Unallocate all of the data blocks from the file that we are deleting, unless other copies still use them
+	int i = 0;
+	int released = 0;
+	while(file->data_block_count != 0)
+	{
+		if ( file->data_block_index[i] != HOLE ) {
+			release_data_block(file->data_block_index[i], file_index);
+			released++;
+		}
+		file->data_block_count--;
+		i++;
+	}
+	
+	unallocate_block(file_index); // Deallocate the file control block
+	update_directory_totals( file->top_level, -(long)file->size, -1, -1, -(1 + released) );
+	
+	free(folder);
+	free(file);
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Allows you to directly edit a file and change its size or its name
+int edit_file ( char * name, int size, char *new_name ) {
+	file_type *file = malloc ( BLOCK_SIZE);
+	
+	//Find the block in memory where this file is written	
+	int block_index = find_block(name, false);
+	if ( block_index == -1 )  {
+		TRACE("\t\t\t[%s] File [%s] not found\n", __func__, name);
+		return -1;
+	}
+	TRACE("\t\t[%s] File [%s] Found At Memory Block [%d]\n", __func__, name, block_index);
+
+	memcpy( file, disk + block_index*BLOCK_SIZE, BLOCK_SIZE);
+	
+	if ( size > 0 ) { 
+		//If size is greater than zero, then the files size will be updated
+		file->size = size;
+		TRACE("\t\t[%s] File [%s] Now Has Size [%d]\n", __func__, name, size);
+		free(file);
+		return 0;
+	}
+	else {		  
+		//Otherwise, the file's name will be updated
+		char top_level[MAX_STRING_LENGTH];
+		strcpy(top_level, get_file_top_level(name));
+
+		// Change the name of the directory's subitem
+		edit_directory_subitem(top_level, name, new_name); 
+
+		// Change the name of the actual file descriptor
+		edit_descriptor_name(block_index, new_name); 
+
+		strcpy(file->name, new_name );
+		write_blocks( block_index, file, 1 );
+
+		TRACE("\t\t\t[%s] File [%s] Now Has Name [%s]\n", __func__, name, file->name);
+
+		free(file);
+		return 0;
+	}
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Grows or shrinks the file whose control block is at "index" to "size" bytes, keeping its data.
+//The blocks it grows by are holes, and everything past the old end reads as zero.
+int resize_file ( int index, int size ) {
+	if ( ((file_type *)(disk + index*BLOCK_SIZE))->compressed )
+		return rewrite_compressed( index, size, 0, NULL, 0 );
+
+	file_type *file = malloc ( BLOCK_SIZE );
+
+	memcpy( file, disk + index*BLOCK_SIZE, BLOCK_SIZE );
+
+	int count = size/BLOCK_SIZE + 1;
+	int old_count = file->data_block_count;
+	descriptor_block *descriptor = (descriptor_block *)disk;
+	int tail = file->data_block_index[old_count - 1];
+	bool shared_tail = size > file->size && tail != HOLE && descriptor->references[tail] > 1;
+	if ( count > MAX_FILE_DATA_BLOCKS || !reserve_blocks(shared_tail) ) {
+		TRACE("\t\t[%s] No Space to Grow File [%s] to [%d] Data Blocks\n", __func__, file->name, count);
+		free(file);
+		return FS_ERR_NO_SPACE;
+	}
+
+	//A shrink leaves old bytes behind the end of the last block; zeroing them is a write, so a shared block is copied first
+	if ( size > file->size && tail != HOLE ) {
+		if ( shared_tail ) {
+			unshare_data_blocks( index, old_count - 1, old_count - 1 );
+			memcpy( file, disk + index*BLOCK_SIZE, BLOCK_SIZE );
+		}
+		int end = file->size % BLOCK_SIZE;
+		snapshot_preserve( file->data_block_index[old_count - 1] );
+		dedup_forget( file->data_block_index[old_count - 1] );
+		memset( disk + file->data_block_index[old_count - 1]*BLOCK_SIZE + end, 0, BLOCK_SIZE - end );
+		checksum_update( file->data_block_index[old_count - 1] );
+	}
+
+	for ( int i = old_count; i < count; i++ )
+		file->data_block_index[i] = HOLE;
+	int released = 0;
+	for ( int i = old_count - 1; i >= count; i-- ) {
+		if ( file->data_block_index[i] == HOLE )
+			continue;
+		release_data_block( file->data_block_index[i], index );
+		released++;
+	}
+	TRACE("\t\t[%s] File [%s] Now Has Size [%d] in [%d] Data Blocks\n", __func__, file->name, size, count);
+
+	update_directory_totals( file->top_level, (long)size - file->size, 0, 0, -released );
+	file->size = size;
+	file->data_block_count = count;
+	write_blocks( index, file, 1 );
+
+	free(file);
+	return FS_OK;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Adds a file "new_name" to the current directory that shares the data blocks of the file at block "index".
+//Only the control block is new, so a copy costs one block however large the file is.
+int copy_file ( int index, char *new_name ) {
+	descriptor_block *descriptor = (descriptor_block *)disk;
+	file_type *file = malloc ( BLOCK_SIZE );
+
+	memcpy( file, disk + index*BLOCK_SIZE, BLOCK_SIZE );
+	strcpy( file->name, new_name );
+	strcpy( file->top_level, current.directory );
+
+	int copy = allocate_block(new_name, false, find_block(current.directory, true), -1);
+	for ( int i = 0; i < file->data_block_count; i++ ) {
+		if ( file->data_block_index[i] == HOLE )
+			continue;
+		descriptor_changing( file->data_block_index[i] );
+		descriptor->references[file->data_block_index[i]]++;
+	}
+	write_blocks( copy, file, 1 );
+	update_directory_totals( file->top_level, file->size, 1, 1, 1 + file_blocks(file) );
+	TRACE("\t\t[%s] File [%s] Shares [%d] Data Blocks with Memory Block [%d]\n", __func__, new_name, file->data_block_count, index );
+
+	free(file);
+	return copy;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Names data block "position" of the file "name" in the descriptor as "name->position"; the file name
+//is cut short where the whole would not fit
+void data_block_name ( char *subname, const char *name, int position ) {
+	char suffix[16];
+
+	int suffix_length = snprintf( suffix, sizeof(suffix), "->%d", position );
+	int kept = strnlen( name, MAX_STRING_LENGTH - 1 - suffix_length );
+	memcpy( subname, name, kept );
+	strcpy( subname + kept, suffix );
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Gives the file at block "index" a copy of its own of each data block from position "first" up to "last"
+//that it shares with other files; call before writing to them
+int unshare_data_blocks ( int index, int first, int last ) {
+	descriptor_block *descriptor = (descriptor_block *)disk;
+	file_type *file = malloc ( BLOCK_SIZE );
+	char subname[MAX_STRING_LENGTH];
+	int shared = 0;
+
+	memcpy( file, disk + index*BLOCK_SIZE, BLOCK_SIZE );
+	for ( int k = first; k <= last; k++ )
+		if ( file->data_block_index[k] != HOLE && descriptor->references[file->data_block_index[k]] > 1 )
+			shared++;
+	if ( shared == 0 || !reserve_blocks(shared) ) {
+		free(file);
+		return shared == 0 ? FS_OK : FS_ERR_NO_SPACE;
+	}
+
+	for ( int k = first; k <= last; k++ ) {
+		int block = file->data_block_index[k];
+		if ( block == HOLE || descriptor->references[block] <= 1 )
+			continue;
+		data_block_name( subname, file->name, k );
+		int copy = allocate_block(subname, false, k > 0 && file->data_block_index[k-1] != HOLE ? file->data_block_index[k-1] + 1 : index + 1, index);
+		write_blocks( copy, disk + block*BLOCK_SIZE, 1 );
+		file->data_block_index[k] = copy;
+		release_data_block( block, index );
+	}
+	write_blocks( index, file, 1 );
+	TRACE("\t\t[%s] File [%s] Copied [%d] Shared Data Blocks\n", __func__, file->name, shared );
+
+	free(file);
+	return FS_OK;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Delayed allocation: gives the holes among data blocks "first" up to "last" of the file at block "index" zeroed
+//blocks of their own; call before writing to them. The holes of one write get a run of consecutive blocks if
+//there is one, searched from right behind the file's block in front of them.
+int fill_holes ( int index, int first, int last ) {
+	descriptor_block *descriptor = (descriptor_block *)disk;
+	file_type *file = malloc ( BLOCK_SIZE );
+	char subname[MAX_STRING_LENGTH];
+	int holes = 0;
+
+	memcpy( file, disk + index*BLOCK_SIZE, BLOCK_SIZE );
+	for ( int k = first; k <= last; k++ )
+		if ( file->data_block_index[k] == HOLE )
+			holes++;
+	if ( holes > 0 && !quota_allows(file->top_level, 0, holes) ) {
+		free(file);
+		return FS_ERR_QUOTA;
+	}
+	if ( holes == 0 || !reserve_blocks(holes) ) {
+		free(file);
+		return holes == 0 ? FS_OK : FS_ERR_NO_SPACE;
+	}
+
+	int goal = index + 1;
+	for ( int k = first - 1; k >= 0; k-- ) {
+		if ( file->data_block_index[k] != HOLE ) {
+			goal = file->data_block_index[k] + 1;
+			break;
+		}
+	}
+	int run = find_free_run(descriptor, goal, holes);
+	if ( run != -1 )
+		goal = run;
+
+	for ( int k = first; k <= last; k++ ) {
+		if ( file->data_block_index[k] != HOLE )
+			continue;
+		data_block_name( subname, file->name, k );
+		int block = allocate_block(subname, false, goal, index);
+		snapshot_preserve(block);
+		memset(disk + block*BLOCK_SIZE, 0, BLOCK_SIZE);
+		checksum_set(block, crc32c.zero);
+		file->data_block_index[k] = block;
+		goal = block + 1;
+	}
+	write_blocks( index, file, 1 );
+	update_directory_totals( file->top_level, 0, 0, 0, holes );
+	TRACE("\t\t[%s] File [%s] Filled [%d] Holes%s\n", __func__, file->name, holes, run != -1 ? " with One Run" : "" );
+
+	free(file);
+	return FS_OK;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Drops the use of a data block by the file at block "user"; the block is freed once no file uses it
+void release_data_block ( int block, int user ) {
+	descriptor_block *descriptor = (descriptor_block *)disk;
+
+	if ( descriptor->references[block] <= 1 ) {
+		unallocate_block(block);
+		return;
+	}
+	descriptor_changing(block);
+	descriptor->references[block]--;
+
+	//Once deduplicated, a file may list the same block more than once; it stays the owner while no other file uses it
+	if ( descriptor->owner[block] == user ) {
+		int other = find_data_block_user(block, user);
+		if ( other != -1 )
+			descriptor->owner[block] = other;
+	}
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Finds a file other than "except" whose control block lists data block "block"; returns -1 if there is none
+int find_data_block_user ( int block, int except ) {
+	descriptor_block *descriptor = (descriptor_block *)disk;
+
+	for ( int i = 0; i < BLOCKS; i++ ) {
+		if ( i == except || !is_file_block(descriptor, i) )
+			continue;
+		file_type *file = (file_type *)(disk + i*BLOCK_SIZE);
+		for ( int k = 0; k < file->data_block_count; k++ )
+			if ( file->data_block_index[k] == block )
+				return i;
+	}
+	return -1;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Bytes of the segment that lie within the file
+int segment_bytes ( file_type *file, const fs_segment *segment ) {
+	if ( segment->offset >= file->size )
+		return 0;
+	return segment->length < file->size - segment->offset ? segment->length : file->size - segment->offset;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+bool valid_segments ( const fs_segment *segments, int count ) {
+	if ( count < 0 || (count > 0 && segments == NULL) )
+		return false;
+	for ( int s = 0; s < count; s++ )
+		if ( segments[s].offset < 0 || segments[s].length < 0 )
+			return false;
+	return true;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Copies the segments between the file's data blocks and their buffers; reads are cut short at the end of the
+//file, and the blocks a write covers have to be filled and unshared first. Pieces that follow each other both
+//on the disk and in the buffers, within a segment or from one segment to the next, are copied by one memcpy.
+void copy_segments ( file_type *file, const fs_segment *segments, int count, bool write ) {
+	char *run_data = NULL;
+	char *run_buffer = NULL;
+	int run_length = 0;
+
+	for ( int s = 0; s < count; s++ ) {
+		int offset = segments[s].offset;
+		char *buffer = segments[s].buffer;
+		int length = segment_bytes( file, &segments[s] );
+
+		while ( length > 0 ) {
+			int within = offset % BLOCK_SIZE;
+			int chunk = BLOCK_SIZE - within < length ? BLOCK_SIZE - within : length;
+			int block = file->data_block_index[offset / BLOCK_SIZE];
+			char *data = disk + block*BLOCK_SIZE + within;
+
+			//The run so far goes out first unless this piece simply extends it, so overlapping segments keep their order
+			bool extends = run_length > 0 && block != HOLE && data == run_data + run_length && buffer == run_buffer + run_length;
+			if ( !extends && run_length > 0 ) {
+				copy_run( run_data, run_buffer, run_length, write );
+				run_length = 0;
+			}
+			if ( block == HOLE )
+				memset( buffer, 0, chunk );	//only reads get here
+			else {
+				if ( write ) {
+					snapshot_preserve( block );
+					dedup_forget( block );
+					checksum_write( block, data, buffer, within, chunk );
+				}
+				if ( run_length == 0 ) {
+					run_data = data;
+					run_buffer = buffer;
+				}
+				run_length += chunk;
+			}
+			offset += chunk;
+			buffer += chunk;
+			length -= chunk;
+		}
+	}
+	if ( run_length > 0 )
+		copy_run( run_data, run_buffer, run_length, write );
+}
+
+/*--------------------------------------------------------------------------------*/
+
+void copy_run ( char *data, char *buffer, int length, bool write ) {
+	if ( write )
+		memcpy( data, buffer, length );
+	else
+		memcpy( buffer, data, length );
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Reads up to "length" bytes at "offset" of the file at block "index"; returns the bytes read, 0 past the end
+int read_file ( int index, int offset, void *buffer, int length ) {
+	fs_segment segment = { offset, buffer, length };
+
+	return read_segments( index, &segment, 1 );
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Writes "length" bytes at "offset" of the file at block "index", growing it first if they reach past its end
+int write_file ( int index, int offset, const void *buffer, int length ) {
+	fs_segment segment = { offset, (void *)buffer, length };
+
+	return write_segments( index, &segment, 1 );
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Reads every segment from the file at block "index", each one cut short at the end of the file;
+//returns the bytes read by all of them. Every block is checked against its checksum once per call.
+int read_segments ( int index, const fs_segment *segments, int count ) {
+	file_type *file = (file_type *)(disk + index*BLOCK_SIZE);
+	uint8_t verified[(MAX_FILE_DATA_BLOCKS + 7) / 8];
+	int total = 0;
+
+	if ( file->compressed ) {
+		for ( int s = 0; s < count; s++ ) {
+			int length = segment_bytes( file, &segments[s] );
+			if ( length > 0 && read_compressed( index, segments[s].offset, segments[s].buffer, length ) < 0 )
+				return FS_ERR_CHECKSUM;
+			total += length;
+		}
+		return total;
+	}
+
+	memset( verified, 0, sizeof(verified) );
+	for ( int s = 0; s < count; s++ ) {
+		int length = segment_bytes( file, &segments[s] );
+		if ( length == 0 )
+			continue;
+		for ( int k = segments[s].offset / BLOCK_SIZE; k <= (segments[s].offset + length - 1) / BLOCK_SIZE; k++ ) {
+			int block = file->data_block_index[k];
+			if ( block == HOLE || verified[k / 8] & (1 << k % 8) )
+				continue;
+			if ( !checksum_valid(block) )
+				return FS_ERR_CHECKSUM;
+			verified[k / 8] |= 1 << k % 8;
+		}
+		total += length;
+	}
+	copy_segments( file, segments, count, false );
+	return total;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Writes every segment to the file at block "index", growing it once to the end of the last one; returns the
+//bytes written by all of them. Later segments win where segments overlap.
+int write_segments ( int index, const fs_segment *segments, int count ) {
+	descriptor_block *descriptor = (descriptor_block *)disk;
+	file_type *file = (file_type *)(disk + index*BLOCK_SIZE);
+	long end = file->size;
+	int total = 0;
+
+	for ( int s = 0; s < count; s++ ) {
+		if ( (long)segments[s].offset + segments[s].length > DISK_PARTITION )
+			return FS_ERR_NO_SPACE;
+		if ( segments[s].offset + segments[s].length > end )
+			end = segments[s].offset + segments[s].length;
+		total += segments[s].length;
+	}
+	if ( file->compressed ) {
+		for ( int s = 0; s < count; s++ ) {
+			int error = rewrite_compressed( index, segments[s].offset + segments[s].length > file->size ? segments[s].offset + segments[s].length : file->size,
+				segments[s].offset, segments[s].buffer, segments[s].length );
+			if ( error != FS_OK )
+				return error;
+		}
+		return total;
+	}
+
+	//The holes and shared blocks under the segments are counted and checked before the file grows,
+	//so that a write that cannot get its blocks leaves the file as it was
+	uint8_t counted[(MAX_FILE_DATA_BLOCKS + 7) / 8];
+	int holes = 0, shared = 0;
+	memset( counted, 0, sizeof(counted) );
+	for ( int s = 0; s < count; s++ ) {
+		if ( segments[s].length == 0 )
+			continue;
+		int last = (segments[s].offset + segments[s].length - 1) / BLOCK_SIZE;
+		if ( last >= MAX_FILE_DATA_BLOCKS )
+			return FS_ERR_NO_SPACE;
+		for ( int k = segments[s].offset / BLOCK_SIZE; k <= last; k++ ) {
+			if ( counted[k / 8] & (1 << k % 8) )
+				continue;
+			counted[k / 8] |= 1 << k % 8;
+			if ( k >= file->data_block_count || file->data_block_index[k] == HOLE )
+				holes++;
+			else if ( descriptor->references[file->data_block_index[k]] > 1 )
+				shared++;
+		}
+	}
+	//Growing copies a shared last block too, to zero what lies behind the old end
+	int tail = file->data_block_count - 1;
+	if ( end > file->size && !(counted[tail / 8] & (1 << tail % 8)) && file->data_block_index[tail] != HOLE
+		&& descriptor->references[file->data_block_index[tail]] > 1 )
+		shared++;
+	if ( holes > 0 && !quota_allows(file->top_level, 0, holes) )
+		return FS_ERR_QUOTA;
+	if ( !reserve_blocks(holes + shared) )
+		return FS_ERR_NO_SPACE;
+
+	if ( end > file->size ) {
+		int error = resize_file( index, end );
+		if ( error != FS_OK )
+			return error;
+	}
+
+	//Most segments land on blocks the file already has to itself; only the others go through fill_holes and unsharing
+	for ( int s = 0; s < count; s++ ) {
+		if ( segments[s].length == 0 )
+			continue;
+		int first = segments[s].offset / BLOCK_SIZE;
+		int last = (segments[s].offset + segments[s].length - 1) / BLOCK_SIZE;
+		bool ready = true;
+		for ( int k = first; k <= last && ready; k++ )
+			ready = file->data_block_index[k] != HOLE && descriptor->references[file->data_block_index[k]] <= 1;
+		if ( ready )
+			continue;
+		int error = fill_holes( index, first, last );
+		if ( error == FS_OK )
+			error = unshare_data_blocks( index, first, last );
+		if ( error != FS_OK )
+			return error;
+	}
+	copy_segments( file, segments, count, true );
+
+	//Inline deduplication: a written block that another block already holds is replaced by that one
+	if ( dedup.on )
+		for ( int s = 0; s < count; s++ )
+			for ( int k = segments[s].offset / BLOCK_SIZE; segments[s].length > 0 && k <= (segments[s].offset + segments[s].length - 1) / BLOCK_SIZE; k++ )
+				dedup_block( file->data_block_index[k] );
+	return total;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+void stat_block ( int index, bool directory, fs_stat_type *stat ) {
+	stat->directory = directory;
+	stat->block = index;
+	if ( directory ) {
+		dir_type *folder = (dir_type *)(disk + index*BLOCK_SIZE);
+		strcpy( stat->name, folder->name );
+		strcpy( stat->parent, folder->top_level );
+		stat->size = folder->total_bytes;
+		stat->blocks = folder->total_blocks;
+		stat->files = folder->total_files;
+		stat->entries = folder->subitem_count;
+		stat->compressed = folder->compress;
+	}
+	else {
+		file_type *file = (file_type *)(disk + index*BLOCK_SIZE);
+		strcpy( stat->name, file->name );
+		strcpy( stat->parent, file->top_level );
+		stat->size = file->size;
+		stat->blocks = 1 + file_blocks(file);
+		stat->files = 0;
+		stat->entries = file_blocks(file);
+		stat->compressed = file->compressed;
+	}
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Returns the control block of an open descriptor, FS_ERR_NOT_FOUND if its file has been removed since
+int open_file_block ( int fd ) {
+	if ( fd < 0 || fd >= MAX_OPEN_FILES || !open_files.open[fd] )
+		return FS_ERR_BAD_DESCRIPTOR;
+	if ( open_files.block[fd] == -1 )
+		return FS_ERR_NOT_FOUND;
+	return open_files.block[fd];
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Points the descriptors of block "from" at block "to"; "to" is -1 when the block is freed
+void open_files_move ( int from, int to ) {
+	for ( int fd = 0; fd < MAX_OPEN_FILES; fd++ )
+		if ( open_files.open[fd] && open_files.block[fd] == from )
+			open_files.block[fd] = to;
+	if ( to >= 0 )
+		open_files.references[to] = open_files.references[from];
+	open_files.references[from] = 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Stores "count" blocks from "data" at block "index". While a snapshot still reads a block from the
+//disk, a block that does not change is skipped, so that the snapshot goes on sharing it.
+void write_blocks ( int index, const void *data, int count ) {
+	for ( int i = 0; i < count; i++ ) {
+		char *block = disk + (index + i)*BLOCK_SIZE;
+		const char *from = (const char *)data + i*BLOCK_SIZE;
+
+		if ( snapshots.saved[index + i] != snapshots.generation ) {
+			if ( memcmp(block, from, BLOCK_SIZE) == 0 )
+				continue;
+			snapshot_preserve( index + i );
+		}
+		dedup_forget( index + i );
+		checksum_write( index + i, block, from, 0, BLOCK_SIZE );
+		memcpy( block, from, BLOCK_SIZE );
+	}
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Call before the descriptor entry of block "index" changes. The free map and the counters are in block 0;
+//the owners of every block are saved with it, as a move hands the data blocks of a file to a new owner at once.
+//The reference count and the name may lie in the blocks after them.
+void descriptor_changing ( int index ) {
+	size_t references = offsetof(descriptor_block, references) + (size_t)index*sizeof(int);
+	size_t name = offsetof(descriptor_block, name) + (size_t)index*MAX_STRING_LENGTH;
+
+	for ( size_t b = 0; b <= (offsetof(descriptor_block, owner) + sizeof(int)*BLOCKS - 1) / BLOCK_SIZE; b++ )
+		snapshot_preserve( b );
+	snapshot_preserve( references / BLOCK_SIZE );
+	snapshot_preserve( (references + sizeof(int) - 1) / BLOCK_SIZE );
+	snapshot_preserve( name / BLOCK_SIZE );
+	snapshot_preserve( (name + MAX_STRING_LENGTH - 1) / BLOCK_SIZE );
+}
+
+/*--------------------------------------------------------------------------------*/
+
+/************************** Defragmentation ************************************/
+
+//Percentage of file data blocks that do not directly follow the previous data block of the same file.
+//0 means every file is a single contiguous run, 100 means no two data blocks of a file are adjacent.
+int fragmentation_score ( ) {
+	descriptor_block *descriptor = (descriptor_block *)disk;
+	file_type *file = malloc ( BLOCK_SIZE );
+	int pairs = 0;
+	int breaks = 0;
+
+	for ( int i = 0; i < BLOCKS; i++ ) {
+		if ( !is_file_block(descriptor, i) )
+			continue;
+		memcpy( file, disk + i*BLOCK_SIZE, BLOCK_SIZE );
+		int previous = HOLE;
+		for ( int k = 0; k < file->data_block_count; k++ ) {
+			if ( file->data_block_index[k] == HOLE )
+				continue;	//holes take no place, so the blocks around one can still be adjacent
+			if ( previous != HOLE ) {
+				pairs++;
+				if ( file->data_block_index[k] != previous + 1 )
+					breaks++;
+			}
+			previous = file->data_block_index[k];
+		}
+	}
+
+	free(file);
+	return pairs == 0 ? 0 : 100*breaks/pairs;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Finds "length" consecutive free blocks, searching from "goal" to the end of the disk and then from the start.
+//The first block of the run is returned, or -1 if the free space is too fragmented.
+int find_free_run ( descriptor_block *descriptor, int goal, int length ) {
+	int run = 0;
+
+	for ( int j = 0; j < BLOCKS; j++ ) {
+		int i = (goal + j) % BLOCKS;
+		if ( i == 0 )
+			run = 0;	//runs do not wrap around the end of the disk
+		run = descriptor->free[i] ? run + 1 : 0;
+		if ( run == length )
+			return i - length + 1;
+	}
+	return -1;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Data blocks of "file" that do not follow the one before; with "moved", as they would be once every block b
+//with moved[b] != -1 was moved there
+int data_breaks ( file_type *file, const int *moved ) {
+	int breaks = 0;
+	int previous = HOLE;
+
+	for ( int k = 0; k < file->data_block_count; k++ ) {
+		int block = file->data_block_index[k];
+		if ( block == HOLE )
+			continue;
+		if ( moved != NULL && moved[block] != -1 )
+			block = moved[block];
+		if ( previous != HOLE && block != previous + 1 )
+			breaks++;
+		previous = block;
+	}
+	return breaks;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//data_breaks summed over the file at block "index" and, if it shares blocks, every other file that uses one of
+//the blocks in "moved"; as they are now, or "after" the move
+int breaks_of_users ( int index, bool shared, const int *moved, bool after ) {
+	descriptor_block *descriptor = (descriptor_block *)disk;
+	file_type *owner = (file_type *)(disk + index*BLOCK_SIZE);
+	int breaks = data_breaks( owner, after ? moved : NULL );
+
+	for ( int i = 0; shared && i < BLOCKS; i++ ) {
+		if ( i == index || !is_file_block(descriptor, i) )
+			continue;
+		file_type *file = (file_type *)(disk + i*BLOCK_SIZE);
+		for ( int k = 0; k < file->data_block_count; k++ ) {
+			int block = file->data_block_index[k];
+			if ( block != HOLE && descriptor->references[block] > 1 && moved[block] != -1 ) {
+				breaks += data_breaks( file, after ? moved : NULL );
+				break;
+			}
+		}
+	}
+	return breaks;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Runs the defragmentation pass for at most "budget" microseconds; returns true once the pass is complete.
+//The first phase packs every directory into the lowest free block of its allocation group,
+//the second moves the data of each fragmented file into one contiguous run. A shared data block moves for
+//every file that uses it, so a file is only moved if that leaves fewer breaks among all of them; files
+//that share blocks in different orders would otherwise pull the blocks back and forth.
+bool defrag_step ( long budget ) {
+	descriptor_block *descriptor = (descriptor_block *)disk;
+	file_type *file = malloc ( BLOCK_SIZE );
+	int *moved = malloc ( sizeof(int)*BLOCKS );
+	struct timespec start;
+
+	clock_gettime( CLOCK_MONOTONIC, &start );
+	while ( defrag_state.phase < 2 && elapsed_microseconds(&start) < budget ) {
+		if ( defrag_state.cursor == BLOCKS ) {
+			defrag_state.phase++;
+			defrag_state.cursor = 0;
+			continue;
+		}
+		int i = defrag_state.cursor++;
+
+		if ( defrag_state.phase == 0 ) {
+			if ( descriptor->free[i] || !descriptor->directory[i] )
+				continue;
+			for ( int j = (i / BLOCKS_PER_GROUP) * BLOCKS_PER_GROUP; j < i; j++ ) {
+				if ( descriptor->free[j] ) {
+					if ( move_block(i, j) == 0 ) defrag_state.moved++;
+					break;
+				}
+			}
+		}
+		else {
+			if ( !is_file_block(descriptor, i) )
+				continue;
+			memcpy( file, disk + i*BLOCK_SIZE, BLOCK_SIZE );
+
+			//Holes are skipped: the blocks the file holds only have to follow each other
+			if ( data_breaks(file, NULL) == 0 )
+				continue;
+			//A block the file holds twice, as deduplication leaves it, takes one place in the run
+			int blocks = 0;
+			bool shared = false;
+			memset( moved, -1, sizeof(int)*BLOCKS );
+			for ( int k = 0; k < file->data_block_count; k++ ) {
+				int block = file->data_block_index[k];
+				if ( block == HOLE || moved[block] != -1 )
+					continue;
+				shared = shared || descriptor->references[block] > 1;
+				moved[block] = blocks++;
+			}
+
+			//Prefer a run right behind the control block, so the file stays in its group
+			int run = find_free_run(descriptor, i + 1, blocks);
+			if ( run == -1 ) {
+				TRACE("\t\t[%s] No Free Run of [%d] Blocks for File [%s]\n", __func__, blocks, file->name );
+				continue;
+			}
+			for ( int b = 0; b < BLOCKS; b++ )
+				if ( moved[b] != -1 )
+					moved[b] += run;
+			if ( breaks_of_users(i, shared, moved, true) >= breaks_of_users(i, shared, moved, false) ) {
+				TRACE("\t\t[%s] Moving File [%s] Would Not Leave Fewer Breaks\n", __func__, file->name );
+				continue;
+			}
+			TRACE("\t\t[%s] Moving File [%s] Data to Memory Blocks [%d]-[%d]\n", __func__, file->name, run, run + blocks - 1 );
+			//The run was free, so a block already moved has left a free block behind
+			for ( int k = 0; k < file->data_block_count; k++ ) {
+				int block = file->data_block_index[k];
+				if ( block != HOLE && !descriptor->free[block] && move_block(block, moved[block]) == 0 ) defrag_state.moved++;
+			}
+		}
+	}
+
+	free(moved);
+	free(file);
+	return defrag_state.phase == 2;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+void defrag_finish ( ) {
+	fprintf(output, "fragmentation score after: %d (%d blocks moved)\n", fragmentation_score(), defrag_state.moved);
+}
+
+/*--------------------------------------------------------------------------------*/
+
+long elapsed_microseconds ( struct timespec *start ) {
+	return elapsed_nanoseconds(start) / 1000;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+long elapsed_nanoseconds ( struct timespec *start ) {
+	struct timespec now;
+
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return (now.tv_sec - start->tv_sec) * 1000000000L + (now.tv_nsec - start->tv_nsec);
+}
+
+/*--------------------------------------------------------------------------------*/
+
+/************************** Consistency Check ************************************/
+
+//Worker that takes directories off the queue and claims everything they refer to.
+//A block is only walked by the worker that claimed it first, so every directory is visited once.
+void *fsck_walk ( void *arg ) {
+	fsck_state *state = arg;
+	dir_type *folder = malloc ( BLOCK_SIZE );
+
+	pthread_mutex_lock( &state->lock );
+	while ( 1 ) {
+		while ( state->queue_head == state->queue_tail && state->busy > 0 )
+			pthread_cond_wait( &state->wake, &state->lock );
+		if ( state->queue_head == state->queue_tail )
+			break;		//nothing queued and nobody left to queue more
+		int index = state->queue[state->queue_head++];
+		state->busy++;
+		pthread_mutex_unlock( &state->lock );
+
+		memcpy( folder, disk + index*BLOCK_SIZE, BLOCK_SIZE );
+		int count = folder->subitem_count;
+		if ( count < 0 || count > MAX_SUBDIRECTORIES ) {
+			fsck_report( state, "fsck: directory [%s] has an invalid subitem count %d\n", folder->name, count );
+			count = 0;
+		}
+
+		for ( int k = 0; k < count; k++ ) {
+			bool directory = folder->subitem_type[k];
+			int child = fsck_lookup( state, folder->subitem[k], directory );
+
+			if ( child == -1 && (child = fsck_lookup( state, folder->subitem[k], !directory )) != -1 ) {
+				directory = !directory;
+				pthread_mutex_lock( &state->lock );
+				state->mistyped[2*state->mistyped_count] = index;
+				state->mistyped[2*state->mistyped_count+1] = k;
+				state->mistyped_count++;
+				pthread_mutex_unlock( &state->lock );
+				fsck_report( state, "fsck: directory [%s] lists [%s] as a %s\n", folder->name, folder->subitem[k], directory ? "file" : "directory" );
+			}
+			if ( child == -1 ) {
+				pthread_mutex_lock( &state->lock );
+				state->dangling[2*state->dangling_count] = index;
+				state->dangling[2*state->dangling_count+1] = k;
+				state->dangling_count++;
+				pthread_mutex_unlock( &state->lock );
+				fsck_report( state, "fsck: directory [%s] lists [%s], which does not exist (dangling)\n", folder->name, folder->subitem[k] );
+				continue;
+			}
+
+			if ( __atomic_add_fetch( &state->claims[child], 1, __ATOMIC_RELAXED ) > 1 )
+				continue;
+			if ( directory ) {
+				pthread_mutex_lock( &state->lock );
+				state->queue[state->queue_tail++] = child;
+				pthread_cond_signal( &state->wake );
+				pthread_mutex_unlock( &state->lock );
+			}
+			else
+				fsck_claim_file( state, child );
+		}
+
+		pthread_mutex_lock( &state->lock );
+		state->busy--;
+	}
+	pthread_cond_broadcast( &state->wake );
+	pthread_mutex_unlock( &state->lock );
+
+	free(folder);
+	return NULL;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Claims the data blocks listed in a file control block
+void fsck_claim_file ( fsck_state *state, int index ) {
+	file_type *file = malloc ( BLOCK_SIZE );
+
+	memcpy( file, disk + index*BLOCK_SIZE, BLOCK_SIZE );
+	if ( file->data_block_count < 0 || file->data_block_count > MAX_FILE_DATA_BLOCKS ) {
+		fsck_report( state, "fsck: file [%s] has an invalid data block count %d\n", file->name, file->data_block_count );
+		file->data_block_count = 0;
+	}
+	for ( int i = 0; i < file->data_block_count; i++ ) {
+		int block = file->data_block_index[i];
+		if ( block == HOLE )
+			continue;
+		if ( block < 0 || block >= BLOCKS ) {
+			fsck_report( state, "fsck: file [%s] refers to invalid block %d\n", file->name, block );
+			continue;
+		}
+		__atomic_add_fetch( &state->claims[block], 1, __ATOMIC_RELAXED );
+	}
+	free(file);
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Worker that compares the claims of its allocation groups with their free map and summary counts
+void *fsck_check_groups ( void *arg ) {
+	fsck_range *range = arg;
+	fsck_state *state = range->state;
+	descriptor_block *descriptor = state->descriptor;
+
+	for ( int g = range->first_group; g < range->last_group; g++ ) {
+		int free_blocks = 0;
+		int directories = 0;
+
+		for ( int i = g*BLOCKS_PER_GROUP; i < (g+1)*BLOCKS_PER_GROUP; i++ ) {
+			if ( descriptor->free[i] ) free_blocks++;
+			if ( descriptor->directory[i] ) directories++;
+
+			//Data blocks may be shared by copies, as many times as their reference count says
+			bool data = !descriptor->free[i] && descriptor->owner[i] >= 0;
+			if ( state->claims[i] == 0 && !descriptor->free[i] )
+				state->status[i] = FSCK_LEAK;
+			else if ( state->claims[i] > 1 && !data )
+				state->status[i] = FSCK_DOUBLE;
+			else if ( state->claims[i] == 1 && descriptor->free[i] )
+				state->status[i] = FSCK_UNMARKED;
+			else if ( data && state->claims[i] != descriptor->references[i] )
+				state->status[i] = FSCK_REFERENCES;
+			if ( state->status[i] != FSCK_OK )
+				__atomic_add_fetch( &state->problems, 1, __ATOMIC_RELAXED );
+		}
+
+		strcpy( range->report[g], "" );
+		if ( free_blocks != descriptor->group_free[g] || directories != descriptor->group_directories[g] ) {
+			snprintf( range->report[g], LINESIZE, "fsck: group %d summary says %d free and %d directories, free map has %d and %d\n",
+				g, descriptor->group_free[g], descriptor->group_directories[g], free_blocks, directories );
+			__atomic_add_fetch( &state->problems, 1, __ATOMIC_RELAXED );
+		}
+	}
+	return NULL;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Binary search in the sorted name tables; returns the block index or -1
+int fsck_lookup ( fsck_state *state, char *name, bool directory ) {
+	fsck_name *table = directory ? state->directories : state->files;
+	int low = 0;
+	int high = (directory ? state->directory_count : state->file_count) - 1;
+
+	while ( low <= high ) {
+		int middle = (low + high) / 2;
+		int cmp = strcmp( table[middle].name, name );
+		if ( cmp == 0 )
+			return table[middle].block;
+		if ( cmp < 0 )
+			low = middle + 1;
+		else
+			high = middle - 1;
+	}
+	return -1;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+int fsck_compare ( const void *a, const void *b ) {
+	return strcmp( ((fsck_name *)a)->name, ((fsck_name *)b)->name );
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Prints one finding; the lock keeps lines from different workers apart
+void fsck_report ( fsck_state *state, const char *format, ... ) {
+	va_list args;
+
+	pthread_mutex_lock( &state->lock );
+	va_start( args, format );
+	vfprintf( output, format, args );
+	va_end( args );
+	state->problems++;
+	pthread_mutex_unlock( &state->lock );
+}
+
+/*--------------------------------------------------------------------------------*/
+
+/************************** Name Index ************************************/
+
+//Position of the first entry that sorts at or after (name, index); index -1 sorts before every block
+int name_index_lower_bound ( char *name, int index ) {
+	descriptor_block *descriptor = (descriptor_block *)disk;
+	int low = 0;
+	int high = sorted_names.count;
+
+	while ( low < high ) {
+		int middle = (low + high) / 2;
+		int block = sorted_names.block[middle];
+		int cmp = strcmp( descriptor->name[block], name );
+		if ( cmp < 0 || (cmp == 0 && block < index) )
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return low;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Adds a block to the index; call after its name has been written to the descriptor
+void name_index_insert ( int index ) {
+	descriptor_block *descriptor = (descriptor_block *)disk;
+
+	if ( strcmp(descriptor->name[index], "") == 0 )
+		return;
+	int position = name_index_lower_bound( descriptor->name[index], index );
+	memmove( &sorted_names.block[position+1], &sorted_names.block[position], sizeof(int)*(sorted_names.count - position) );
+	sorted_names.block[position] = index;
+	sorted_names.count++;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Drops a block from the index; call before its name is changed or cleared in the descriptor
+void name_index_remove ( int index ) {
+	descriptor_block *descriptor = (descriptor_block *)disk;
+
+	int position = name_index_lower_bound( descriptor->name[index], index );
+	if ( position == sorted_names.count || sorted_names.block[position] != index )
+		return;
+	memmove( &sorted_names.block[position], &sorted_names.block[position+1], sizeof(int)*(sorted_names.count - position - 1) );
+	sorted_names.count--;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Compares the first "length" bytes of a name record with the prefix, 16 bytes at a time
+bool name_has_prefix ( char *record, char *prefix, int length ) {
+#ifdef __SSE2__
+	char padded[16] = { 0 };
+	int head = length < 16 ? length : 16;
+
+	memcpy( padded, prefix, head );
+	__m128i equal = _mm_cmpeq_epi8( _mm_loadu_si128((__m128i *)record), _mm_loadu_si128((__m128i *)padded) );
+	unsigned mask = (1u << head) - 1;
+	if ( ((unsigned)_mm_movemask_epi8(equal) & mask) != mask )
+		return false;
+	return strncmp( record + head, prefix + head, length - head ) == 0;
+#else
+	return strncmp( record, prefix, length ) == 0;
+#endif
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Cheap filter for full scans: false if the record cannot contain the first two bytes of the literal.
+//Bytes after the terminator may give false positives, fnmatch has the final word.
+bool name_may_contain ( char *record, char *literal, int length ) {
+	if ( record[0] == '\0' )
+		return false;
+	if ( length == 0 )
+		return true;
+#ifdef __SSE2__
+	//Two overlapping 16 byte windows cover every pair of adjacent bytes in the MAX_STRING_LENGTH record
+	int shift = length > 1 ? 1 : 0;
+	int offsets[2] = { 0, MAX_STRING_LENGTH - 16 - shift };
+	__m128i first = _mm_set1_epi8( literal[0] );
+	__m128i second = _mm_set1_epi8( literal[shift] );
+	for ( int k = 0; k < 2; k++ ) {
+		__m128i hits = _mm_cmpeq_epi8( _mm_loadu_si128((__m128i *)(record + offsets[k])), first );
+		hits = _mm_and_si128( hits, _mm_cmpeq_epi8( _mm_loadu_si128((__m128i *)(record + offsets[k] + shift)), second ) );
+		if ( _mm_movemask_epi8(hits) != 0 )
+			return true;
+	}
+	return false;
+#else
+	return strstr( record, literal ) != NULL;
+#endif
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Writes the full path of a block ("root/a/b") by following the top_level names upwards. A path longer than
+//LINESIZE starts with ".../" in place of the directories above the ones that fit.
+void build_path ( int index, char *path ) {
+	char parent[MAX_STRING_LENGTH];
+	dir_type *folder = malloc ( BLOCK_SIZE );
+
+	//Files and directories both start with name and top_level
+	memcpy( folder, disk + index*BLOCK_SIZE, BLOCK_SIZE );
+	snprintf( path, LINESIZE, "%s", folder->name );
+	strcpy( parent, folder->top_level );
+	while ( strcmp(parent, "") != 0 ) {
+		int block_index = find_block(parent, true);
+		if ( block_index == -1 )
+			break;
+		memcpy( folder, disk + block_index*BLOCK_SIZE, BLOCK_SIZE );
+		int length = strlen(path);
+		int name_length = strlen(folder->name);
+		if ( name_length + 1 + length + (int)strlen(".../") >= LINESIZE ) {
+			memmove( path + strlen(".../"), path, length + 1 );
+			memcpy( path, ".../", strlen(".../") );
+			break;
+		}
+		memmove( path + name_length + 1, path, length + 1 );
+		memcpy( path, folder->name, name_length );
+		path[name_length] = '/';
+		strcpy( parent, folder->top_level );
+	}
+	free(folder);
+}
+
+/*--------------------------------------------------------------------------------*/
+
+int compare_block_names ( const void *a, const void *b ) {
+	descriptor_block *descriptor = (descriptor_block *)disk;
+
+	return strcmp( descriptor->name[*(int *)a], descriptor->name[*(int *)b] );
+}
+
+/*--------------------------------------------------------------------------------*/
+
+/************************** Snapshots ************************************/
+
+//Call before block "index" of the disk changes: every snapshot taken since the block was last saved
+//still reads it from the disk, so those snapshots get one shared copy of it first.
+void snapshot_preserve ( int index ) {
+	int previous = snapshots.saved[index];
+	saved_block *copy = NULL;
+
+	if ( previous == snapshots.generation )
+		return;
+	snapshots.saved[index] = snapshots.generation;
+
+	for ( snapshot *shot = snapshots.newest; shot != NULL && shot->generation > previous; shot = shot->older ) {
+		if ( snapshot_block_free(shot, index) )
+			continue;
+		if ( copy == NULL ) {
+			copy = malloc( sizeof(saved_block) );
+			copy->references = 0;
+			memcpy( copy->data, disk + index*BLOCK_SIZE, BLOCK_SIZE );
+			snapshots.copies++;
+		}
+		shot->block[index] = copy;
+		shot->saved++;
+		copy->references++;
+	}
+	if ( copy != NULL )
+		TRACE("\t\t\t[%s] Saved Memory Block [%d] for [%d] Snapshots\n", __func__, index, copy->references );
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//True if block "index" was free when the snapshot was taken, so what it held did not matter.
+//The free map lies in block 0, which the snapshot has a copy of once the free map changed.
+bool snapshot_block_free ( snapshot *shot, int index ) {
+	char *first = shot->block[0] != NULL ? shot->block[0]->data : disk;
+
+	return ((descriptor_block *)first)->free[index];
+}
+
+/*--------------------------------------------------------------------------------*/
+
+snapshot *snapshot_find ( char *name ) {
+	for ( snapshot *shot = snapshots.newest; shot != NULL; shot = shot->older )
+		if ( strcmp(shot->name, name) == 0 )
+			return shot;
+	return NULL;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Copies back every block that changed since the snapshot and rebuilds what is kept in memory only.
+//Newer snapshots save the blocks first, like for any other change, so they stay intact.
+void snapshot_restore ( snapshot *shot ) {
+	descriptor_block *descriptor = (descriptor_block *)disk;
+	char (*open_name)[MAX_STRING_LENGTH] = malloc( sizeof(*open_name)*MAX_OPEN_FILES );
+	char (*watch_name)[MAX_STRING_LENGTH] = malloc( sizeof(*watch_name)*MAX_WATCHES );
+
+	for ( int fd = 0; fd < MAX_OPEN_FILES; fd++ )
+		if ( open_files.open[fd] && open_files.block[fd] != -1 )
+			strcpy( open_name[fd], descriptor->name[open_files.block[fd]] );
+	for ( int w = 0; w < MAX_WATCHES; w++ )
+		if ( changes.used[w] && changes.block[w] != -1 )
+			strcpy( watch_name[w], descriptor->name[changes.block[w]] );
+
+	//The descriptor goes last: its checksums are those of the restored blocks, while writing
+	//the other blocks still works out their checksums from the ones on the disk
+	int restored = 0;
+	for ( int n = 0; n < BLOCKS; n++ ) {
+		int i = (n + DESCRIPTOR_BLOCKS) % BLOCKS;
+		if ( shot->block[i] == NULL )
+			continue;
+		write_blocks( i, shot->block[i]->data, 1 );
+		restored++;
+	}
+	TRACE("\t\t[%s] Restored [%d] Memory Blocks of Snapshot [%s]\n", __func__, restored, shot->name );
+
+	sorted_names.count = 0;
+	for ( int i = 0; i < BLOCKS; i++ )
+		name_index_insert(i);
+	dedup_reset();
+	cache_reset();
+	reclaim_count();
+	quota_count();
+
+	//A descriptor stays open only if its block still holds the same file
+	memset( open_files.references, 0, sizeof(open_files.references) );
+	for ( int fd = 0; fd < MAX_OPEN_FILES; fd++ ) {
+		int block = open_files.block[fd];
+		if ( !open_files.open[fd] || block == -1 )
+			continue;
+		if ( is_file_block(descriptor, block) && strcmp(descriptor->name[block], open_name[fd]) == 0 )
+			open_files.references[block]++;
+		else
+			open_files.block[fd] = -1;
+	}
+	free(open_name);
+
+	//The same goes for a watch and its directory
+	for ( int w = 0; w < MAX_WATCHES; w++ ) {
+		int block = changes.block[w];
+		if ( changes.used[w] && block != -1 && !(descriptor->directory[block] && strcmp(descriptor->name[block], watch_name[w]) == 0) )
+			changes.block[w] = -1;
+	}
+	free(watch_name);
+}
+
+/*--------------------------------------------------------------------------------*/
+
+/************************** Deduplication ************************************/
+
+//64 bit hash of a block in the manner of xxHash64: four independent lanes take 8 bytes each per round,
+//so the multiplies overlap, and the lanes are folded together and mixed at the end
+uint64_t block_hash ( const char *data ) {
+	const uint64_t prime1 = 0x9E3779B185EBCA87ULL, prime2 = 0xC2B2AE3D27D4EB4FULL, prime3 = 0x165667B19E3779F9ULL;
+	uint64_t lane[4] = { prime1 + prime2, prime2, 0, -prime1 };
+	uint64_t word;
+	int i = 0;
+
+	for ( ; i + 32 <= BLOCK_SIZE; i += 32 )
+		for ( int k = 0; k < 4; k++ ) {
+			memcpy( &word, data + i + 8*k, 8 );
+			lane[k] += word * prime2;
+			lane[k] = ((lane[k] << 31) | (lane[k] >> 33)) * prime1;
+		}
+	uint64_t hash = ((lane[0] << 1) | (lane[0] >> 63)) + ((lane[1] << 7) | (lane[1] >> 57))
+		+ ((lane[2] << 12) | (lane[2] >> 52)) + ((lane[3] << 18) | (lane[3] >> 46));
+	for ( ; i < BLOCK_SIZE; i += 8 ) {
+		word = 0;
+		memcpy( &word, data + i, BLOCK_SIZE - i < 8 ? BLOCK_SIZE - i : 8 );
+		hash ^= ((word * prime2) << 31 | (word * prime2) >> 33) * prime1;
+		hash = ((hash << 27) | (hash >> 37)) * prime1 + prime3;
+	}
+	hash ^= hash >> 33;
+	hash *= prime2;
+	hash ^= hash >> 29;
+	hash *= prime3;
+	return hash ^ (hash >> 32);
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Matches data block "index" with the index: if an identical block is in it, every file using "index" is pointed
+//at that block and "index" is freed; otherwise "index" joins the index. Returns true if the block was merged.
+bool dedup_block ( int index ) {
+	char *data = disk + index*BLOCK_SIZE;
+
+	if ( dedup.hashed[index] )
+		return false;
+	uint64_t hash = block_hash(data);
+	int *bucket = &dedup.bucket[hash & (DEDUP_BUCKETS - 1)];
+
+	//Equal hashes are only a hint, the data has the final word
+	for ( int j = *bucket; j != -1; j = dedup.next[j] ) {
+		if ( dedup.hash[j] == hash && memcmp(disk + j*BLOCK_SIZE, data, BLOCK_SIZE) == 0 ) {
+			merge_data_block( index, j );
+			return true;
+		}
+	}
+	dedup.hash[index] = hash;
+	dedup.hashed[index] = true;
+	dedup.next[index] = *bucket;
+	*bucket = index;
+	return false;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Drops a block from the index; call before its data changes, or when it moves or is freed
+void dedup_forget ( int index ) {
+	if ( !dedup.hashed[index] )
+		return;
+	int *link = &dedup.bucket[dedup.hash[index] & (DEDUP_BUCKETS - 1)];
+	while ( *link != index )
+		link = &dedup.next[*link];
+	*link = dedup.next[index];
+	dedup.hashed[index] = false;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+void dedup_reset ( ) {
+	for ( int b = 0; b < DEDUP_BUCKETS; b++ )
+		dedup.bucket[b] = -1;
+	memset( dedup.hashed, 0, sizeof(dedup.hashed) );
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Points every file that uses data block "from" at the identical data block "to" and frees "from"
+void merge_data_block ( int from, int to ) {
+	descriptor_block *descriptor = (descriptor_block *)disk;
+	file_type *file = malloc ( BLOCK_SIZE );
+	int left = descriptor->references[from];
+
+	descriptor_changing(to);
+	descriptor->references[to] += left;
+	for ( int user = descriptor->owner[from]; user >= 0; ) {
+		memcpy( file, disk + user*BLOCK_SIZE, BLOCK_SIZE );
+		for ( int i = 0; i < file->data_block_count; i++ ) {
+			if ( file->data_block_index[i] == from ) {
+				file->data_block_index[i] = to;
+				left--;
+			}
+		}
+		write_blocks( user, file, 1 );
+		user = left > 0 ? find_data_block_user(from, -1) : -1;
+	}
+	TRACE("\t\t[%s] Data Block [%d] Merged into Identical Block [%d], Now Used [%d] Times\n", __func__, from, to, descriptor->references[to] );
+	unallocate_block(from);
+
+	free(file);
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Blocks that sharing saves: a data block used by n files stands in for n - 1 copies
+int shared_blocks_saved ( ) {
+	descriptor_block *descriptor = (descriptor_block *)disk;
+	int saved = 0;
+
+	for ( int i = 0; i < BLOCKS; i++ )
+		if ( descriptor->references[i] > 1 )
+			saved += descriptor->references[i] - 1;
+	return saved;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Runs the deduplication pass for at most "budget" microseconds; returns true once every block has been matched
+bool dedup_step ( long budget ) {
+	descriptor_block *descriptor = (descriptor_block *)disk;
+	struct timespec start;
+
+	clock_gettime( CLOCK_MONOTONIC, &start );
+	while ( dedup.cursor < BLOCKS && elapsed_microseconds(&start) < budget ) {
+		int i = dedup.cursor++;
+		if ( descriptor->free[i] || descriptor->owner[i] == -1 )
+			continue;
+		if ( dedup_block(i) )
+			dedup.merged++;
+	}
+	return dedup.cursor == BLOCKS;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+void dedup_finish ( ) {
+	int saved = shared_blocks_saved();
+	fprintf(output, "dedup: %d blocks merged, %d blocks saved by sharing (%ld bytes)\n", dedup.merged, saved, (long)saved*BLOCK_SIZE);
+}
+
+/*--------------------------------------------------------------------------------*/
+
+/************************** Compression ************************************/
+
+//A compressed file keeps its data as one packed stream in its data blocks: a table with the packed length of
+//each of its size/BLOCK_SIZE + 1 logical blocks, then the packed blocks back to back. Several logical blocks
+//share a physical block that way, so data_block_count counts physical blocks, while size stays the logical size.
+//A logical block that does not get smaller is stored as it is, with BLOCK_SIZE as its length.
+
+//Reads logical bytes of a compressed file through the block cache; the range has to lie within the file
+int read_compressed ( int index, int offset, char *buffer, int length ) {
+	int done = 0;
+
+	while ( done < length ) {
+		int within = (offset + done) % BLOCK_SIZE;
+		int chunk = BLOCK_SIZE - within < length - done ? BLOCK_SIZE - within : length - done;
+		char *data = cached_block(index, (offset + done) / BLOCK_SIZE);
+		if ( data == NULL )
+			return FS_ERR_CHECKSUM;
+		memcpy( buffer + done, data + within, chunk );
+		done += chunk;
+	}
+	return length;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Builds the packed stream of the compressed file at block "index" anew with "size" logical bytes and "length" bytes
+//of "buffer" written at "offset". Only the blocks the write touches, and a tail that grows, are packed again;
+//every other block keeps its packed bytes.
+int rewrite_compressed ( int index, int size, int offset, const char *buffer, int length ) {
+	file_type *file = malloc ( BLOCK_SIZE );
+
+	memcpy( file, disk + index*BLOCK_SIZE, BLOCK_SIZE );
+	int old_count = file->size/BLOCK_SIZE + 1;
+	int count = size/BLOCK_SIZE + 1;
+	if ( count > MAX_FILE_DATA_BLOCKS ) {
+		free(file);
+		return FS_ERR_NO_SPACE;
+	}
+
+	char *old = malloc( (long)file->data_block_count*BLOCK_SIZE );
+	for ( int p = 0; p < file->data_block_count; p++ )
+		memcpy( old + p*BLOCK_SIZE, disk + file->data_block_index[p]*BLOCK_SIZE, BLOCK_SIZE );
+	char *stream = calloc( count + 2, BLOCK_SIZE );
+	char *logical = malloc( BLOCK_SIZE );
+	uint16_t *old_length = (uint16_t *)old;
+	uint16_t *new_length = (uint16_t *)stream;
+	int from = 2*old_count;
+	int end = 2*count;
+
+	for ( int k = 0; k < count; k++ ) {
+		int first = k*BLOCK_SIZE;
+		bool written = length > 0 && first < offset + length && first + BLOCK_SIZE > offset;
+		bool tail = k == old_count - 1 && size > file->size;
+
+		if ( k < old_count && !written && !tail ) {
+			new_length[k] = old_length[k];
+			memcpy( stream + end, old + from, old_length[k] );
+		}
+		else {
+			if ( k < old_count )
+				unpack_block( old + from, old_length[k], logical );
+			else
+				memset( logical, 0, BLOCK_SIZE );
+			if ( tail )
+				memset( logical + file->size % BLOCK_SIZE, 0, BLOCK_SIZE - file->size % BLOCK_SIZE );
+			if ( written ) {
+				int start = offset > first ? offset - first : 0;
+				int stop = offset + length < first + BLOCK_SIZE ? offset + length - first : BLOCK_SIZE;
+				memcpy( logical + start, buffer + first + start - offset, stop - start );
+			}
+			new_length[k] = pack_block( logical, stream + end );
+		}
+		end += new_length[k];
+		if ( k < old_count )
+			from += old_length[k];
+	}
+
+	int error = store_data( index, file, stream, end );
+	if ( error == FS_OK ) {
+		TRACE("\t\t[%s] File [%s] Packed [%d] Bytes into [%d] Data Blocks\n", __func__, file->name, size, file->data_block_count );
+		update_directory_totals( file->top_level, (long)size - file->size, 0, 0, 0 );
+		file->size = size;
+		write_blocks( index, file, 1 );
+		cache_forget( index );
+	}
+
+	free(logical);
+	free(stream);
+	free(old);
+	free(file);
+	return error;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Turns the plain data blocks of the file at block "index" into a packed stream, or the other way round
+int compress_file ( int index, bool on ) {
+	file_type *file = malloc ( BLOCK_SIZE );
+
+	memcpy( file, disk + index*BLOCK_SIZE, BLOCK_SIZE );
+	int count = file->size/BLOCK_SIZE + 1;
+	char *data = calloc( count + 2, BLOCK_SIZE );
+	int end;
+
+	if ( on ) {
+		uint16_t *length = (uint16_t *)data;
+		end = 2*count;
+		for ( int k = 0; k < count; k++ ) {
+			int block = file->data_block_index[k];
+			length[k] = pack_block( block == HOLE ? zero_block : disk + block*BLOCK_SIZE, data + end );
+			end += length[k];
+		}
+	}
+	else {
+		for ( int k = 0; k < count; k++ ) {
+			char *block = cached_block(index, k);
+			if ( block == NULL ) {
+				free(data);
+				free(file);
+				return FS_ERR_CHECKSUM;
+			}
+			memcpy( data + k*BLOCK_SIZE, block, BLOCK_SIZE );
+		}
+		end = count*BLOCK_SIZE;
+	}
+
+	int error = store_data( index, file, data, end );
+	if ( error == FS_OK ) {
+		TRACE("\t\t[%s] File [%s] Now %s in [%d] Data Blocks\n", __func__, file->name, on ? "Compressed" : "Plain", file->data_block_count );
+		file->compressed = on;
+		write_blocks( index, file, 1 );
+		cache_forget( index );
+	}
+
+	free(data);
+	free(file);
+	return error;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Makes the data blocks of the file at block "index" hold the first "bytes" of "data", which has to be padded
+//to whole blocks. Blocks are added or released at the end, and shared ones are copied first, like for any write.
+//"file" is the caller's copy of the control block; its data blocks are updated, writing it back is up to the caller.
+int store_data ( int index, file_type *file, const char *data, int bytes ) {
+	descriptor_block *descriptor = (descriptor_block *)disk;
+	char subname[MAX_STRING_LENGTH];
+
+	int count = bytes > 0 ? (bytes + BLOCK_SIZE - 1) / BLOCK_SIZE : 1;
+	int old_count = file->data_block_count;
+	int kept = count < old_count ? count : old_count;
+	int needed = count > old_count ? count - old_count : 0;
+	if ( count > MAX_FILE_DATA_BLOCKS )
+		return FS_ERR_NO_SPACE;
+	if ( count > old_count && !quota_allows(file->top_level, 0, count - old_count) )
+		return FS_ERR_QUOTA;
+
+	//The packed stream has no holes; the blocks dropped at the end may still be some
+	int error = fill_holes( index, 0, kept - 1 );
+	if ( error != FS_OK )
+		return error;
+	memcpy( file->data_block_index, ((file_type *)(disk + index*BLOCK_SIZE))->data_block_index, sizeof(int)*kept );
+	for ( int p = 0; p < kept; p++ )
+		if ( descriptor->references[file->data_block_index[p]] > 1 )
+			needed++;
+	if ( !reserve_blocks(needed) )
+		return FS_ERR_NO_SPACE;
+
+	unshare_data_blocks( index, 0, kept - 1 );
+	memcpy( file->data_block_index, ((file_type *)(disk + index*BLOCK_SIZE))->data_block_index, sizeof(int)*kept );
+
+	for ( int p = old_count; p < count; p++ ) {
+		data_block_name( subname, file->name, p );
+		file->data_block_index[p] = allocate_block(subname, false, file->data_block_index[p-1] + 1, index);
+	}
+	int released = 0;
+	for ( int p = old_count - 1; p >= count; p-- ) {
+		if ( file->data_block_index[p] == HOLE )
+			continue;
+		release_data_block( file->data_block_index[p], index );
+		released++;
+	}
+	for ( int p = 0; p < count; p++ )
+		write_blocks( file->data_block_index[p], data + p*BLOCK_SIZE, 1 );
+
+	update_directory_totals( file->top_level, 0, 0, 0, (count > old_count ? count - old_count : 0) - released );
+	file->data_block_count = count;
+	return FS_OK;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Copies "bytes" of the packed stream from "position" on, across the data blocks of the file;
+//returns false if one of the blocks does not match its checksum
+bool packed_read ( file_type *file, int position, void *buffer, int bytes ) {
+	char *to = buffer;
+
+	while ( bytes > 0 ) {
+		int within = position % BLOCK_SIZE;
+		int chunk = BLOCK_SIZE - within < bytes ? BLOCK_SIZE - within : bytes;
+		int block = file->data_block_index[position / BLOCK_SIZE];
+		if ( !checksum_valid(block) )
+			return false;
+		memcpy( to, disk + block*BLOCK_SIZE + within, chunk );
+		position += chunk;
+		to += chunk;
+		bytes -= chunk;
+	}
+	return true;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Packs one logical block into "packed", which has room for BLOCK_SIZE bytes; returns the packed length
+int pack_block ( const char *data, char *packed ) {
+	struct timespec start;
+
+	clock_gettime( CLOCK_MONOTONIC, &start );
+	int length = lz_compress( data, BLOCK_SIZE, packed, BLOCK_SIZE );
+	if ( length == -1 ) {
+		memcpy( packed, data, BLOCK_SIZE );
+		length = BLOCK_SIZE;
+	}
+	codec.pack_time += elapsed_nanoseconds(&start);
+	codec.packed++;
+	codec.raw_bytes += BLOCK_SIZE;
+	codec.packed_bytes += length;
+	return length;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+void unpack_block ( const char *packed, int length, char *data ) {
+	struct timespec start;
+
+	clock_gettime( CLOCK_MONOTONIC, &start );
+	if ( length == BLOCK_SIZE )
+		memcpy( data, packed, BLOCK_SIZE );
+	else if ( lz_decompress(packed, length, data, BLOCK_SIZE) != BLOCK_SIZE )
+		TRACE("\t\t\t[%s] Packed Block of [%d] Bytes is Damaged\n", __func__, length );
+	codec.unpack_time += elapsed_nanoseconds(&start);
+	codec.unpacked++;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Compresses "length" bytes in the manner of LZ4. Every sequence is a token byte (the literal count in the
+//high nibble, the match length - LZ_MIN_MATCH in the low one, 15 meaning more bytes follow), the literals and
+//a two byte offset back to the match; the last sequence has literals only. Returns the compressed length, or
+//-1 if it would not be shorter than "max".
+int lz_compress ( const char *in, int length, char *out, int max ) {
+	uint16_t table[1 << LZ_HASH_BITS] = { 0 };	//last position of each hashed 4 byte sequence
+	int anchor = 0, o = 0;
+	int i = 1;
+
+	while ( i + LZ_MIN_MATCH <= length ) {
+		uint32_t sequence, candidate_sequence;
+		memcpy( &sequence, in + i, 4 );
+		int h = (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+		int candidate = table[h];
+		table[h] = i;
+		memcpy( &candidate_sequence, in + candidate, 4 );
+		if ( candidate_sequence != sequence || i - candidate > 65535 ) {
+			i++;
+			continue;
+		}
+
+		int match = LZ_MIN_MATCH;
+		while ( i + match < length && in[candidate + match] == in[i + match] )
+			match++;
+		int literals = i - anchor;
+		if ( o + 1 + literals/255 + 1 + literals + 2 + (match - LZ_MIN_MATCH)/255 + 1 >= max )
+			return -1;
+
+		char *token = out + o++;
+		*token = (char)(((literals < 15 ? literals : 15) << 4) | (match - LZ_MIN_MATCH < 15 ? match - LZ_MIN_MATCH : 15));
+		if ( literals >= 15 ) {
+			int rest = literals - 15;
+			for ( ; rest >= 255; rest -= 255 ) out[o++] = (char)255;
+			out[o++] = (char)rest;
+		}
+		memcpy( out + o, in + anchor, literals );
+		o += literals;
+		out[o++] = (char)((i - candidate) & 0xFF);
+		out[o++] = (char)((i - candidate) >> 8);
+		if ( match - LZ_MIN_MATCH >= 15 ) {
+			int rest = match - LZ_MIN_MATCH - 15;
+			for ( ; rest >= 255; rest -= 255 ) out[o++] = (char)255;
+			out[o++] = (char)rest;
+		}
+		i += match;
+		anchor = i;
+	}
+
+	int literals = length - anchor;
+	if ( o + 1 + literals/255 + 1 + literals >= max )
+		return -1;
+	out[o++] = (char)((literals < 15 ? literals : 15) << 4);
+	if ( literals >= 15 ) {
+		int rest = literals - 15;
+		for ( ; rest >= 255; rest -= 255 ) out[o++] = (char)255;
+		out[o++] = (char)rest;
+	}
+	memcpy( out + o, in + anchor, literals );
+	return o + literals;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Undoes lz_compress; returns the bytes written to "out", which never exceed "max"
+int lz_decompress ( const char *in, int length, char *out, int max ) {
+	const unsigned char *from = (const unsigned char *)in;
+	int i = 0, o = 0;
+
+	while ( i < length ) {
+		int token = from[i++];
+		int literals = token >> 4;
+		if ( literals == 15 ) {
+			int extra;
+			do {
+				extra = i < length ? from[i++] : 0;
+				literals += extra;
+			} while ( extra == 255 );
+		}
+		if ( literals > length - i || literals > max - o )
+			return o;
+		memcpy( out + o, in + i, literals );
+		i += literals;
+		o += literals;
+		if ( i + 2 > length )
+			break;
+
+		int distance = from[i] | (from[i+1] << 8);
+		i += 2;
+		int match = (token & 15) + LZ_MIN_MATCH;
+		if ( (token & 15) == 15 ) {
+			int extra;
+			do {
+				extra = i < length ? from[i++] : 0;
+				match += extra;
+			} while ( extra == 255 );
+		}
+		if ( distance == 0 || distance > o || match > max - o )
+			return o;
+		//A match that overlaps what it copies repeats the last "distance" bytes; every copy doubles what can be repeated
+		while ( match > 0 ) {
+			int chunk = distance < match ? distance : match;
+			memcpy( out + o, out + o - distance, chunk );
+			o += chunk;
+			match -= chunk;
+			distance += chunk;
+		}
+	}
+	return o;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Logical block "k" of the compressed file at block "index", decompressed; only the packed bytes of that
+//block are read from the disk. The pointer stays good until the next call; NULL if a checksum does not match.
+char *cached_block ( int index, int k ) {
+	file_type *file = (file_type *)(disk + index*BLOCK_SIZE);
+	uint16_t length[MAX_FILE_DATA_BLOCKS];
+	int slot = 0;
+
+	block_cache.clock++;
+	for ( int c = 0; c < CACHE_BLOCKS; c++ ) {
+		if ( block_cache.file[c] == index && block_cache.block[c] == k ) {
+			block_cache.used[c] = block_cache.clock;
+			codec.cache_hits++;
+			return block_cache.data[c];
+		}
+		if ( block_cache.used[c] < block_cache.used[slot] )
+			slot = c;
+	}
+
+	int count = file->size/BLOCK_SIZE + 1;
+	if ( !packed_read(file, 0, length, 2*(k + 1)) )
+		return NULL;
+	int position = 2*count;
+	for ( int j = 0; j < k; j++ )
+		position += length[j];
+
+	char *packed = malloc( BLOCK_SIZE );
+	if ( !packed_read(file, position, packed, length[k]) ) {
+		free(packed);
+		return NULL;
+	}
+	unpack_block( packed, length[k], block_cache.data[slot] );
+	free(packed);
+
+	block_cache.file[slot] = index;
+	block_cache.block[slot] = k;
+	block_cache.used[slot] = block_cache.clock;
+	return block_cache.data[slot];
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Drops the cached blocks of the file at block "index"; call when its data changes, it moves or it is removed
+void cache_forget ( int index ) {
+	for ( int c = 0; c < CACHE_BLOCKS; c++ )
+		if ( block_cache.file[c] == index ) {
+			block_cache.file[c] = -1;
+			block_cache.used[c] = 0;
+		}
+}
+
+/*--------------------------------------------------------------------------------*/
+
+void cache_reset ( ) {
+	for ( int c = 0; c < CACHE_BLOCKS; c++ ) {
+		block_cache.file[c] = -1;
+		block_cache.used[c] = 0;
+	}
+}
+
+/*--------------------------------------------------------------------------------*/
+
+/************************** Checksums ************************************/
+
+//Builds the CRC tables and checks whether the CPU has the crc32 instruction
+void checksum_init ( ) {
+	for ( uint32_t n = 0; n < 256; n++ ) {
+		uint32_t crc = n;
+		for ( int bit = 0; bit < 8; bit++ )
+			crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+		crc32c.table[n] = crc;
+	}
+	//Bit 31 stands for x^0, so x^8 is bit 23
+	crc32c.shift[0] = 0x80000000u;
+	for ( int n = 0; n < BLOCK_SIZE; n++ )
+		crc32c.shift[n + 1] = crc32c_multiply( 0x00800000u, crc32c.shift[n] );
+#ifdef __x86_64__
+	crc32c.hardware = __builtin_cpu_supports("sse4.2");
+#endif
+	crc32c.zero = block_checksum( zero_block );
+}
+
+/*--------------------------------------------------------------------------------*/
+
+#ifdef __x86_64__
+//The crc32 instruction has a latency of three cycles but takes a new one every cycle, so three parts of the
+//block are run side by side and joined at the end: each part's CRC is moved past the parts behind it
+__attribute__((target("sse4.2")))
+uint32_t block_checksum_hardware ( const char *data ) {
+	const int lane = BLOCK_SIZE / 24 * 8;
+	uint64_t first = 0xFFFFFFFF, second = 0, third = 0;
+	uint64_t words[3];
+
+	for ( int i = 0; i < lane; i += 8 ) {
+		memcpy( &words[0], data + i, 8 );
+		memcpy( &words[1], data + lane + i, 8 );
+		memcpy( &words[2], data + 2*lane + i, 8 );
+		first = _mm_crc32_u64( first, words[0] );
+		second = _mm_crc32_u64( second, words[1] );
+		third = _mm_crc32_u64( third, words[2] );
+	}
+	uint32_t crc = crc32c_multiply( crc32c.shift[lane], crc32c_multiply(crc32c.shift[lane], (uint32_t)first) ^ (uint32_t)second ) ^ (uint32_t)third;
+	for ( int i = 3*lane; i < BLOCK_SIZE; i++ )
+		crc = _mm_crc32_u8( crc, (unsigned char)data[i] );
+	return ~crc;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+__attribute__((target("sse4.2")))
+uint32_t crc32c_update_hardware ( uint32_t crc, const char *data, int length ) {
+	uint64_t value = crc, word;
+	int i = 0;
+
+	for ( ; i + 8 <= length; i += 8 ) {
+		memcpy( &word, data + i, 8 );
+		value = _mm_crc32_u64( value, word );
+	}
+	for ( ; i < length; i++ )
+		value = _mm_crc32_u8( (uint32_t)value, (unsigned char)data[i] );
+	return (uint32_t)value;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+__attribute__((target("sse4.2")))
+uint32_t crc32c_delta_hardware ( uint32_t crc, const char *old, const char *new, int length ) {
+	uint64_t value = crc, a, b;
+	int i = 0;
+
+	for ( ; i + 8 <= length; i += 8 ) {
+		memcpy( &a, old + i, 8 );
+		memcpy( &b, new + i, 8 );
+		value = _mm_crc32_u64( value, a ^ b );
+	}
+	for ( ; i < length; i++ )
+		value = _mm_crc32_u8( (uint32_t)value, (unsigned char)(old[i] ^ new[i]) );
+	return (uint32_t)value;
+}
+#endif
+
+/*--------------------------------------------------------------------------------*/
+
+//CRC32C of a whole block
+uint32_t block_checksum ( const char *data ) {
+#ifdef __x86_64__
+	if ( crc32c.hardware )
+		return block_checksum_hardware( data );
+#endif
+	return ~crc32c_update( 0xFFFFFFFF, data, BLOCK_SIZE );
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Runs "length" bytes through the CRC register "crc", without the inversions before and after
+uint32_t crc32c_update ( uint32_t crc, const char *data, int length ) {
+#ifdef __x86_64__
+	if ( crc32c.hardware )
+		return crc32c_update_hardware( crc, data, length );
+#endif
+	for ( int i = 0; i < length; i++ )
+		crc = crc32c.table[(crc ^ (unsigned char)data[i]) & 0xFF] ^ (crc >> 8);
+	return crc;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Runs the bytes "old" xor "new" through the CRC register "crc"
+uint32_t crc32c_delta ( uint32_t crc, const char *old, const char *new, int length ) {
+#ifdef __x86_64__
+	if ( crc32c.hardware )
+		return crc32c_delta_hardware( crc, old, new, length );
+#endif
+	for ( int i = 0; i < length; i++ )
+		crc = crc32c.table[(crc ^ (unsigned char)(old[i] ^ new[i])) & 0xFF] ^ (crc >> 8);
+	return crc;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Product of two polynomials modulo the CRC polynomial, bit reversed like the CRC itself
+uint32_t crc32c_multiply ( uint32_t a, uint32_t b ) {
+	uint32_t product = 0;
+
+	for ( uint32_t m = 0x80000000u; m != 0; m >>= 1 ) {
+		if ( a & m )
+			product ^= b;
+		b = b & 1 ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+	}
+	return product;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//True if block "index" still matches its checksum; the descriptor blocks are not checked
+bool checksum_valid ( int index ) {
+	descriptor_block *descriptor = (descriptor_block *)disk;
+
+	if ( index < DESCRIPTOR_BLOCKS || block_checksum(disk + index*BLOCK_SIZE) == descriptor->checksum[index] )
+		return true;
+	TRACE("\t\t\t[%s] Memory Block [%d] [%s] Does Not Match Its Checksum\n", __func__, index, descriptor->name[index] );
+	return false;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Computes the checksum of block "index" from what it holds now; call after it was filled in place
+void checksum_update ( int index ) {
+	if ( index >= DESCRIPTOR_BLOCKS )
+		checksum_set( index, block_checksum(disk + index*BLOCK_SIZE) );
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Call before bytes "offset" up to "offset + length" of block "index" change from "old" to "new".
+//The CRC is linear, so the new checksum is the old one xor the CRC of old xor new over the whole block.
+//That CRC only grows where bytes change: a run of equal words just moves it along by one multiplication,
+//so the cost follows the bytes that really change. A block that was damaged keeps failing its check.
+void checksum_write ( int index, const char *old, const char *new, int offset, int length ) {
+	descriptor_block *descriptor = (descriptor_block *)disk;
+	uint32_t delta = 0;
+	int end = 0;		//end of the last run of changed words
+	int i;
+	uint64_t a, b;
+
+	if ( index < DESCRIPTOR_BLOCKS )
+		return;
+	for ( i = first_change(old, new, 0, length); i + 8 <= length; i = first_change(old, new, end, length) ) {
+		int run = i + 8;
+		for ( ; run + 8 <= length; run += 8 ) {
+			memcpy( &a, old + run, 8 );
+			memcpy( &b, new + run, 8 );
+			if ( a == b )
+				break;
+		}
+		if ( delta != 0 && i > end )
+			delta = crc32c_multiply( crc32c.shift[i - end], delta );
+		delta = crc32c_delta( delta, old + i, new + i, run - i );
+		end = run;
+	}
+	//Less than a word left at the end
+	if ( i < length ) {
+		if ( delta != 0 && i > end )
+			delta = crc32c_multiply( crc32c.shift[i - end], delta );
+		delta = crc32c_delta( delta, old + i, new + i, length - i );
+		end = length;
+	}
+	if ( delta != 0 )
+		checksum_set( index, descriptor->checksum[index] ^ crc32c_multiply(crc32c.shift[BLOCK_SIZE - offset - end], delta) );
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Position of the first 8 byte word from "from" on in which "old" and "new" differ; if there is none,
+//the position where less than a word is left. Equal bytes are skipped 64 at a time.
+int first_change ( const char *old, const char *new, int from, int length ) {
+	uint64_t a, b;
+
+#ifdef __SSE2__
+	for ( ; from + 64 <= length; from += 64 ) {
+		__m128i same = _mm_cmpeq_epi8( _mm_loadu_si128((__m128i *)(old + from)), _mm_loadu_si128((__m128i *)(new + from)) );
+		for ( int k = 16; k < 64; k += 16 )
+			same = _mm_and_si128( same, _mm_cmpeq_epi8(_mm_loadu_si128((__m128i *)(old + from + k)), _mm_loadu_si128((__m128i *)(new + from + k))) );
+		if ( _mm_movemask_epi8(same) != 0xFFFF )
+			break;
+	}
+#endif
+	for ( ; from + 8 <= length; from += 8 ) {
+		memcpy( &a, old + from, 8 );
+		memcpy( &b, new + from, 8 );
+		if ( a != b )
+			break;
 	}
+	return from;
+}
 
-	//Go through again if there is a subdirectory
-	for( int i = 0; i < folder->subitem_count; i++ ) {
-		if( folder->subitem_type[i] == true ) {
-			//Recursively call the function! can be improved further ;)
-			printing(folder->subitem[i]);
+/*--------------------------------------------------------------------------------*/
+
+//The checksums lie in the descriptor, so a snapshot has to see the old one first
+void checksum_set ( int index, uint32_t checksum ) {
+	descriptor_block *descriptor = (descriptor_block *)disk;
+	size_t position = offsetof(descriptor_block, checksum) + (size_t)index*sizeof(uint32_t);
+
+	snapshot_preserve( position / BLOCK_SIZE );
+	snapshot_preserve( (position + sizeof(uint32_t) - 1) / BLOCK_SIZE );
+	descriptor->checksum[index] = checksum;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Runs the scrub pass for at most "budget" microseconds; returns true once every block in use has been checked.
+//In the background only as many blocks are checked as the rate allows since the pass started; a slice
+//that is ahead of the rate sleeps for the rest of its budget instead of spinning.
+bool scrub_step ( long budget ) {
+	descriptor_block *descriptor = (descriptor_block *)disk;
+	struct timespec start;
+
+	clock_gettime( CLOCK_MONOTONIC, &start );
+	while ( scrub.cursor < BLOCKS && elapsed_microseconds(&start) < budget ) {
+		if ( scrub.rate > 0 && scrub.checked >= elapsed_microseconds(&scrub.start) * scrub.rate / 1000000 ) {
+			long left = budget - elapsed_microseconds(&start);
+			struct timespec pause = { 0, (left > 0 ? left : 0) * 1000 };
+			nanosleep( &pause, NULL );
+			break;
+		}
+		int i = scrub.cursor++;
+		if ( descriptor->free[i] || i < DESCRIPTOR_BLOCKS )
+			continue;
+		scrub.checked++;
+		if ( !checksum_valid(i) ) {
+			scrub.errors++;
+			fprintf(output, "scrub: block %d [%s] does not match its checksum\n", i, descriptor->name[i]);
 		}
 	}
+	return scrub.cursor == BLOCKS;
 }
 
 /*--------------------------------------------------------------------------------*/
 
-//Displays the content of the descriptor block and free block table.
-void print_descriptor ( ) {
-	descriptor_block *descriptor = malloc( BLOCK_SIZE*2 );
+void scrub_finish ( ) {
+	fprintf(output, "scrub: %d blocks checked, %d checksum errors\n", scrub.checked, scrub.errors);
+}
+
+/*--------------------------------------------------------------------------------*/
 
-	memcpy ( descriptor, disk, BLOCK_SIZE*2 );
+/************************** Reclaim ************************************/
 
-	printf("Disk Descriptor Free Table:\n");
-	
-	for ( int i = 0; i < BLOCKS ; i++ ) {
-		printf("\tIndex %d : %d\n", i, descriptor->free[i]);
+//Takes the entry at block "index" out of the name space and leaves its blocks to the reclaim task.
+//Everything below a directory goes with it, as entries are found by name; only control blocks are
+//touched, so the data blocks of the files cost nothing here.
+void orphan_entry ( int index ) {
+	descriptor_block *descriptor = (descriptor_block *)disk;
+
+	if ( descriptor->directory[index] ) {
+		dir_type *folder = (dir_type *)(disk + index*BLOCK_SIZE);
+		for ( int i = 0; i < folder->subitem_count; i++ ) {
+			int child = find_block(folder->subitem[i], folder->subitem_type[i]);
+			if ( child != -1 )
+				orphan_entry(child);
+		}
+		if ( changes.count > 0 )
+			watches_move(index, -1);
+		if ( folder->quota_blocks > 0 || folder->quota_entries > 0 )
+			quota_directories--;
+		reclaim.pending++;
+	}
+	else {
+		if ( open_files.references[index] > 0 )
+			open_files_move(index, -1);
+		reclaim.pending += 1 + file_blocks((file_type *)(disk + index*BLOCK_SIZE));
+	}
+	edit_descriptor_name( index, REMOVED_NAME );
+
+	if ( !tasks[3].active ) {
+		tasks[3].active = true;
+		reclaim.released = 0;
+		clock_gettime( CLOCK_MONOTONIC, &reclaim.start );
 	}
-	
-	free(descriptor);
 }
 
 /*--------------------------------------------------------------------------------*/
 
-//finds the first free block on the disk; the free block index is returned
-int allocate_block ( char *name, bool directory ) { 
+//Releases at most "max" blocks of removed entries and returns how many it released.
+//A file gives its data blocks up from the last one, so a file left half done is still a valid file.
+int reclaim_blocks ( int max ) {
+	descriptor_block *descriptor = (descriptor_block *)disk;
+	file_type *file = malloc ( BLOCK_SIZE );
+	int released = 0;
 
-	descriptor_block *descriptor = malloc( BLOCK_SIZE*2);
+	while ( released < max && reclaim.pending > 0 ) {
+		int n = 0;
+		while ( n < BLOCKS && (descriptor->free[reclaim.cursor] || strcmp(descriptor->name[reclaim.cursor], REMOVED_NAME) != 0) ) {
+			reclaim.cursor = (reclaim.cursor + 1) % BLOCKS;
+			n++;
+		}
+		if ( n == BLOCKS ) {
+			reclaim.pending = 0;	//nothing is left to release, whatever the count said
+			break;
+		}
 
-	memcpy ( descriptor, disk, BLOCK_SIZE*2 );
-	
-	//Goes through every block until free one is found	
-	if ( debug ) printf("\t\t\t[%s] Finding Free Memory Block in the Descriptor\n", __func__ );
+		int index = reclaim.cursor;
+		if ( !descriptor->directory[index] ) {
+			memcpy( file, disk + index*BLOCK_SIZE, BLOCK_SIZE );
+			int count = released;
+			while ( file->data_block_count > 0 && released < max ) {
+				int block = file->data_block_index[--file->data_block_count];
+				if ( block == HOLE )
+					continue;
+				release_data_block( block, index );
+				released++;
+			}
+			reclaim.pending -= released - count;
+			if ( file->data_block_count > 0 || released == max ) {
+				write_blocks( index, file, 1 );
+				break;
+			}
+		}
+		unallocate_block(index);
+		reclaim.pending--;
+		released++;
+	}
+	TRACE("\t\t[%s] Released [%d] Memory Blocks, [%d] Still Pending\n", __func__, released, reclaim.pending );
+
+	free(file);
+	return released;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Works out the blocks removed entries hold from the descriptor, for a disk that was rolled back
+void reclaim_count ( ) {
+	descriptor_block *descriptor = (descriptor_block *)disk;
+
+	reclaim.pending = 0;
 	for ( int i = 0; i < BLOCKS; i++ ) {
-		 if ( descriptor->free[i] ) {
-		 	//Once free block is found, update descriptor information
-			descriptor->free[i] = false;
-			descriptor->directory[i] = directory;
-			strcpy(descriptor->name[i], name);
-			
-			//update descriptor back to the beginning of the disk
-			memcpy(disk, descriptor, BLOCK_SIZE*2);
-				if ( debug ) printf("\t\t\t[%s] Allocated [%s] at Memory Block [%d]\n", __func__, name, i );
+		if ( descriptor->free[i] || strcmp(descriptor->name[i], REMOVED_NAME) != 0 )
+			continue;
+		reclaim.pending++;
+		if ( !descriptor->directory[i] )
+			reclaim.pending += file_blocks((file_type *)(disk + i*BLOCK_SIZE));
+	}
+	tasks[3].active = reclaim.pending > 0;
+	reclaim.released = 0;
+	clock_gettime( CLOCK_MONOTONIC, &reclaim.start );
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Counts the blocks that are free once every removed entry is reclaimed: their own blocks, and the data
+//blocks that no file still in the tree shares with them
+int reclaim_freeable ( ) {
+	descriptor_block *descriptor = (descriptor_block *)disk;
+	int *listed = calloc( BLOCKS, sizeof(int) );
+	int freeable = 0;
+
+	for ( int i = 0; i < BLOCKS; i++ ) {
+		if ( descriptor->free[i] || strcmp(descriptor->name[i], REMOVED_NAME) != 0 )
+			continue;
+		freeable++;
+		if ( descriptor->directory[i] )
+			continue;
+		file_type *file = (file_type *)(disk + i*BLOCK_SIZE);
+		for ( int k = 0; k < file->data_block_count; k++ )
+			if ( file->data_block_index[k] != HOLE && ++listed[file->data_block_index[k]] == descriptor->references[file->data_block_index[k]] )
+				freeable++;
+	}
+
+	free(listed);
+	return freeable;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//True once "count" blocks are free; what removed entries hold is released right away if it is needed
+bool reserve_blocks ( int count ) {
+	descriptor_block *descriptor = (descriptor_block *)disk;
 
-			free(descriptor);
-			return i; 
+	while ( descriptor->free_blocks < count && reclaim.pending > 0 )
+		reclaim_blocks( count - descriptor->free_blocks );
+	return descriptor->free_blocks >= count;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Releases blocks of removed entries for at most "budget" microseconds; returns true once none are left.
+//Batches go out at RECLAIM_RATE blocks per second, the first one right away; a slice that is ahead
+//of the rate sleeps for the rest of its budget.
+bool reclaim_step ( long budget ) {
+	struct timespec start;
+
+	clock_gettime( CLOCK_MONOTONIC, &start );
+	while ( reclaim.pending > 0 && elapsed_microseconds(&start) < budget ) {
+		long allowed = RECLAIM_BATCH + elapsed_microseconds(&reclaim.start) * RECLAIM_RATE / 1000000 - reclaim.released;
+		if ( allowed <= 0 ) {
+			long left = budget - elapsed_microseconds(&start);
+			struct timespec pause = { 0, (left > 0 ? left : 0) * 1000 };
+			nanosleep( &pause, NULL );
+			break;
 		}
+		reclaim.released += reclaim_blocks( allowed < RECLAIM_BATCH ? allowed : RECLAIM_BATCH );
 	}
-	free(descriptor);
-	if ( debug ) printf("\t\t\t[%s] No Free Space Found: Returning -1\n", __func__);
-	return -1;
+	return reclaim.pending == 0;
 }
 
 /*--------------------------------------------------------------------------------*/
 
-//updates the descriptor block on disk to reflect that the block is no longer in use. 
-void unallocate_block ( int offset ) { 
-	descriptor_block *descriptor = malloc( BLOCK_SIZE*2 );
-	
-	memcpy ( descriptor, disk, BLOCK_SIZE*2 );
-	
-	//TODO: check if the block holds a file, and then unallocate all its sub-block
-	if ( debug ) printf("\t\t\t[%s] Unallocating Memory Block [%d]\n", __func__, offset );
-	descriptor->free[offset] = true;
-	strcpy( descriptor->name[offset], "" );
+//Reclaiming starts by itself, so it finishes without a report
+void reclaim_finish ( ) {
+	TRACE("\t[%s] Released [%ld] Memory Blocks\n", __func__, reclaim.released );
+}
 
-	memcpy ( disk, descriptor, BLOCK_SIZE*2 );	
-	
-	free(descriptor);
+/*--------------------------------------------------------------------------------*/
+
+/************************** Change Feed ************************************/
+
+//Publishes an event about "name" in the directory "parent" to the watches that see it: those on the
+//directory itself, and those on a directory above it that include their subtree. "parent" is "" for
+//an event every watch sees. With no watch in use this returns at once.
+void publish_change ( int type, char *parent, char *name, char *new_name, bool directory, long size ) {
+	int parent_block = -1;
+	uint64_t watches = 0;
+
+	if ( changes.count == 0 )
+		return;
+	if ( strcmp(parent, "") == 0 )
+		watches = ~(uint64_t)0;
+	else {
+		//The directory and its ancestors, nearest first
+		int path[BLOCKS];
+		int depth = 0;
+		char above[MAX_STRING_LENGTH];
+		strcpy( above, parent );
+		while ( strcmp(above, "") != 0 && depth < BLOCKS ) {
+			int block_index = find_block(above, true);
+			if ( block_index == -1 )
+				break;
+			path[depth++] = block_index;
+			strcpy( above, ((dir_type *)(disk + block_index*BLOCK_SIZE))->top_level );
+		}
+		if ( depth == 0 )
+			return;
+		parent_block = path[0];
+
+		for ( int w = 0; w < MAX_WATCHES; w++ ) {
+			if ( !changes.used[w] || changes.block[w] == -1 )
+				continue;
+			for ( int d = 0; d < (changes.subtree[w] ? depth : 1); d++ )
+				if ( path[d] == changes.block[w] ) {
+					watches |= (uint64_t)1 << w;
+					break;
+				}
+		}
+		if ( watches == 0 )
+			return;
+	}
+
+	//Mark the slot as being written before touching it, and publish its sequence once it is complete
+	unsigned long sequence = changes.published + 1;
+	change_slot *slot = &changes.slot[sequence % CHANGE_EVENTS];
+	__atomic_store_n( &slot->sequence, 0, __ATOMIC_RELAXED );
+	__atomic_thread_fence( __ATOMIC_RELEASE );
+	slot->watches = watches;
+	slot->event.sequence = sequence;
+	slot->event.type = type;
+	slot->event.parent = parent_block;
+	slot->event.directory = directory;
+	snprintf( slot->event.name, FS_NAME_LENGTH, "%s", name );
+	snprintf( slot->event.new_name, FS_NAME_LENGTH, "%s", new_name );
+	slot->event.size = size;
+	__atomic_store_n( &slot->sequence, sequence, __ATOMIC_RELEASE );
+	__atomic_store_n( &changes.published, sequence, __ATOMIC_RELEASE );
 }
 
 /*--------------------------------------------------------------------------------*/
 
-//Takes in a name, and searches through descriptor block to find the block that contains the item
-int find_block ( char *name, bool directory ) {
+//Points the watches on directory block "from" at block "to"; "to" is -1 when the directory is removed
+void watches_move ( int from, int to ) {
+	for ( int w = 0; w < MAX_WATCHES; w++ )
+		if ( changes.used[w] && changes.block[w] == from )
+			changes.block[w] = to;
+}
 
-	descriptor_block *descriptor = malloc( BLOCK_SIZE*2 );
+/*--------------------------------------------------------------------------------*/
 
-	memcpy ( descriptor, disk, BLOCK_SIZE*2 );
-	
-	if ( debug ) printf("\t\t\t[%s] Searching Descriptor for [%s], which is a [%s]\n", __func__, name, directory == true ? "Folder": "File" );
-	for ( int i = 0; i < BLOCKS; i++ ) {
-		if ( strcmp(descriptor->name[i], name) ==0 ){
-			//Make sure it is of the type that we are searching for
-			if ( descriptor->directory[i] == directory ) {
-				if ( debug ) printf("\t\t\t[%s] Found [%s] at Memory Block [%d]\n", __func__, name, i );
-				free(descriptor);
-				//Return the block index where the item resides in memory
-				return i;
+//Watches "name", a directory in the working directory ("." is the working directory itself), and with
+//"subtree" every directory below it too; the watch sees the events published from now on
+int fs_watch ( fs_handle *fs, char *name, bool subtree ) {
+	bool directory = true;
+
+	if ( disk_allocated == false )
+		return FS_ERR_NO_DISK;
+	enter(fs);
+
+	int block_index = strcmp(name, ".") == 0 ? find_block(current.directory, true) : find_entry(name, &directory);
+	leave(fs);
+	if ( block_index == -1 )
+		return FS_ERR_NOT_FOUND;
+	if ( !directory )
+		return FS_ERR_NOT_DIRECTORY;
+
+	for ( int w = 0; w < MAX_WATCHES; w++ ) {
+		if ( changes.used[w] )
+			continue;
+		changes.used[w] = true;
+		changes.block[w] = block_index;
+		changes.subtree[w] = subtree;
+		changes.next[w] = changes.published + 1;
+		changes.count++;
+		return w;
+	}
+	return FS_ERR_TOO_MANY_OPEN;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+int fs_unwatch ( int watch ) {
+	if ( watch < 0 || watch >= MAX_WATCHES || !changes.used[watch] )
+		return FS_ERR_BAD_DESCRIPTOR;
+	changes.used[watch] = false;
+	changes.count--;
+	return FS_OK;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Reads at most "max" of the watch's new events. The ring is walked from where the watch left off, so a
+//read costs the events published since the last one, whatever the size of the tree.
+int fs_watch_read ( int watch, fs_event *events, int max ) {
+	if ( watch < 0 || watch >= MAX_WATCHES || !changes.used[watch] )
+		return FS_ERR_BAD_DESCRIPTOR;
+	if ( max < 0 )
+		return FS_ERR_INVALID;
+
+	unsigned long published = __atomic_load_n( &changes.published, __ATOMIC_ACQUIRE );
+	unsigned long sequence = changes.next[watch];
+	bool lost = published >= sequence && published - sequence >= CHANGE_EVENTS;
+	int count = 0;
+
+	while ( !lost && count < max && sequence <= published ) {
+		change_slot *slot = &changes.slot[sequence % CHANGE_EVENTS];
+		if ( __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != sequence ) {
+			lost = true;
+			break;
+		}
+		uint64_t watches = slot->watches;
+		events[count] = slot->event;
+		__atomic_thread_fence( __ATOMIC_ACQUIRE );
+		if ( __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) != sequence ) {
+			lost = true;
+			break;
+		}
+		if ( watches & (uint64_t)1 << watch )
+			count++;
+		sequence++;
+	}
+
+	//Go on with the events published from now on
+	if ( lost ) {
+		changes.next[watch] = __atomic_load_n( &changes.published, __ATOMIC_ACQUIRE ) + 1;
+		TRACE("\t[%s] Watch [%d] Overflowed\n", __func__, watch );
+		return FS_ERR_OVERFLOW;
+	}
+	changes.next[watch] = sequence;
+	if ( count == 0 && changes.block[watch] == -1 )
+		return FS_ERR_NOT_FOUND;
+	return count;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+/************************** Batches ************************************/
+
+//Creates the entries of "ops" in one pass: everything is checked first, so the batch either fails as a whole
+//without a change or goes through. Then the entries are sorted by parent; each parent is read and written
+//once, its totals are updated once, and the control blocks of its files are placed in one free run.
+int fs_batch ( fs_handle *fs, const fs_batch_op *ops, int count, int *failed ) {
+	int failed_op = -1;
+
+	if ( disk_allocated == false )
+		return FS_ERR_NO_DISK;
+	if ( count < 0 || (count > 0 && ops == NULL) )
+		return FS_ERR_INVALID;
+	if ( failed == NULL )
+		failed = &failed_op;
+	*failed = -1;
+	if ( count == 0 )
+		return FS_OK;
+	enter(fs);
+
+	batch_entry *entries = malloc( sizeof(batch_entry)*count );
+	int error = batch_check( entries, ops, count, failed );
+	if ( error != FS_OK ) {
+		free(entries);
+		leave(fs);
+		return error;
+	}
+
+	//A group is the entries of one parent; parents made by the batch sort ahead of their entries by depth
+	working_directory saved = current;
+	for ( int first = 0, last; first < count; first = last ) {
+		for ( last = first + 1; last < count && strcmp(entries[last].parent, entries[first].parent) == 0; last++ )
+			;
+		batch_apply( entries, ops, first, last );
+	}
+
+	//Files in a compressing directory are packed like those of fs_mkfile, which is the one step that can fail;
+	//then every entry made is taken out again, those deepest down first
+	for ( int e = 0; e < count && error == FS_OK; e++ ) {
+		dir_type *folder = (dir_type *)(disk + find_block(entries[e].parent, true)*BLOCK_SIZE);
+		if ( entries[e].directory || !folder->compress )
+			continue;
+		error = compress_file( entries[e].block, true );
+		if ( error == FS_OK )
+			error = resize_file( entries[e].block, ops[entries[e].op].size );
+		if ( error != FS_OK )
+			*failed = entries[e].op;
+	}
+	if ( error != FS_OK ) {
+		for ( int e = count - 1; e >= 0; e-- ) {
+			strcpy( current.directory, entries[e].parent );
+			unlink_entry( entries[e].name, entries[e].block, entries[e].directory );
+		}
+		TRACE("\t[%s] Batch of [%d] Operations Undone\n", __func__, count );
+	}
+	else
+		for ( int e = 0; e < count; e++ )
+			publish_change( FS_EVENT_CREATE, entries[e].parent, entries[e].name, "", entries[e].directory,
+				entries[e].directory ? 0 : ops[entries[e].op].size );
+	current = saved;
+
+	free(entries);
+	leave(fs);
+	return error;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Checks every operation of a batch without changing anything and fills "entries" in the order they are applied.
+//Names are checked against the disk and against each other, and space, quotas and directory sizes for the
+//batch as a whole.
+int batch_check ( batch_entry *entries, const fs_batch_op *ops, int count, int *failed ) {
+	int *made = malloc( sizeof(int)*count );	//the directories of the batch, sorted by name
+	int made_count = 0;
+	int error = FS_OK;
+
+	for ( int i = 0; i < count; i++ )
+		if ( ops[i].type == FS_BATCH_MKDIR && ops[i].name != NULL && valid_name(ops[i].name) )
+			made[made_count++] = i;
+	batch_sorting = ops;
+	qsort( made, made_count, sizeof(int), compare_batch_names );
+
+	for ( int i = 0; i < count && error == FS_OK; i++ ) {
+		const fs_batch_op *op = &ops[i];
+		batch_entry *entry = &entries[i];
+		char *parent = op->parent == NULL || strcmp(op->parent, "") == 0 || strcmp(op->parent, ".") == 0 ? current.directory : op->parent;
+
+		*failed = i;
+		if ( (op->type != FS_BATCH_MKDIR && op->type != FS_BATCH_MKFILE) || op->name == NULL || !valid_name(op->name)
+			|| strlen(parent) >= MAX_STRING_LENGTH || (op->type == FS_BATCH_MKFILE && op->size < 0) ) {
+			error = FS_ERR_INVALID;
+			break;
+		}
+		if ( op->type == FS_BATCH_MKFILE && op->size/BLOCK_SIZE + 1 > MAX_FILE_DATA_BLOCKS ) {
+			error = FS_ERR_NO_SPACE;
+			break;
+		}
+		entry->op = i;
+		strcpy( entry->parent, parent );
+		strcpy( entry->name, op->name );
+		entry->directory = op->type == FS_BATCH_MKDIR;
+		entry->maker = -1;
+		entry->depth = 0;
+		entry->block = -1;
+
+		//The parent is on the disk or made by an earlier op
+		int parent_block = find_block(parent, true);
+		if ( parent_block == -1 ) {
+			int low = 0, high = made_count;
+			while ( low < high ) {
+				int middle = (low + high) / 2;
+				if ( strcmp(ops[made[middle]].name, parent) < 0 )
+					low = middle + 1;
+				else
+					high = middle;
 			}
+			if ( low == made_count || strcmp(ops[made[low]].name, parent) != 0 || made[low] >= i ) {
+				error = FS_ERR_NOT_FOUND;
+				break;
+			}
+			entry->maker = made[low];
+			entry->depth = entries[made[low]].depth + 1;
+		}
+		else {
+			dir_type *folder = (dir_type *)(disk + parent_block*BLOCK_SIZE);
+			for ( int k = 0; k < folder->subitem_count && error == FS_OK; k++ )
+				if ( strcmp(folder->subitem[k], op->name) == 0 )
+					error = FS_ERR_EXISTS;
 		}
+		if ( entry->directory && find_block(op->name, true) != -1 )
+			error = FS_ERR_EXISTS;
 	}
-	
-	free(descriptor);
-	if ( debug ) printf("\t\t\t[%s] Block Not Found: Returning -1\n", __func__);
-	return -1;
+	for ( int m = 1; m < made_count && error == FS_OK; m++ )
+		if ( strcmp(ops[made[m - 1]].name, ops[made[m]].name) == 0 ) {
+			*failed = made[m - 1] > made[m] ? made[m - 1] : made[m];
+			error = FS_ERR_EXISTS;
+		}
+	free(made);
+	if ( error != FS_OK )
+		return error;
+
+	//Grouped by parent, the names of a group sorted, which also brings doubles next to each other
+	qsort( entries, count, sizeof(batch_entry), compare_batch_entries );
+	int blocks = count;
+	for ( int first = 0, last; first < count; first = last ) {
+		for ( last = first + 1; last < count && strcmp(entries[last].parent, entries[first].parent) == 0; last++ ) {
+			if ( strcmp(entries[last].name, entries[last - 1].name) == 0 ) {
+				*failed = entries[last].op > entries[last - 1].op ? entries[last].op : entries[last - 1].op;
+				return FS_ERR_EXISTS;
+			}
+		}
+		int used = 0;
+		if ( entries[first].maker == -1 ) {
+			dir_type *folder = (dir_type *)(disk + find_block(entries[first].parent, true)*BLOCK_SIZE);
+			used = folder->subitem_count;
+			if ( folder->compress )
+				for ( int e = first; e < last; e++ )
+					blocks += !entries[e].directory;	//the packed data, as in fs_mkfile
+		}
+		if ( used + last - first > MAX_SUBDIRECTORIES ) {
+			*failed = entries[first + MAX_SUBDIRECTORIES - used].op;
+			return FS_ERR_FULL;
+		}
+	}
+
+	//Every entry adds one entry and one block to each directory on the disk above it, a file in a compressing
+	//directory one more block for its packed data
+	*failed = -1;
+	if ( quota_directories > 0 ) {
+		int *added = calloc( BLOCKS, sizeof(int) );
+		int *added_blocks = calloc( BLOCKS, sizeof(int) );
+		int *position = malloc( sizeof(int)*count );	//of each op in "entries"
+		for ( int e = 0; e < count; e++ )
+			position[entries[e].op] = e;
+		for ( int e = 0; e < count; e++ ) {
+			int root = e;
+			while ( entries[root].maker != -1 )
+				root = position[entries[root].maker];
+			int block = find_block(entries[root].parent, true);
+			added[block]++;
+			added_blocks[block] += 1 + (entries[e].maker == -1 && !entries[e].directory && ((dir_type *)(disk + block*BLOCK_SIZE))->compress);
+		}
+		free(position);
+		int *total = calloc( BLOCKS, sizeof(int) );
+		int *total_blocks = calloc( BLOCKS, sizeof(int) );
+		for ( int b = 0; b < BLOCKS; b++ ) {
+			for ( int above = added[b] > 0 ? b : -1; above != -1; ) {
+				total[above] += added[b];
+				total_blocks[above] += added_blocks[b];
+				above = find_block(((dir_type *)(disk + above*BLOCK_SIZE))->top_level, true);
+			}
+		}
+		for ( int b = 0; b < BLOCKS && error == FS_OK; b++ ) {
+			dir_type *folder = (dir_type *)(disk + b*BLOCK_SIZE);
+			if ( total[b] > 0 && ((folder->quota_blocks > 0 && folder->total_blocks + total_blocks[b] > folder->quota_blocks)
+				|| (folder->quota_entries > 0 && folder->total_entries + total[b] > folder->quota_entries)) )
+				error = FS_ERR_QUOTA;
+		}
+		free(added);
+		free(added_blocks);
+		free(total);
+		free(total_blocks);
+		if ( error != FS_OK )
+			return error;
+	}
+	if ( !reserve_blocks(blocks) )
+		return FS_ERR_NO_SPACE;
+	return FS_OK;
 }
 
 /*--------------------------------------------------------------------------------*/
 
-int add_descriptor ( char * name ) {
-	//Allocate memory to a descriptor_block type so that we start assigning values to its members.
-	descriptor_block *descriptor = malloc( BLOCK_SIZE*2);
-		if ( debug ) printf("\t\t[%s] Allocating Space for Descriptor Block\n", __func__);
-	
-	//Allocate memory to the array of strings within the descriptor block, which holds the name of each block
-	descriptor->name = malloc ( sizeof*name*BLOCKS );
-		if ( debug ) printf("\t\t[%s] Allocating Space for Descriptor's Name Member\n", __func__);
-	
-	//initialize each block ==> that it is free
-	if ( debug ) printf("\t\t[%s] Initializing Descriptor to Have All of Memory Available\n", __func__);
-	for (int i = 0; i < BLOCKS; i++ ) {
-		descriptor->free[i] = true;
-		descriptor->directory[i] = false;
+//Places the entries "first" up to "last" (exclusive), which share a parent, and then writes the parent once
+void batch_apply ( batch_entry *entries, const fs_batch_op *ops, int first, int last ) {
+	descriptor_block *descriptor = (descriptor_block *)disk;
+	dir_type *folder = malloc ( BLOCK_SIZE );
+	long bytes = 0;
+	int files = 0;
+
+	strcpy( current.directory, entries[first].parent );
+	int parent_block = find_block(current.directory, true);
+	memcpy( folder, disk + parent_block*BLOCK_SIZE, BLOCK_SIZE );
+
+	for ( int e = first; e < last; e++ )
+		files += !entries[e].directory;
+	int goal = find_free_run(descriptor, parent_block, files);
+	if ( goal == -1 )
+		goal = parent_block;
+
+	for ( int e = first; e < last; e++ ) {
+		batch_entry *entry = &entries[e];
+		if ( entry->directory )
+			entry->block = place_directory( entry->name );
+		else {
+			//A compressing directory gets its files empty; fs_batch packs and sizes them afterwards
+			int size = folder->compress ? 0 : ops[entry->op].size;
+			entry->block = place_file( entry->name, size, goal );
+			goal = entry->block + 1;
+			bytes += size;
+		}
+		strcpy( folder->subitem[folder->subitem_count], entry->name );
+		folder->subitem_type[folder->subitem_count] = entry->directory;
+		folder->subitem_count++;
 	}
+	write_blocks( parent_block, folder, 1 );
+	update_directory_totals( current.directory, bytes, files, last - first, last - first );
+	TRACE("\t\t[%s] Placed [%d] Entries in Directory [%s]\n", __func__, last - first, current.directory );
+	free(folder);
+}
 
-	//descriptor occupied space on the disk 
-	int limit = (int)(sizeof(descriptor_block)/BLOCK_SIZE) + 1;
-	
-	if ( debug ) printf("\t\t[%s] Updating Descriptor to Show that first [%d] Memory Blocks Are Taken\n", __func__, limit+1);
-	for ( int i = 0; i < limit; i ++ ) {
-		descriptor->free[i]= false; //marking space occupied by descriptor as used
+/*--------------------------------------------------------------------------------*/
+
+//By depth first, so that a directory of the batch is placed before its entries, then by parent and name
+int compare_batch_entries ( const void *a, const void *b ) {
+	const batch_entry *x = a, *y = b;
+
+	if ( x->depth != y->depth )
+		return x->depth - y->depth;
+	int order = strcmp( x->parent, y->parent );
+	return order != 0 ? order : strcmp( x->name, y->name );
+}
+
+/*--------------------------------------------------------------------------------*/
+
+int compare_batch_names ( const void *a, const void *b ) {
+	int order = strcmp( batch_sorting[*(int *)a].name, batch_sorting[*(int *)b].name );
+
+	return order != 0 ? order : *(int *)a - *(int *)b;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Adds an operation to the batch "batch begin" opened; the entry goes into the directory of "batch in"
+int batch_queue ( int type, char *name, int size ) {
+	if ( !valid_name(name) || size < 0 )
+		return FS_ERR_INVALID;
+	if ( batch.count == batch.capacity ) {
+		batch.capacity = batch.capacity == 0 ? 64 : batch.capacity * 2;
+		batch.ops = realloc( batch.ops, sizeof(fs_batch_op)*batch.capacity );
+		batch.names = realloc( batch.names, sizeof(*batch.names)*batch.capacity );
 	}
-	
-	strcpy(descriptor->name[0], "descriptor"); 	
-	
-	//writing new updated descriptor to the beginning of the disk
-	//may encounter error here, to be fixed
-	memcpy ( disk, descriptor, (BLOCK_SIZE*(limit+1)));
+	snprintf( batch.names[batch.count][0], MAX_STRING_LENGTH, "%s", batch.parent );
+	snprintf( batch.names[batch.count][1], MAX_STRING_LENGTH, "%s", name );
+	batch.ops[batch.count].type = type;
+	batch.ops[batch.count].size = size;
+	batch.count++;
+	return FS_OK;
+}
 
-	return 0;	
+/*--------------------------------------------------------------------------------*/
+
+/************************** Images ************************************/
+
+//Writes the directory "name" and everything below it to "path" as an image. The node table is built breadth
+//first in memory, each directory's children sorted once they are all appended; then the file data is written
+//from data_offset on in table order, and the header and the table in front of it last, once the data is known.
+int fs_export ( fs_handle *fs, char *name, const char *path ) {
+	bool directory = true;
+
+	if ( disk_allocated == false )
+		return FS_ERR_NO_DISK;
+	enter(fs);
+
+	int block_index = strcmp(name, ".") == 0 ? find_block(current.directory, true) : find_entry(name, &directory);
+	leave(fs);
+	if ( block_index == -1 )
+		return FS_ERR_NOT_FOUND;
+	if ( !directory )
+		return FS_ERR_NOT_DIRECTORY;
+
+	//Until the data is written, the offset of a node holds its control block
+	dir_type *top = (dir_type *)(disk + block_index*BLOCK_SIZE);
+	int capacity = top->total_entries > 0 ? top->total_entries : 1;
+	fs_image_node *nodes = calloc( capacity, sizeof(fs_image_node) );
+	int count = 1;
+	strcpy( nodes[0].name, top->name );
+	nodes[0].flags = FS_IMAGE_DIRECTORY;
+	nodes[0].offset = block_index;
+	for ( int i = 0; i < count; i++ ) {
+		if ( !(nodes[i].flags & FS_IMAGE_DIRECTORY) )
+			continue;
+		dir_type *folder = (dir_type *)(disk + nodes[i].offset*BLOCK_SIZE);
+		if ( count + folder->subitem_count > capacity ) {
+			capacity = 2*capacity + folder->subitem_count;
+			nodes = realloc( nodes, sizeof(fs_image_node)*capacity );
+		}
+		nodes[i].first = count;
+		nodes[i].count = folder->subitem_count;
+		nodes[i].files = folder->total_files;
+		nodes[i].size = folder->total_bytes;
+		for ( int k = 0; k < folder->subitem_count; k++ ) {
+			fs_image_node *node = &nodes[count++];
+			memset( node, 0, sizeof(fs_image_node) );
+			strcpy( node->name, folder->subitem[k] );
+			node->flags = folder->subitem_type[k] ? FS_IMAGE_DIRECTORY : 0;
+			node->parent = i;
+			node->offset = find_block( folder->subitem[k], folder->subitem_type[k] );
+		}
+		qsort( nodes + nodes[i].first, nodes[i].count, sizeof(fs_image_node), compare_image_nodes );
+	}
+
+	FILE *file = fopen( path, "wb" );
+	if ( file == NULL ) {
+		free(nodes);
+		return FS_ERR_IO;
+	}
+	fs_image_header header = { "", FS_IMAGE_PAGE, count, FS_IMAGE_PAGE, 0, 0 };
+	memcpy( header.magic, FS_IMAGE_MAGIC, sizeof(header.magic) );
+	header.data_offset = (header.node_offset + sizeof(fs_image_node)*count + FS_IMAGE_PAGE - 1) / FS_IMAGE_PAGE * FS_IMAGE_PAGE;
+
+	uint64_t bytes = 0;
+	nodes[0].offset = 0;
+	int error = export_data( file, nodes, count, header.data_offset, &bytes );
+	if ( error == FS_OK ) {
+		header.size = header.data_offset + bytes;
+		fseek( file, 0, SEEK_SET );
+		fwrite( &header, sizeof(header), 1, file );
+		fseek( file, header.node_offset, SEEK_SET );
+		fwrite( nodes, sizeof(fs_image_node), count, file );
+		fflush( file );
+		//The gaps in front of the sections were skipped, and a tree without data ends before data_offset
+		if ( ferror(file) || ftruncate(fileno(file), header.size) != 0 )
+			error = FS_ERR_IO;
+	}
+	if ( fclose(file) != 0 && error == FS_OK )
+		error = FS_ERR_IO;
+	if ( error != FS_OK )
+		remove( path );
+	TRACE("\t[%s] Exported [%s] as [%d] Nodes: [%d]\n", __func__, top->name, count, error );
+
+	free(nodes);
+	return error;
 }
 
 /*--------------------------------------------------------------------------------*/
 
-//Allows us to directly update values in the descriptor block. 
-int edit_descriptor ( int free_index, bool free, int name_index, char * name ) {
+//Writes the data of every file among "nodes" from data_offset on and sets its offset; files of a page or more
+//start on a page. "bytes" gets the size of the data section.
+int export_data ( FILE *file, fs_image_node *nodes, int count, uint64_t data_offset, uint64_t *bytes ) {
+	char *buffer = malloc( EXPORT_CHUNK );
+	uint64_t cursor = 0;
+	int error = FS_OK;
+
+	for ( int i = 1; i < count && error == FS_OK; i++ ) {
+		int index = nodes[i].offset;
+		nodes[i].offset = 0;
+		if ( nodes[i].flags & FS_IMAGE_DIRECTORY )
+			continue;
+
+		file_type *data = (file_type *)(disk + index*BLOCK_SIZE);
+		nodes[i].size = data->size;
+		if ( nodes[i].size >= FS_IMAGE_PAGE )
+			cursor = (cursor + FS_IMAGE_PAGE - 1) / FS_IMAGE_PAGE * FS_IMAGE_PAGE;
+		nodes[i].offset = cursor;
+		fseek( file, data_offset + cursor, SEEK_SET );
+
+		//Holes read as zeros, so the data of a file is always whole
+		for ( int position = 0; position < data->size && error == FS_OK; position += EXPORT_CHUNK ) {
+			int bytes = read_file( index, position, buffer, EXPORT_CHUNK );
+			if ( bytes < 0 )
+				error = bytes;
+			else if ( (int)fwrite(buffer, 1, bytes, file) != bytes )
+				error = FS_ERR_IO;
+		}
+		cursor += nodes[i].size;
+	}
+	*bytes = cursor;
 
-	descriptor_block *descriptor = malloc( BLOCK_SIZE*2 );
-	
-	//Copy descriptor on disk to our descriptor_block type, 
-	memcpy ( descriptor, disk, BLOCK_SIZE*2 );
+	free(buffer);
+	return error;
+}
 
-	//Each array in the descriptor block will be updated
-	if ( free_index > 0 ) {
-		descriptor->free[free_index] = free;
-			if ( debug ) printf("\t\t[%s] Descriptor Free Member now shows Memory Block [%d] is [%s]\n", __func__, free_index, free == true ? "Free": "Used");
+/*--------------------------------------------------------------------------------*/
+
+//Maps the image at "path"; only the header is looked at, the pages of the rest are read as they are used
+int fs_image_open ( const char *path, fs_image **image ) {
+	struct stat status;
+
+	*image = NULL;
+	int fd = open( path, O_RDONLY );
+	if ( fd == -1 )
+		return FS_ERR_IO;
+	if ( fstat(fd, &status) != 0 || status.st_size < (off_t)sizeof(fs_image_header) ) {
+		close(fd);
+		return FS_ERR_INVALID;
 	}
-	if ( name_index > 0 ) {
-		strcpy(descriptor->name[name_index], name );
-			if ( debug ) printf("\t\t[%s] Descriptor Name Member now shows Memory Block [%d] has Name [%s]\n", __func__, name_index, name);	
+	const char *base = mmap( NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	close(fd);
+	if ( base == MAP_FAILED )
+		return FS_ERR_IO;
+
+	const fs_image_header *header = (const fs_image_header *)base;
+	if ( memcmp(header->magic, FS_IMAGE_MAGIC, sizeof(header->magic)) != 0 || header->page != FS_IMAGE_PAGE
+		|| header->nodes == 0 || header->size > (uint64_t)status.st_size
+		|| header->node_offset < sizeof(fs_image_header) || header->node_offset % FS_IMAGE_PAGE != 0
+		|| header->node_offset + sizeof(fs_image_node)*header->nodes > header->data_offset || header->data_offset > header->size
+		|| !(((const fs_image_node *)(base + header->node_offset))->flags & FS_IMAGE_DIRECTORY) ) {
+		munmap( (void *)base, status.st_size );
+		return FS_ERR_INVALID;
 	}
-		
-	// write the new updated descriptor back to the beginning of the disk
-	memcpy(disk, descriptor, BLOCK_SIZE*2);
 
-	return 0;
+	*image = malloc( sizeof(fs_image) );
+	(*image)->base = base;
+	(*image)->length = status.st_size;
+	(*image)->header = header;
+	(*image)->nodes = (const fs_image_node *)(base + header->node_offset);
+	return FS_OK;
 }
 
 /*--------------------------------------------------------------------------------*/
 
-// This changes the name of a file in the descriptor; used for moving files;
-int edit_descriptor_name (int index, char* new_name)
-{
-	descriptor_block *descriptor = malloc( BLOCK_SIZE*2 );
+void fs_image_close ( fs_image *image ) {
+	if ( image == NULL )
+		return;
+	munmap( (void *)image->base, image->length );
+	free(image);
+}
 
-	memcpy ( descriptor, disk, BLOCK_SIZE*2 );
+/*--------------------------------------------------------------------------------*/
 
-	// Change the name of the file at index to the new_name
-	strcpy(descriptor->name[index], new_name);
+//Walks "path" down from node 0, one binary search per name; empty names, as in "a//b" or "a/", are skipped
+const fs_image_node *fs_image_lookup ( fs_image *image, const char *path ) {
+	const fs_image_node *node = image->nodes;
+	char name[FS_NAME_LENGTH];
+
+	while ( node != NULL && *path != '\0' ) {
+		int length = strcspn( path, "/" );
+		if ( length >= FS_NAME_LENGTH )
+			return NULL;
+		if ( length > 0 ) {
+			memcpy( name, path, length );
+			name[length] = '\0';
+			node = fs_image_child( image, node, name );
+		}
+		path += length + (path[length] == '/');
+	}
+	return node;
+}
 
-	memcpy(disk, descriptor, BLOCK_SIZE*2);
+/*--------------------------------------------------------------------------------*/
 
-	free(descriptor);
-	return 0;
+const fs_image_node *fs_image_child ( fs_image *image, const fs_image_node *directory, const char *name ) {
+	const fs_image_node *children = fs_image_children( image, directory );
+
+	if ( children == NULL )
+		return NULL;
+	int low = 0, high = directory->count - 1;
+	while ( low <= high ) {
+		int middle = low + (high - low) / 2;
+		int order = strncmp( children[middle].name, name, FS_NAME_LENGTH );
+		if ( order == 0 )
+			return &children[middle];
+		if ( order < 0 )
+			low = middle + 1;
+		else
+			high = middle - 1;
+	}
+	return NULL;
 }
 
 /*--------------------------------------------------------------------------------*/
 
-//Allows us to add a folder to the disk.
-int add_directory( char * name ) {
-	
-	if ( strcmp(name,"") == 0 ) {
-		if ( debug ) printf("\t\t[%s] Invalid Command\n", __func__ );
-		return -1;
+const fs_image_node *fs_image_children ( fs_image *image, const fs_image_node *directory ) {
+	if ( !(directory->flags & FS_IMAGE_DIRECTORY) || (uint64_t)directory->first + directory->count > image->header->nodes )
+		return NULL;
+	return image->nodes + directory->first;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+const void *fs_image_data ( fs_image *image, const fs_image_node *file ) {
+	if ( (file->flags & FS_IMAGE_DIRECTORY) || file->offset > image->header->size - image->header->data_offset
+		|| file->size > image->header->size - image->header->data_offset - file->offset )
+		return NULL;
+	return image->base + image->header->data_offset + file->offset;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+int compare_image_nodes ( const void *a, const void *b ) {
+	return strcmp( ((const fs_image_node *)a)->name, ((const fs_image_node *)b)->name );
+}
+
+/*--------------------------------------------------------------------------------*/
+
+/************************** Volumes ************************************/
+
+int fs_volume ( const char **members, int count ) {
+	if ( disk_allocated == true )
+		return FS_ERR_EXISTS;
+	if ( count < 1 || count > FS_MAX_MEMBERS )
+		return FS_ERR_INVALID;
+	for ( int m = 0; m < count; m++ )
+		if ( members[m] == NULL || strcmp(members[m], "") == 0 )
+			return FS_ERR_INVALID;
+
+	for ( int m = 0; m < volume.count; m++ )
+		free( volume.path[m] );
+	for ( int m = 0; m < count; m++ )
+		volume.path[m] = strdup( members[m] );
+	volume.count = count;
+	return FS_OK;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Maps block b of the disk from member b % count, behind the member's header block. The address range of
+//the disk is reserved first and the blocks are mapped over it, so the disk stays one flat range and the
+//engine sees no difference; a block is a page, which is what makes this possible. With one member the
+//blocks follow each other in it and are mapped in one go.
+char *volume_map ( int *error ) {
+	*error = BLOCK_SIZE % sysconf(_SC_PAGESIZE) != 0 ? FS_ERR_INVALID : volume_open();
+	if ( *error != FS_OK )
+		return NULL;
+	*error = FS_ERR_IO;
+
+	//A mounted volume has its members read ahead all at once, and the blocks are mapped in as they arrive;
+	//mapped one by one, they would otherwise fault in a page at a time
+	for ( int m = 0; m < volume.count && volume.mounted; m++ )
+		posix_fadvise( volume.fd[m], 0, 0, POSIX_FADV_WILLNEED );
+	int flags = MAP_SHARED | MAP_FIXED | (volume.mounted ? MAP_POPULATE : 0);
+
+	char *reserved = mmap( NULL, DISK_PARTITION, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+	int run = volume.count == 1 ? BLOCKS : 1;
+	for ( int b = 0; reserved != MAP_FAILED && b < BLOCKS; b += run ) {
+		off_t offset = (off_t)BLOCK_SIZE * (1 + b / volume.count);
+		if ( mmap(reserved + (size_t)b*BLOCK_SIZE, (size_t)run*BLOCK_SIZE, PROT_READ | PROT_WRITE, flags,
+			volume.fd[b % volume.count], offset) == MAP_FAILED ) {
+			munmap( reserved, DISK_PARTITION );
+			reserved = MAP_FAILED;
+		}
+	}
+	if ( reserved == MAP_FAILED ) {
+		for ( int m = 0; m < volume.count; m++ )
+			close( volume.fd[m] );
+		return NULL;
 	}
-	
-	//Allocating memory for new folder
-	dir_type *folder = malloc ( BLOCK_SIZE);
-		if ( debug ) printf("\t\t[%s] Allocating Space for New Folder\n", __func__);
-	
-	//Initialize our new folder
-	strcpy(folder->name, name);					
-	strcpy(folder->top_level, current.directory);
-	folder->subitem = malloc ( sizeof*(folder->subitem)*MAX_SUBDIRECTORIES);
-	folder->subitem_count = 0;					// Imp : Initialize subitem array to have 0 elements
-	
 
-	//Find free block in disk to store our folder; true => mark the block as directory
-	int index = allocate_block(name, true);
-		if ( debug ) printf("\t\t[%s] Assigning New Folder to Memory Block [%d]\n", __func__, index);
-		
-	//Copy our folder to the disk
-	memcpy( disk + index*BLOCK_SIZE, folder, BLOCK_SIZE);
-	
-	if ( debug ) printf("\t\t[%s] Folder [%s] Successfully Added\n", __func__, name);
-	free(folder);
-	return 0;
+	TRACE("\t[%s] Disk Striped over [%d] Members: [%d]\n", __func__, volume.count, volume.mounted );
+	return reserved;
 }
 
 /*--------------------------------------------------------------------------------*/
 
-//Allows to remove a directory folder from the disk.
-int remove_directory( char * name ) {
-	
-	dir_type *folder = malloc (BLOCK_SIZE);
-	int block_index = find_block(name, true);
-	
-	//If there was no subdirectory found, then return -1
-	if( block_index == -1 ) {
-		if ( debug ) printf("\t\t[%s] Directory [%s] does not exist in the current folder [%s]\n", __func__, name, current.directory);
-		return -1;
+//Opens the members and finds out whether they hold a volume of this disk in this order. If none of them
+//holds any volume, gives them a header with a new id and the size of their blocks, for fs_format to format;
+//members of another volume, in another order or cut short are left alone with FS_ERR_INVALID.
+int volume_open ( ) {
+	off_t length = (off_t)BLOCK_SIZE * (1 + (BLOCKS + volume.count - 1) / volume.count);
+	volume_header header;
+	uint64_t id = 0;
+	struct stat status;
+	int members = 0;	//that hold a header of some volume
+
+	volume.mounted = true;
+	for ( int m = 0; m < volume.count; m++ ) {
+		volume.fd[m] = open( volume.path[m], O_RDWR | O_CREAT, 0644 );
+		if ( volume.fd[m] == -1 ) {
+			while ( --m >= 0 )
+				close( volume.fd[m] );
+			return FS_ERR_IO;
+		}
+		bool found = pread(volume.fd[m], &header, sizeof(header), 0) == sizeof(header) && memcmp(header.magic, VOLUME_MAGIC, sizeof(header.magic)) == 0;
+		if ( !found || header.member != (uint32_t)m || header.members != (uint32_t)volume.count || header.blocks != BLOCKS
+			|| header.block_size != BLOCK_SIZE || (m > 0 && header.id != id) || fstat(volume.fd[m], &status) != 0 || status.st_size < length )
+			volume.mounted = false;
+		members += found;
+		id = header.id;
+	}
+	if ( volume.mounted )
+		return FS_OK;
+	if ( members > 0 ) {
+		for ( int m = 0; m < volume.count; m++ )
+			close( volume.fd[m] );
+		return FS_ERR_INVALID;
 	}
 
-	memcpy( folder, disk + block_index*BLOCK_SIZE, BLOCK_SIZE );
-
-	//Go through again if there is a subdirectory ==> as implemented in Unix
-	for( int i = 0; i < folder->subitem_count; i++ ) {
-		if( folder->subitem_type[i] == true ) {
-			//Recursively call the function to remove the subitem
-			remove_directory(folder->subitem[i]);
-		}
-		else {
-			//Remove the subitem that is a file
-			remove_file(folder->subitem[i]);
+	struct timespec now;
+	clock_gettime( CLOCK_REALTIME, &now );
+	memset( &header, 0, sizeof(header) );
+	memcpy( header.magic, VOLUME_MAGIC, sizeof(header.magic) );
+	header.members = volume.count;
+	header.blocks = BLOCKS;
+	header.block_size = BLOCK_SIZE;
+	header.id = ((uint64_t)now.tv_sec << 32) ^ (uint64_t)now.tv_nsec ^ (uint64_t)getpid();
+	for ( int m = 0; m < volume.count; m++ ) {
+		header.member = m;
+		if ( ftruncate(volume.fd[m], length) != 0 || pwrite(volume.fd[m], &header, sizeof(header), 0) != sizeof(header) ) {
+			for ( int k = 0; k < volume.count; k++ )
+				close( volume.fd[k] );
+			return FS_ERR_IO;
 		}
 	}
-	unallocate_block(block_index);
-	free(folder);
-	
-	return 0;
+	return FS_OK;
 }
 
 /*--------------------------------------------------------------------------------*/
 
-//Allows you to directly add items to a folders subitem array, or change the folder's name
-int edit_directory (char * name,  char*subitem_name, char *new_name, bool name_change, bool directory ) {
-	
-	if( strcmp(name,"") == 0 ) {
-		if( debug ) printf("\t\t[%s] Invalid Command\n", __func__ );
-		return -1;
+//A thread per member, so the members are written at the same time. The disk of a volume is the page cache
+//of its members, which holds every change already; only getting them into the files is left.
+int fs_sync ( ) {
+	pthread_t threads[FS_MAX_MEMBERS];
+	bool started[FS_MAX_MEMBERS];
+	int results[FS_MAX_MEMBERS];
+	int error = FS_OK;
+
+	if ( disk_allocated == false )
+		return FS_ERR_NO_DISK;
+	for ( int m = 0; m < volume.count; m++ ) {
+		results[m] = volume.fd[m];
+		started[m] = volume.count > 1 && pthread_create(&threads[m], NULL, volume_sync_member, &results[m]) == 0;
+		if ( !started[m] )
+			volume_sync_member( &results[m] );
 	}
-
-	dir_type *folder = malloc ( BLOCK_SIZE);
-	
-	//Find where the folder is on disk	
-	int block_index = find_block(name, true);
-	//If the directory is not found, should return
-	if( block_index == -1 ) {
-		if ( debug ) printf("\t\t[%s] Directory [%s] does not exist\n", __func__, name);
-		return -1;
+	for ( int m = 0; m < volume.count; m++ ) {
+		if ( started[m] )
+			pthread_join( threads[m], NULL );
+		if ( results[m] != 0 )
+			error = FS_ERR_IO;
 	}
-		if ( debug ) printf("\t\t[%s] Folder [%s] Found At Memory Block [%d]\n", __func__, name, block_index);
-	
-	memcpy( folder, disk + block_index*BLOCK_SIZE, BLOCK_SIZE);
+	TRACE("\t[%s] Synced [%d] Members: [%d]\n", __func__, volume.count, error );
+	return error;
+}
 
-	if ( strcmp(subitem_name, "") != 0 ) {	//Case that we are adding subitem to the descriptor block
-		
-		if ( !name_change ) {     //Case adding subitem
-			if ( debug ) printf("\t\t[%s] Added Subitem [%s] at Subitem index [%d] to directory [%s]\n", __func__, subitem_name, folder->subitem_count, folder->name );
-			strcpy (folder->subitem[folder->subitem_count], subitem_name );
-			folder->subitem_type[folder->subitem_count] = directory;
-			folder->subitem_count++;
-				if ( debug ) printf("\t\t[%s] Folder [%s] Now Has [%d] Subitems\n", __func__, name, folder->subitem_count);
+/*--------------------------------------------------------------------------------*/
 
-			//update the disk too!	
-			memcpy( disk + block_index*BLOCK_SIZE, folder, BLOCK_SIZE);
-			
-			free(folder);
-			return 0;
-		}
-		else {				//Case editing a subitem's name
-			for ( int i =0; i < folder->subitem_count; i++ ) {
-				if ( strcmp(folder->subitem[i], subitem_name) == 0 ) {
-					strcpy( folder->subitem[i], new_name);
-						if ( debug ) printf("\t\t[%s] Edited Subitem [%s] to [%s] at Subitem index [%d] for directory [%s]\n", __func__, subitem_name, new_name, i, folder->name );	
+//Takes the descriptor of a member and leaves the result of fdatasync in its place
+void *volume_sync_member ( void *arg ) {
+	int *fd = arg;
 
-					memcpy( disk + block_index*BLOCK_SIZE, folder, BLOCK_SIZE);
-					free(folder);
-					return 0;
-				}
-			}
+	*fd = fdatasync( *fd );
+	return NULL;
+}
 
-			if ( debug ) printf("\t\t[%s] Subitem Does Not Exist in Directory [%s]\n", __func__, folder->name );
-			free(folder);
-			return -1;
-		}
-	}
-	else {						//Case we are changing the folders name
-		//if directory with given name already exists, don't allow
-		int block_index2 = find_block(new_name, true);
+/*--------------------------------------------------------------------------------*/
 
-		//If the directory for the new name already exists, should return -1
-		if( block_index2 != -1 ) {
-			if ( debug ) printf("\t\t[%s] Directory [%s] already exists. Choose a different name\n", __func__, new_name);
-			return -1;
-		}
-	
-		strcpy(folder->name, new_name );
-			if ( debug ) printf("\t\t[%s] Folder [%s] Now Has Name [%s]\n", __func__, name, folder->name);
-		
-		memcpy( disk + block_index*BLOCK_SIZE, folder, BLOCK_SIZE);
-		
-		//edit descriptors
-		edit_descriptor(-1, false, block_index, new_name );
-			if ( debug ) printf("\t\t[%s] Updated Descriptor's Name Member\n", __func__);
-			if ( debug ) print_directory(folder->name);
-		
-		//changing parents name
-		edit_directory(folder->top_level, name, new_name, true, true );
-			if ( debug ) printf("\t\t[%s] Updated Parents Subitem Name\n", __func__);
-		
-		int child_index;
+/************************** Quotas ************************************/
 
-		//Iterates through to change the subitems' top_level name
-		for ( int i = 0; i < folder->subitem_count; i++) {
-			file_type *child_file = malloc ( BLOCK_SIZE);
-			dir_type *child_folder = malloc ( BLOCK_SIZE);
-			
-			child_index = find_block ( folder->subitem[i], folder->subitem_type);
-			if ( folder->subitem_type[i] ) {
-				//if type == folder
-				memcpy( child_folder, disk + child_index*BLOCK_SIZE, BLOCK_SIZE);
-				strcpy( child_folder->top_level, new_name );
-				
-				memcpy( disk + child_index*BLOCK_SIZE, child_folder, BLOCK_SIZE);
-				free ( child_folder );
-				free ( child_file );
-			}
-			else {
-				//if type == file
-				memcpy( child_file, disk + child_index*BLOCK_SIZE, BLOCK_SIZE);
-				strcpy( child_file->top_level, new_name );
-			
-				memcpy( disk + child_index*BLOCK_SIZE, child_file, BLOCK_SIZE);	
-				free ( child_folder );
-				free ( child_file );
-			} 
+//True if "entries" more entries and "blocks" more blocks fit the quota of directory "name" and of every
+//directory above it. update_directory_totals keeps the totals of each directory current, so only the
+//directories on the way up are looked at, and none at all while no quota is set.
+bool quota_allows ( char *name, int entries, int blocks ) {
+	char parent[MAX_STRING_LENGTH];
+
+	if ( quota_directories == 0 )
+		return true;
+	strcpy( parent, name );
+	while ( strcmp(parent, "") != 0 ) {
+		int block_index = find_block(parent, true);
+		if ( block_index == -1 )
+			break;
+		dir_type *folder = (dir_type *)(disk + block_index*BLOCK_SIZE);
+		if ( (folder->quota_blocks > 0 && folder->total_blocks + blocks > folder->quota_blocks)
+			|| (folder->quota_entries > 0 && folder->total_entries + entries > folder->quota_entries) ) {
+			TRACE("\t\t[%s] Directory [%s] Is Over Its Quota\n", __func__, folder->name );
+			return false;
 		}
-			
-		free(folder);
-		return 0;
+		strcpy( parent, folder->top_level );
 	}
-		
-	free ( folder );
+	return true;
 }
 
 /*--------------------------------------------------------------------------------*/
 
-//Allows us to add a file to our disk; This function will allocate this file descriptor block (holds file info), as well as data blocks 
-int add_file( char * name, int size ) {
-	char subname[20];
-	
-	if ( size < 0 || strcmp(name,"") == 0 ) {
-		if ( debug ) printf("\t\t[%s] Invalid command\n", __func__);
-		if (!debug ) printf("%s: missing operand\n", "mkfil");
-		return 1;
+//Counts the directories with a quota again, after a rollback put back other directories
+void quota_count ( ) {
+	descriptor_block *descriptor = (descriptor_block *)disk;
+
+	quota_directories = 0;
+	for ( int i = 0; i < BLOCKS; i++ ) {
+		if ( descriptor->free[i] || !descriptor->directory[i] || strcmp(descriptor->name[i], REMOVED_NAME) == 0 )
+			continue;
+		dir_type *folder = (dir_type *)(disk + i*BLOCK_SIZE);
+		if ( folder->quota_blocks > 0 || folder->quota_entries > 0 )
+			quota_directories++;
 	}
-		
-	
-	//Allocate memory to a file_type
-	file_type *file = malloc ( BLOCK_SIZE );
-		if ( debug ) printf("\t\t[%s] Allocating Space for New File\n", __func__);
-		
-	//Initialize all the members of our new file
-	strcpy( file->name, name);	
-	strcpy ( file->top_level, current.directory );
-	file->size = size;		
-	file->data_block_count = 0;
-		if ( debug ) printf("\t\t[%s] Initializing File Members\n", __func__);
-				
-	//Find free block to put this file descriptor block in memory, false ==> indicates a file
-	int index = allocate_block(name, false);
-	
-	//Find free blocks to put the file data into
-	if ( debug ) printf("\t\t[%s] Allocating [%d] Data Blocks in Memory for File Data\n", __func__, (int)size/BLOCK_SIZE);
-	for ( int i = 0; i < size/BLOCK_SIZE + 1; i++ ) {
-		sprintf(subname, "%s->%d", name, i);
-		file->data_block_index[i] = allocate_block(subname, false);
-		file->data_block_count++;
-	}  
-	//data blocks in memory not copied to disk
-	memcpy( disk + index*BLOCK_SIZE, file, BLOCK_SIZE);
-	
-	if ( debug ) printf("\t\t[%s] File [%s] Successfully Added\n", __func__, name);
-	
-	free(file);
-	return 0;
 }
 
 /*--------------------------------------------------------------------------------*/
 
-int remove_file (char* name)
-{
-	if (strcmp(name,"") == 0 ) {
-		if ( debug ) printf("\t\t[%s] Invalid command\n", __func__);
-		if (!debug ) printf("%s: missing operand\n", "rmfil");
-		return 1;
-	}
+/************************** Command Trace ************************************/
+
+//Starts a new trace in "path"; a trace that is still being recorded is closed first
+int fs_trace_start ( const char *path ) {
+	fs_trace_stop();
+	command_trace.file = fopen( path, "wb" );
+	if ( command_trace.file == NULL )
+		return FS_ERR_IO;
+	fwrite( FS_TRACE_MAGIC, 1, strlen(FS_TRACE_MAGIC), command_trace.file );
+	checksum_init();	//output is checksummed before a disk may have set the tables up
+	clock_gettime( CLOCK_MONOTONIC, &command_trace.start );
+	return FS_OK;
+}
 
-	file_type *file = malloc ( BLOCK_SIZE);
-	dir_type *folder = malloc ( BLOCK_SIZE);
-	
-	int file_index = find_block(name, false);
-	
-	// If the file is not found, error, return -1
-	if ( file_index == -1 )  {
-		if ( debug ) printf("\t\t\t[%s] File [%s] not found\n", __func__, name);
-		return -1;
+/*--------------------------------------------------------------------------------*/
+
+void fs_trace_stop ( ) {
+	if ( command_trace.file != NULL )
+		fclose( command_trace.file );
+	command_trace.file = NULL;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Appends the command that started at "start" and just finished, with the checksum of what it printed;
+//blank lines are left out
+void trace_command ( int session, const char *line, int result, uint32_t printed, struct timespec *start ) {
+	fs_trace_record record;
+	struct timespec now;
+
+	int length = strcspn( line, "\r\n" );
+	if ( (int)strspn(line, " \t") >= length )
+		return;
+	if ( length > LINESIZE - 1 )
+		length = LINESIZE - 1;
+
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	record.start = (start->tv_sec - command_trace.start.tv_sec) * 1000000000LL + (start->tv_nsec - command_trace.start.tv_nsec);
+	record.duration = (now.tv_sec - start->tv_sec) * 1000000000LL + (now.tv_nsec - start->tv_nsec);
+	record.session = session;
+	record.result = result;
+	record.length = length;
+	record.output = printed;
+	fwrite( &record, sizeof(record), 1, command_trace.file );
+	fwrite( line, 1, length, command_trace.file );
+}
+
+/*--------------------------------------------------------------------------------*/
+
+/************************** Trace Ring ************************************/
+
+//Records one trace point of the calling thread. Nothing is formatted: numbers are stored as they
+//are and strings are copied, in the order the site's format asks for them.
+void trace_point ( trace_site *site, const char *format, ... ) {
+	trace_ring *ring = thread_ring != NULL ? thread_ring : trace_ring_claim();
+	trace_record *record = &ring->record[ring->next % TRACE_RECORDS];
+	struct timespec now;
+	char scanned[TRACE_ARGUMENTS];
+	char *kind = site->kind;
+	va_list args;
+
+	//The first thread to hit the site publishes what it found; the others scan for themselves meanwhile
+	int count = __atomic_load_n( &site->count, __ATOMIC_ACQUIRE );
+	if ( count < 0 ) {
+		int expected = -1;
+		kind = scanned;
+		count = trace_scan( format, kind );
+		if ( __atomic_compare_exchange_n(&site->count, &expected, -2, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED) ) {
+			memcpy( site->kind, scanned, TRACE_ARGUMENTS );
+			__atomic_store_n( &site->count, count, __ATOMIC_RELEASE );
+		}
 	}
-	
-	if ( debug ) printf("\t\t[%s] File [%s] Found At Memory Block [%d]\n", __func__, name, file_index);
-	
-	memcpy( file, disk + file_index*BLOCK_SIZE, BLOCK_SIZE);
-	
-	//Find the top_level folder on disk
-	int folder_index = find_block(file->top_level, true);
-	
-	if ( debug ) printf("\t\t[%s] Folder [%s] Found At Memory Block [%d]\n", __func__, name, folder_index);
-	memcpy( folder, disk + folder_index*BLOCK_SIZE, BLOCK_SIZE);
-	
-	
-	// Go through the parent directory's subitem array and remove our file
-	char subitem_name[MAX_STRING_LENGTH]; 
-	const int subcnt = folder->subitem_count; // no of subitems
-	int j;
-	int k=0;
-	for(j = 0; j<subcnt; j++)
-		{
-			strcpy(subitem_name, folder->subitem[j]);
-			if (strcmp(subitem_name, name) != 0) 
-			// if this element is not the one we are removing, copy back
-			{
-				strcpy(folder->subitem[k],subitem_name);
-				k++;
-			}
+
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	record->format = format;
+	record->time = now.tv_sec * 1000000000L + now.tv_nsec;
+	record->thread = ring->thread;
+
+	va_start( args, format );
+	for ( int n = 0; n < count; n++ ) {
+		if ( kind[n] == 's' ) {
+			strncpy( record->argument[n].text, va_arg(args, const char *), TRACE_TEXT - 1 );
+			record->argument[n].text[TRACE_TEXT - 1] = '\0';
 		}
-	strcpy(folder->subitem[k], "");
-	folder->subitem_count--;
+		else
+			record->argument[n].number = kind[n] == 'l' ? va_arg(args, long) : va_arg(args, int);
+	}
+	va_end( args );
 
-	memcpy(disk + folder_index*BLOCK_SIZE, folder, BLOCK_SIZE); // Update the folder in memory
+	//Publish the record only once it is complete
+	__atomic_store_n( &ring->next, ring->next + 1, __ATOMIC_RELEASE );
+}
 
+/*--------------------------------------------------------------------------------*/
 
-	//Imp :  Unallocate all of the data blocks from the file that we are deleting
-	int i = 0;
-	while(file->data_block_count != 0)
-	{
-		unallocate_block(file->data_block_index[i]);
-		file->data_block_count--;
-		i++;
+//Finds the conversions of a format and what each one takes; returns how many there are
+int trace_scan ( const char *format, char *kind ) {
+	int n = 0;
+
+	for ( const char *c = format; *c != '\0' && n < TRACE_ARGUMENTS; c++ ) {
+		if ( *c != '%' )
+			continue;
+		c++;
+		while ( *c != '\0' && strchr("-+ #0123456789.", *c) != NULL )
+			c++;
+		bool is_long = *c == 'l';
+		while ( *c == 'l' )
+			c++;
+		if ( *c == '%' )
+			continue;
+		kind[n++] = *c == 's' ? 's' : is_long ? 'l' : 'i';
 	}
-	
-	unallocate_block(file_index); // Deallocate the file control block
-	
-	free(folder);
-	free(file);
-	return 0;
+	return n;
 }
 
 /*--------------------------------------------------------------------------------*/
 
-//Allows you to directly edit a file and change its size or its name
-int edit_file ( char * name, int size, char *new_name ) {
-	file_type *file = malloc ( BLOCK_SIZE);
-	
-	//Find the block in memory where this file is written	
-	int block_index = find_block(name, false);
-	if ( block_index == -1 )  {
-		if ( debug ) printf("\t\t\t[%s] File [%s] not found\n", __func__, name);
-		return -1;
+//Gives the calling thread a ring: one whose thread has ended if there is any, a new one otherwise
+trace_ring *trace_ring_claim ( ) {
+	trace_ring *ring;
+
+	pthread_once( &trace_once, trace_key_create );
+	for ( ring = __atomic_load_n(&trace_rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->link ) {
+		bool expected = false;
+		if ( __atomic_compare_exchange_n(&ring->in_use, &expected, true, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED) )
+			break;
 	}
-	if ( debug ) printf("\t\t[%s] File [%s] Found At Memory Block [%d]\n", __func__, name, block_index);
 
-	memcpy( file, disk + block_index*BLOCK_SIZE, BLOCK_SIZE);
-	
-	if ( size > 0 ) { 
-		//If size is greater than zero, then the files size will be updated
-		file->size = size;
-		if ( debug ) printf("\t\t[%s] File [%s] Now Has Size [%d]\n", __func__, name, size);
-		free(file);
-		return 0;
+	if ( ring == NULL ) {
+		ring = calloc( 1, sizeof(trace_ring) );
+		ring->in_use = true;
+		ring->thread = __atomic_fetch_add( &trace_ring_count, 1, __ATOMIC_ACQ_REL );
+		ring->link = __atomic_load_n( &trace_rings, __ATOMIC_ACQUIRE );
+		while ( !__atomic_compare_exchange_n(&trace_rings, &ring->link, ring, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) )
+			;
 	}
-	else {		  
-		//Otherwise, the file's name will be updated
-		char top_level[MAX_STRING_LENGTH];
-		strcpy(top_level, get_file_top_level(name));
 
-		// Change the name of the directory's subitem
-		edit_directory_subitem(top_level, name, new_name); 
+	thread_ring = ring;
+	pthread_setspecific( trace_key, ring );
+	return ring;
+}
 
-		// Change the name of the actual file descriptor
-		edit_descriptor_name(block_index, new_name); 
+/*--------------------------------------------------------------------------------*/
 
-		strcpy(file->name, new_name );
-		memcpy( disk + block_index*BLOCK_SIZE, file, BLOCK_SIZE);	
+//Runs when a thread with a ring ends; the records stay for "trace dump"
+void trace_ring_release ( void *ring ) {
+	__atomic_store_n( &((trace_ring *)ring)->in_use, false, __ATOMIC_RELEASE );
+}
+
+void trace_key_create ( ) {
+	pthread_key_create( &trace_key, trace_ring_release );
+}
 
-		if ( debug ) printf("\t\t\t[%s] File [%s] Now Has Name [%s]\n", __func__, name, file->name);
+/*--------------------------------------------------------------------------------*/
 
-		free(file);
-		return 0;
+//Formats a record the way printf would have formatted its trace point
+void trace_format ( trace_record *record, char *text, int size ) {
+	char conversion[16];
+	int length = 0;
+	int n = 0;
+
+	for ( const char *c = record->format; *c != '\0' && length < size - 1; c++ ) {
+		if ( *c != '%' ) {
+			text[length++] = *c;
+			continue;
+		}
+		const char *start = c++;
+		while ( *c != '\0' && strchr("-+ #0123456789.l", *c) != NULL )
+			c++;
+		if ( *c == '\0' || c - start + 1 >= (int)sizeof(conversion) || n == TRACE_ARGUMENTS )
+			break;
+		if ( *c == '%' ) {
+			text[length++] = '%';
+			continue;
+		}
+
+		memcpy( conversion, start, c - start + 1 );
+		conversion[c - start + 1] = '\0';
+		if ( *c == 's' )
+			length += snprintf( text + length, size - length, conversion, record->argument[n].text );
+		else if ( strchr(conversion, 'l') != NULL )
+			length += snprintf( text + length, size - length, conversion, record->argument[n].number );
+		else
+			length += snprintf( text + length, size - length, conversion, (int)record->argument[n].number );
+		if ( length > size - 1 )
+			length = size - 1;
+		n++;
 	}
+	text[length] = '\0';
+}
+
+/*--------------------------------------------------------------------------------*/
+
+int compare_trace_records ( const void *a, const void *b ) {
+	const trace_record *x = a;
+	const trace_record *y = b;
+	return (x->time > y->time) - (x->time < y->time);
 }
 
 /*--------------------------------------------------------------------------------*/
@@ -1105,7 +6841,7 @@ char * get_directory_name ( char*name ) {
 	//for a directory not a file
 	int block_index = find_block(name, true);
 	if ( block_index == -1 )  {
-		if ( debug ) printf("\t\t\t[%s] Folder [%s] not found\n", __func__, name);
+		TRACE("\t\t\t[%s] Folder [%s] not found\n", __func__, name);
 		strcpy ( tmp, "");
 		return tmp;
 	}
@@ -1113,7 +6849,7 @@ char * get_directory_name ( char*name ) {
 	memcpy( folder, disk + block_index*BLOCK_SIZE, BLOCK_SIZE);
 	
 	strcpy( tmp, folder->name);
-		if ( debug ) printf("\t\t\t[%s] Name [%s] found for [%s] folder\n", __func__, tmp, name );
+		TRACE("\t\t\t[%s] Name [%s] found for [%s] folder\n", __func__, tmp, name );
 		
 	free ( folder );
 	return tmp;
@@ -1128,7 +6864,7 @@ char * get_directory_top_level ( char*name) {
 	//true ==> indicates a folder and not a file
 	int block_index = find_block(name, true);
 	if ( block_index == -1 )  {
-		if ( debug ) printf("\t\t\t[%s] Folder [%s] not found\n", __func__,name);
+		TRACE("\t\t\t[%s] Folder [%s] not found\n", __func__,name);
 		strcpy ( tmp, "");
 		return tmp;
 	}
@@ -1136,7 +6872,7 @@ char * get_directory_top_level ( char*name) {
 	memcpy( folder, disk + block_index*BLOCK_SIZE, BLOCK_SIZE);
 	
 	strcpy( tmp, folder->top_level);
-		if ( debug ) printf("\t\t\t[%s] top_level [%s] found for [%s] folder\n", __func__, tmp, name );
+		TRACE("\t\t\t[%s] top_level [%s] found for [%s] folder\n", __func__, tmp, name );
 	
 	free ( folder );
 	return tmp;
@@ -1150,7 +6886,7 @@ char * get_directory_subitem ( char*name, int subitem_index, char*subitem_name )
 
 	int block_index = find_block(name, true);
 	if ( block_index == -1 ) {
-		if ( debug ) printf("\t\t\t[%s] Folder [%s] not found\n", __func__, name);
+		TRACE("\t\t\t[%s] Folder [%s] not found\n", __func__, name);
 		strcpy ( tmp, "");
 		return tmp;
 	}
@@ -1160,7 +6896,7 @@ char * get_directory_subitem ( char*name, int subitem_index, char*subitem_name )
 	if ( subitem_index >= 0 ) { 
 		//Case we are changing the name of a subitem
 		strcpy( tmp, folder->subitem[subitem_index]);
-		if ( debug ) printf("\t\t\t[%s] subitem[%d] = [%s] for [%s] folder\n", __func__, subitem_index, tmp, name );
+		TRACE("\t\t\t[%s] subitem[%d] = [%s] for [%s] folder\n", __func__, subitem_index, tmp, name );
 		free(folder);
 		return tmp;
 	}
@@ -1168,11 +6904,11 @@ char * get_directory_subitem ( char*name, int subitem_index, char*subitem_name )
 		//Case that we Are Searching for a Sub Item
 		for ( int i =0; i < folder->subitem_count; i ++ ) {
 			if ( strcmp( folder->subitem[i], subitem_name ) == 0 ) {
-				if ( debug ) printf( "\t\t\t[%s] Found [%s] as a Subitem of Directory [%s]\n", __func__, subitem_name, name );
+				TRACE( "\t\t\t[%s] Found [%s] as a Subitem of Directory [%s]\n", __func__, subitem_name, name );
 				return "0";
 			}
 		}
-		if ( debug ) printf( "\t\t\t[%s] Did Not Find [%s] as a Subitem of Directory [%s]\n", __func__, subitem_name, name );
+		TRACE( "\t\t\t[%s] Did Not Find [%s] as a Subitem of Directory [%s]\n", __func__, subitem_name, name );
 		free ( folder );
 		return "-1";
 	}
@@ -1190,7 +6926,7 @@ int edit_directory_subitem (char* name, char* sub_name, char* new_sub_name)
 	//for a directory not a file
 	int block_index = find_block(name, true);
 	if ( block_index == -1 ) {
-		if ( debug ) printf("\t\t\t[%s] Folder [%s] not found\n", __func__, name);
+		TRACE("\t\t\t[%s] Folder [%s] not found\n", __func__, name);
 	}
 	
 	memcpy( folder, disk + block_index*BLOCK_SIZE, BLOCK_SIZE);
@@ -1202,9 +6938,9 @@ int edit_directory_subitem (char* name, char* sub_name, char* new_sub_name)
 		if (strcmp(folder->subitem[i], sub_name) == 0)
 		{
 			strcpy(folder->subitem[i], new_sub_name);
-			if (debug) printf("\t\t\t[%s] Edited subitem in %s from %s to %s\n", __func__, folder->name, sub_name, folder->subitem[i]);
+			TRACE("\t\t\t[%s] Edited subitem in %s from %s to %s\n", __func__, folder->name, sub_name, folder->subitem[i]);
 
-			memcpy(disk + block_index*BLOCK_SIZE ,folder, BLOCK_SIZE);
+			write_blocks( block_index, folder, 1 );
 			free(folder);
 			return i;
 		}
@@ -1216,6 +6952,31 @@ int edit_directory_subitem (char* name, char* sub_name, char* new_sub_name)
 
 /*--------------------------------------------------------------------------------*/
 
+//Adds the given changes to the totals of directory "name" and every directory above it.
+//This costs one step per level of depth, so that du never has to walk a subtree.
+void update_directory_totals ( char *name, long bytes, int files, int entries, int blocks ) {
+	dir_type *folder = malloc ( BLOCK_SIZE );
+	char parent[MAX_STRING_LENGTH];
+
+	strcpy( parent, name );
+	while ( strcmp(parent, "") != 0 ) {
+		int block_index = find_block(parent, true);
+		if ( block_index == -1 )
+			break;
+		memcpy( folder, disk + block_index*BLOCK_SIZE, BLOCK_SIZE );
+		folder->total_bytes += bytes;
+		folder->total_files += files;
+		folder->total_entries += entries;
+		folder->total_blocks += blocks;
+		write_blocks( block_index, folder, 1 );
+			TRACE("\t\t\t[%s] Directory [%s] Now Holds [%ld] Bytes in [%d] Files and [%d] Blocks\n", __func__, folder->name, folder->total_bytes, folder->total_files, folder->total_blocks );
+		strcpy( parent, folder->top_level );
+	}
+	free(folder);
+}
+
+/*--------------------------------------------------------------------------------*/
+
 int get_directory_subitem_count( char*name) {
 	
 	dir_type *folder = malloc ( BLOCK_SIZE);
@@ -1223,14 +6984,14 @@ int get_directory_subitem_count( char*name) {
 
 	int block_index = find_block(name, true);
 	if ( block_index == -1 ) {
-		if ( debug ) printf("\t\t\t[%s] Folder [%s] not found\n", __func__, name);
+		TRACE("\t\t\t[%s] Folder [%s] not found\n", __func__, name);
 		return -1;
 	}
 	
 	memcpy( folder, disk + block_index*BLOCK_SIZE, BLOCK_SIZE);
  	
  	tmp = folder->subitem_count;
-		if ( debug ) printf("\t\t\t[%s] subitem_count [%d] found for [%s] folder\n", __func__, folder->subitem_count, name );
+		TRACE("\t\t\t[%s] subitem_count [%d] found for [%s] folder\n", __func__, folder->subitem_count, name );
 	
 	free ( folder );
 	return tmp;
@@ -1245,7 +7006,7 @@ char * get_file_name ( char*name ) {
 	//false ==> indicates a file and not a folder 
 	int block_index = find_block(name, false);
 	if ( block_index == -1 ) {
-		if ( debug ) printf("\t\t\t[%s] File [%s] not found\n", __func__, name);
+		TRACE("\t\t\t[%s] File [%s] not found\n", __func__, name);
 		strcpy ( tmp, "");
 		return tmp;
 	}
@@ -1253,7 +7014,7 @@ char * get_file_name ( char*name ) {
 	memcpy( file, disk + block_index*BLOCK_SIZE, BLOCK_SIZE);
 	
 	strcpy( tmp, file->name);
-		if ( debug ) printf("\t\t\t[%s] Name [%s] found for [%s] file\n", __func__, tmp, name );
+		TRACE("\t\t\t[%s] Name [%s] found for [%s] file\n", __func__, tmp, name );
 		
 	free ( file );
 	return tmp;
@@ -1267,7 +7028,7 @@ char * get_file_top_level ( char*name) {
 
 	int block_index = find_block(name, false);
 	if ( block_index == -1 ) {
-		if ( debug ) printf("\t\t\t[%s] File [%s] not found\n", __func__, name);
+		TRACE("\t\t\t[%s] File [%s] not found\n", __func__, name);
 		strcpy ( tmp, "");
 		return tmp;
 	}
@@ -1275,7 +7036,7 @@ char * get_file_top_level ( char*name) {
 	memcpy( file, disk + block_index*BLOCK_SIZE, BLOCK_SIZE);
 	
 	strcpy( tmp, file->top_level);
-		if ( debug ) printf("\t\t\t[%s] top_level [%s] found for [%s] file\n", __func__, tmp, name );
+		TRACE("\t\t\t[%s] top_level [%s] found for [%s] file\n", __func__, tmp, name );
 	
 	free ( file );
 	return tmp;
@@ -1290,14 +7051,14 @@ int get_file_size( char*name) {
 
 	int block_index = find_block(name, false);
 	if ( block_index == -1 ) {
-		if ( debug ) printf("\t\t\t[%s] File [%s] not found\n", __func__, name);
+		TRACE("\t\t\t[%s] File [%s] not found\n", __func__, name);
 		return -1;
 	}
 		
 	memcpy( file, disk + block_index*BLOCK_SIZE, BLOCK_SIZE);
  	
  	tmp = file->size;
-		if ( debug ) printf("\t\t\t[%s] size of [%d] found for [%s] file\n", __func__, tmp, name );
+		TRACE("\t\t\t[%s] size of [%d] found for [%s] file\n", __func__, tmp, name );
 	
 	free ( file );
 	return tmp;
@@ -1306,32 +7067,20 @@ int get_file_size( char*name) {
 /*--------------------------------------------------------------------------------*/
 
 /********************************* Print Functions ********************************/
+//Traces the attributes of a folder; records only, nothing is printed
 void print_directory ( char *name) {
-	dir_type *folder = malloc( BLOCK_SIZE);
-	int block_index = find_block(name, true);
-	memcpy( folder, disk + block_index*BLOCK_SIZE, BLOCK_SIZE);
-	
-	printf("	-----------------------------\n");
-	printf("	New Folder Attributes:\n\n\tname = %s\n\ttop_level = %s\n\tsubitems = ", folder->name, folder->top_level);
-	for (int i = 0; i < folder->subitem_count; i++) {
-		printf( "%s ", folder->subitem[i]);
-	}
-	printf("\n\tsubitem_count = %d\n", folder->subitem_count);
-	printf("	-----------------------------\n");
-	
-	free(folder);
+	if ( !debug )
+		return;
+	dir_type *folder = (dir_type *)(disk + find_block(name, true)*BLOCK_SIZE);
+	TRACE("\t[%s] Folder Attributes: name = %s, top_level = %s, subitem_count = %d\n", __func__, folder->name, folder->top_level, folder->subitem_count);
 }
 
+//Traces the attributes of a file
 void print_file ( char *name) {
-	file_type *file = malloc( BLOCK_SIZE);
-	int block_index = find_block(name, false);
-	memcpy( file, disk + block_index*BLOCK_SIZE, BLOCK_SIZE);
-	
-	printf("	-----------------------------\n");
-	printf("	New File Attributes:\n\n\tname = %s\n\ttop_level = %s\n\tfile size = %d\n\tblock count = %d\n", file->name, file->top_level, file->size, file->data_block_count);
-	printf("	-----------------------------\n");
-	
-	free(file);
+	if ( !debug )
+		return;
+	file_type *file = (file_type *)(disk + find_block(name, false)*BLOCK_SIZE);
+	TRACE("\t[%s] File Attributes: name = %s, top_level = %s, file size = %d, block count = %d\n", __func__, file->name, file->top_level, file->size, file->data_block_count);
 }
 
 /*--------------------------------------------------------------------------------*/
\ No newline at end of file
@@ -0,0 +1,244 @@
+#ifndef SIMULATED_FILE_SYSTEM_H
+#define SIMULATED_FILE_SYSTEM_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Library interface of the simulated file system.
+ *
+ * Every call works on a handle, which carries its own working directory, and names are
+ * looked up in that directory ("." is the directory itself). Calls return FS_OK (0) or
+ * one of the negative FS_ERR_* codes below; the read, write and readdir calls return a
+ * count and fs_open a descriptor instead. Nothing is printed and nothing is parsed,
+ * except by fs_command, which runs one line of the text interface (see the README).
+ *
+ * The disk is a single process wide image and the library is not thread safe; callers
+ * that share it between threads have to serialize the calls themselves.
+ */
+
+#define FS_NAME_LENGTH 20	//names are at most FS_NAME_LENGTH-1 characters
+
+#define FS_OK 0
+#define FS_ERR_INVALID -1	//empty or too long name, negative size or offset; a file that is not an image or not of the volume
+#define FS_ERR_NOT_FOUND -2	//no such file or directory in the working directory
+#define FS_ERR_EXISTS -3	//the name is already taken
+#define FS_ERR_NO_SPACE -4	//not enough free blocks on the disk
+#define FS_ERR_FULL -5		//the directory cannot hold more entries
+#define FS_ERR_NO_DISK -6	//fs_format (or the "root" command) has not run yet
+#define FS_ERR_IS_DIRECTORY -7	//file operation on a directory
+#define FS_ERR_NOT_DIRECTORY -8	//directory operation on a file
+#define FS_ERR_BAD_DESCRIPTOR -9	//not a descriptor returned by fs_open (or a watch of fs_watch), or closed already
+#define FS_ERR_TOO_MANY_OPEN -10	//every slot of the open file (or watch) table is taken
+#define FS_ERR_IO -11		//a file outside the simulated disk could not be opened
+#define FS_ERR_CHECKSUM -12	//a block read does not match its checksum
+#define FS_ERR_OVERFLOW -13	//a watch fell so far behind that events were lost
+#define FS_ERR_QUOTA -14	//a directory would go over its quota
+
+//The disk is mapped on a huge page boundary. Huge pages let a couple of TLB entries cover all of it; explicit
+//ones have to be reserved by the administrator (vm.nr_hugepages) and fall back to transparent ones otherwise.
+#define FS_PAGES_BASE 0		//pages of the base size only; the default
+#define FS_PAGES_TRANSPARENT 1	//asks the kernel for transparent huge pages (madvise)
+#define FS_PAGES_HUGE 2		//explicit huge pages (MAP_HUGETLB)
+
+//A volume keeps the disk in image files on the host, striped RAID 0 fashion: block b lies in member b % count,
+//so the consecutive blocks of a file spread over every member. The blocks of the members are mapped into the
+//disk and the page cache does the reading and writing, in parallel over the members: fs_format asks for the
+//blocks of every member to be read ahead at once, and fs_sync writes the members back, a thread each.
+//Members that hold this volume already are mounted as they are, and new or empty files are formatted;
+//fs_format fails with FS_ERR_INVALID rather than format members of another volume, or in another order.
+//Snapshots, watches and the rest of what is kept in memory do not outlive the process.
+#define FS_MAX_MEMBERS 16
+
+typedef struct fs_handle fs_handle;
+
+typedef struct {
+	char name[FS_NAME_LENGTH];
+	char parent[FS_NAME_LENGTH];
+	bool directory;
+	int block;		//control block on the disk
+	long size;		//bytes; for a directory, of all files below it
+	int blocks;		//blocks used, for a directory including everything below it; holes of a file use none
+	int files;		//files below a directory; 0 for a file
+	int entries;		//entries of a directory; data blocks of a file
+	bool compressed;	//a compressed file; for a directory, new files in it are compressed
+} fs_stat_type;
+
+typedef struct {
+	char name[FS_NAME_LENGTH];
+	bool directory;
+} fs_entry_type;
+
+//A quota counts the blocks and the entries (files and directories, the directory itself included) of a
+//directory and everything below it; calls that would take it over a limit fail with FS_ERR_QUOTA
+typedef struct {
+	int blocks;		//limits; 0 for none
+	int entries;
+	int used_blocks;	//held now; the blocks are those of fs_stat
+	int used_entries;
+} fs_quota_type;
+
+int fs_format ( );				//creates the disk and the root directory, once; mounts a volume that exists already
+fs_handle *fs_attach ( );			//new handle, working directory is root
+void fs_detach ( fs_handle *fs );
+void fs_debug ( bool on );			//trace points of the engine, shown by "trace dump"; on by default
+void fs_dedup ( bool on );			//inline deduplication: a written data block identical to another one shares it; off by default
+void fs_pages ( int mode );			//how fs_format backs the disk, FS_PAGES_*; call it first
+int fs_volume ( const char **members, int count );	//the image files fs_format puts the disk in, at most FS_MAX_MEMBERS; call it first
+int fs_sync ( );				//writes a volume back to its members; FS_ERR_IO if one of them fails
+const char *fs_strerror ( int error );
+
+int fs_chdir ( fs_handle *fs, char *name );	//".." goes up one level
+int fs_mkdir ( fs_handle *fs, char *name );
+int fs_mkfile ( fs_handle *fs, char *name, int size );	//the data is a hole until written: it reads as zeros and takes no blocks
+int fs_remove ( fs_handle *fs, char *name );	//directories are removed with everything below them; the blocks are freed in the background
+int fs_rename ( fs_handle *fs, char *name, char *new_name );
+int fs_resize ( fs_handle *fs, char *name, int size );	//keeps the data; new bytes read as zero
+int fs_copy ( fs_handle *fs, char *name, char *new_name );	//the copy shares the data blocks until one of the two is written
+int fs_compress ( fs_handle *fs, char *name, bool on );	//packs a file's data compressed; for a directory, the files created in it from now on
+int fs_quota_set ( fs_handle *fs, char *name, int blocks, int entries );	//limits a directory and everything below it; 0 for no limit
+int fs_quota_get ( fs_handle *fs, char *name, fs_quota_type *quota );
+int fs_stat ( fs_handle *fs, char *name, fs_stat_type *stat );
+int fs_readdir ( fs_handle *fs, char *name, fs_entry_type *entries, int max );	//returns the number of entries, fills at most max
+int fs_listdir ( fs_handle *fs, char *name, const char *after, fs_entry_type *entries, int max );	//a page sorted by name, after the cursor "after" ("" first); returns the entries filled
+int fs_read ( fs_handle *fs, char *name, int offset, void *buffer, int length );	//returns bytes read, 0 at the end of the file
+int fs_write ( fs_handle *fs, char *name, int offset, const void *buffer, int length );	//grows the file if needed; returns bytes written
+
+//Vectored input/output: one call moves every segment, looking the file up and checking its blocks once.
+//Segments that follow each other on the disk and in memory are copied together. Writes return the bytes of
+//all segments; reads cut each segment short at the end of the file and return the bytes read.
+typedef struct {
+	int offset;	//in the file
+	void *buffer;
+	int length;
+} fs_segment;
+
+int fs_readv ( fs_handle *fs, char *name, const fs_segment *segments, int count );
+int fs_writev ( fs_handle *fs, char *name, const fs_segment *segments, int count );	//later segments win where they overlap
+
+//A descriptor from fs_open refers to the file itself, so the calls on it skip the name lookup.
+//Descriptors are shared by all handles; once the file is removed they return FS_ERR_NOT_FOUND.
+int fs_open ( fs_handle *fs, char *name );	//returns a descriptor (0 or more)
+int fs_close ( int fd );
+int fs_fstat ( int fd, fs_stat_type *stat );
+int fs_fresize ( int fd, int size );
+int fs_pread ( int fd, int offset, void *buffer, int length );
+int fs_pwrite ( int fd, int offset, const void *buffer, int length );
+int fs_preadv ( int fd, const fs_segment *segments, int count );
+int fs_pwritev ( int fd, const fs_segment *segments, int count );
+
+//Snapshots cover the whole disk. Taking one copies nothing; a block is copied once, when it first
+//changes afterwards, and the copy is shared by every snapshot that saw the block like that.
+typedef struct {
+	char name[FS_NAME_LENGTH];
+	long created;		//seconds since the epoch
+	int blocks;		//blocks the snapshot holds a copy of; it shares the others with the disk
+} fs_snapshot_type;
+
+int fs_snapshot_create ( char *name );
+int fs_snapshot_delete ( char *name );
+int fs_snapshot_rollback ( fs_handle *fs, char *name );	//the disk goes back to the snapshot, which is kept
+int fs_snapshot_list ( fs_snapshot_type *list, int max );	//oldest first; returns the number of snapshots, fills at most max
+
+//Change feed: the calls that change the tree publish an event, and a watch reads the events of one directory,
+//or of every directory below it as well, in the order they happened. The feed keeps a bounded number of
+//events; a watch that falls further behind gets FS_ERR_OVERFLOW once, loses what it missed and should look
+//at its directory again. fs_watch_read takes no lock, so it may run in other threads while the library is
+//in use, one thread per watch. Writes of file data are not published.
+#define FS_EVENT_CREATE 1	//fs_mkdir, fs_mkfile, fs_copy
+#define FS_EVENT_REMOVE 2
+#define FS_EVENT_RENAME 3	//from name to new_name
+#define FS_EVENT_RESIZE 4	//to size bytes
+#define FS_EVENT_RESET 5	//a snapshot rollback replaced the tree; seen by every watch
+
+typedef struct {
+	unsigned long sequence;	//numbers the events of the feed
+	int type;		//FS_EVENT_*
+	int parent;		//control block of the directory the entry is in
+	bool directory;
+	char name[FS_NAME_LENGTH];
+	char new_name[FS_NAME_LENGTH];
+	long size;
+} fs_event;
+
+int fs_watch ( fs_handle *fs, char *name, bool subtree );	//"." is the working directory; returns a watch (0 or more)
+int fs_unwatch ( int watch );
+int fs_watch_read ( int watch, fs_event *events, int max );	//returns the events read; FS_ERR_NOT_FOUND once the directory is removed and they are all read
+
+//A batch creates many entries in one call, all of them or none. The entries are grouped by directory, so each
+//directory takes its new entries in one write and their control blocks are allocated together. A parent is
+//named like a directory anywhere on the disk ("" for the working directory) and may be created earlier in the
+//same batch; as directories are found by name, a directory the batch creates may not share its name with another.
+#define FS_BATCH_MKDIR 1
+#define FS_BATCH_MKFILE 2
+
+typedef struct {
+	int type;		//FS_BATCH_*
+	char *parent;
+	char *name;
+	int size;		//of a file
+} fs_batch_op;
+
+int fs_batch ( fs_handle *fs, const fs_batch_op *ops, int count, int *failed );	//on an error nothing changes and *failed is the op, -1 if the batch as a whole does not fit
+
+//An export writes a directory and everything below it into a read-only image meant to be mapped, not loaded.
+//Its sections start on FS_IMAGE_PAGE boundaries: the header, the node table and the file data. The node
+//table is breadth first, with the exported directory as node 0, so the children of a directory are next to
+//each other, sorted by name, and are looked up by binary search. A file's data is contiguous (holes become
+//zeros) and files of a page or more start on a page. Everything is in the byte order of the host, and a
+//mapped image is used as it is: fs_image_open checks the header, and every other call only what it touches.
+//An image never changes, so its calls may run in any thread, with or without a disk.
+#define FS_IMAGE_MAGIC "FSIMAGE1"
+#define FS_IMAGE_PAGE 4096
+#define FS_IMAGE_DIRECTORY 1	//flags of a node
+
+typedef struct {
+	char magic[8];		//FS_IMAGE_MAGIC, no terminator
+	uint32_t page;		//FS_IMAGE_PAGE the image was written with
+	uint32_t nodes;		//entries of the node table
+	uint64_t node_offset;	//bytes from the start of the image
+	uint64_t data_offset;
+	uint64_t size;		//bytes of the whole image
+} fs_image_header;
+
+typedef struct {
+	char name[FS_NAME_LENGTH];
+	uint32_t flags;		//FS_IMAGE_*
+	uint32_t parent;	//node of the directory it is in; 0 for node 0 itself
+	uint32_t first;		//of a directory: its children are the nodes first up to first+count-1
+	uint32_t count;
+	uint32_t files;		//of a directory: files below it
+	uint64_t offset;	//of a file: where its data starts, in bytes from data_offset
+	uint64_t size;		//bytes; of a directory, of all files below it
+} fs_image_node;
+
+typedef struct fs_image fs_image;
+
+int fs_export ( fs_handle *fs, char *name, const char *path );	//"." is the working directory
+int fs_image_open ( const char *path, fs_image **image );	//maps an image read-only; FS_ERR_INVALID if it is not one
+void fs_image_close ( fs_image *image );
+const fs_image_node *fs_image_lookup ( fs_image *image, const char *path );	//names separated by "/" from node 0 ("" for node 0); NULL if not there
+const fs_image_node *fs_image_child ( fs_image *image, const fs_image_node *directory, const char *name );
+const fs_image_node *fs_image_children ( fs_image *image, const fs_image_node *directory );	//the first of count, NULL for a file
+const void *fs_image_data ( fs_image *image, const fs_image_node *file );	//size bytes in the mapping, NULL for a directory
+
+int fs_command ( fs_handle *fs, const char *line, FILE *out );	//runs one text command, its output goes to out
+bool fs_background_step ( FILE *out );		//one time slice of background work; true while work is left
+
+//A command trace starts with FS_TRACE_MAGIC; then every command run by fs_command follows as one
+//record and the command line itself (record.length bytes, no newline), in the byte order of the host
+#define FS_TRACE_MAGIC "FSTRACE2"
+
+typedef struct {
+	uint64_t start;		//nanoseconds from the start of the trace to the start of the command
+	uint32_t duration;	//nanoseconds the command took
+	uint32_t output;	//CRC-32C of what the command printed
+	uint16_t session;	//handle that ran it, numbered in the order of fs_attach
+	int8_t result;		//what the command returned
+	uint8_t length;		//bytes of the command line after the record
+} fs_trace_record;
+
+int fs_trace_start ( const char *path );	//records every fs_command into path until fs_trace_stop
+void fs_trace_stop ( );
+
+#endif
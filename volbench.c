@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/wait.h>
+#include "simulatedFileSystem.h"
+
+/* Throughput of striped volumes with 1 up to N members.
+ *
+ * For every member count, a child process makes a volume of that many image files, placed
+ * round robin in the directories given (one per device shows the devices adding up), and
+ * then rewrites files that fill most of the disk and syncs, "rounds" times. Then the pages
+ * of the members are dropped from the page cache, and each round a new child mounts the
+ * volume and reads every file back, so each read comes from the members. Every process is
+ * separate since a disk is set up once per process.
+ *
+ * usage: volbench [-n members] [-r rounds] directory...
+ */
+
+#define LINESIZE 128
+#define FILES 7
+#define FILE_SIZE 500000	//bytes per file; together most of the disk
+
+int max_members = 4;
+int rounds = 5;
+char *member_paths[FS_MAX_MEMBERS];
+
+/*--------------------------------------------------------------------------------*/
+
+long now_nanoseconds ( ) {
+	struct timespec now;
+
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Formats a volume of "members" members and rewrites every file each round; returns the nanoseconds
+//of the writes and syncs
+long write_volume ( int members ) {
+	char *buffer = malloc( FILE_SIZE );
+	char name[LINESIZE];
+
+	if ( fs_volume((const char **)member_paths, members) != FS_OK || fs_format() != FS_OK ) {
+		fprintf( stderr, "volbench: cannot make a volume of %d members\n", members );
+		exit(1);
+	}
+	fs_handle *fs = fs_attach();
+	for ( int f = 0; f < FILES; f++ ) {
+		snprintf( name, sizeof(name), "f%d", f );
+		fs_mkfile( fs, name, FILE_SIZE );
+	}
+
+	long start = now_nanoseconds();
+	for ( int r = 0; r < rounds; r++ ) {
+		memset( buffer, 'a' + r, FILE_SIZE );
+		for ( int f = 0; f < FILES; f++ ) {
+			snprintf( name, sizeof(name), "f%d", f );
+			if ( fs_write(fs, name, 0, buffer, FILE_SIZE) != FILE_SIZE ) {
+				fprintf( stderr, "volbench: writing %s failed\n", name );
+				exit(1);
+			}
+		}
+		if ( fs_sync() != FS_OK ) {
+			fprintf( stderr, "volbench: sync failed\n" );
+			exit(1);
+		}
+	}
+	long elapsed = now_nanoseconds() - start;
+
+	fs_detach(fs);
+	free(buffer);
+	return elapsed;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Mounts the volume and reads every file once; returns the nanoseconds of the mount and the reads
+long read_volume ( int members ) {
+	char *buffer = malloc( FILE_SIZE );
+	char name[LINESIZE];
+
+	long start = now_nanoseconds();
+	if ( fs_volume((const char **)member_paths, members) != FS_OK || fs_format() != FS_OK ) {
+		fprintf( stderr, "volbench: cannot mount the volume of %d members\n", members );
+		exit(1);
+	}
+	fs_handle *fs = fs_attach();
+	for ( int f = 0; f < FILES; f++ ) {
+		snprintf( name, sizeof(name), "f%d", f );
+		if ( fs_read(fs, name, 0, buffer, FILE_SIZE) != FILE_SIZE ) {
+			fprintf( stderr, "volbench: reading %s failed\n", name );
+			exit(1);
+		}
+	}
+	long elapsed = now_nanoseconds() - start;
+
+	fs_detach(fs);
+	free(buffer);
+	return elapsed;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Drops the pages of the members from the page cache, once they are on the device
+void drop_members ( int members ) {
+	for ( int m = 0; m < members; m++ ) {
+		int fd = open( member_paths[m], O_RDONLY );
+		if ( fd == -1 )
+			continue;
+		fdatasync( fd );
+		posix_fadvise( fd, 0, 0, POSIX_FADV_DONTNEED );
+		close( fd );
+	}
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Runs "run" in a child process and returns what it measured
+long in_child ( long (*run)(int), int members ) {
+	int channel[2];
+	long elapsed = -1;
+	int status;
+
+	fflush( stdout );
+	if ( pipe(channel) != 0 )
+		return -1;
+	pid_t child = fork();
+	if ( child == 0 ) {
+		elapsed = run( members );
+		if ( write(channel[1], &elapsed, sizeof(elapsed)) != sizeof(elapsed) )
+			_exit(1);
+		_exit(0);
+	}
+	close( channel[1] );
+	if ( child < 0 || read(channel[0], &elapsed, sizeof(elapsed)) != sizeof(elapsed) )
+		elapsed = -1;
+	close( channel[0] );
+	if ( child > 0 )
+		waitpid( child, &status, 0 );
+	return elapsed;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+int main ( int argc, char *argv[] ) {
+	int option;
+
+	while ( (option = getopt(argc, argv, "n:r:")) != -1 ) {
+		if ( option == 'n' )
+			max_members = atoi(optarg);
+		else if ( option == 'r' )
+			rounds = atoi(optarg);
+		else
+			break;
+	}
+	if ( option == '?' || optind == argc || max_members < 1 || max_members > FS_MAX_MEMBERS || rounds < 1 ) {
+		fprintf( stderr, "usage: %s [-n members (1 to %d)] [-r rounds] directory...\n", argv[0], FS_MAX_MEMBERS );
+		return 1;
+	}
+
+	printf("%8s %12s %12s\n", "members", "write MB/s", "read MB/s");
+	for ( int members = 1; members <= max_members; members++ ) {
+		char path[LINESIZE * 2];
+		for ( int m = 0; m < members; m++ ) {
+			snprintf( path, sizeof(path), "%s/volbench.%d.%d.img", argv[optind + m % (argc - optind)], members, m );
+			member_paths[m] = strdup( path );
+			unlink( path );
+		}
+
+		long written = in_child( write_volume, members );
+		long read = 0;
+		for ( int r = 0; r < rounds && read >= 0 && written >= 0; r++ ) {
+			drop_members( members );
+			long took = in_child( read_volume, members );
+			read = took < 0 ? -1 : read + took;
+		}
+		if ( written < 0 || read < 0 ) {
+			fprintf( stderr, "%s: the volume of %d members failed\n", argv[0], members );
+			return 1;
+		}
+
+		double bytes = (double)FILES * FILE_SIZE * rounds;
+		printf("%8d %12.1f %12.1f\n", members, bytes / written * 1e3, bytes / read * 1e3);
+		for ( int m = 0; m < members; m++ ) {
+			unlink( member_paths[m] );
+			free( member_paths[m] );
+		}
+	}
+	return 0;
+}